@@ -0,0 +1,418 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#include "asyncio.h"
+
+
+size_t PwriteFully(int fd, const off_t off, const BYTE_T *buf, const size_t len)
+{
+  size_t done=0;
+
+  while (done<len) {
+    ssize_t sent=pwrite(fd,buf+done,len-done,off+(off_t)done);
+    if (sent<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      break;
+    } else if (sent==0) {
+      break;
+    } else {
+      done+=sent;
+    }
+  }
+  return done;
+}
+
+//
+// A block that has never been written may lie past the end of the
+// data file.  It reads as zeros, as it would have had the file been
+// extended, but without extending it.
+//
+size_t PreadFully(int fd, const off_t off, BYTE_T *buf, const size_t len)
+{
+  size_t done=0;
+
+  while (done<len) {
+    ssize_t got=pread(fd,buf+done,len-done,off+(off_t)done);
+    if (got<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      break;
+    } else if (got==0) {
+      // end of file
+      memset(buf+done,0,len-done);
+      done=len;
+    } else {
+      done+=got;
+    }
+  }
+  return done;
+}
+
+
+//
+// Both of these move along a copy of the iovecs, since a short
+// transfer can end in the middle of one.
+//
+static size_t MoveVectorFully(const bool write, int fd, const off_t off, const struct iovec *iov, const int iovcnt)
+{
+  vector<struct iovec> left(iov,iov+iovcnt);
+  size_t done=0;
+  SIZE_T first=0;
+
+  while (first<left.size()) {
+    int cnt = left.size()-first<(size_t)IOV_MAX ? left.size()-first : IOV_MAX;
+    ssize_t n = write ? pwritev(fd,&(left[first]),cnt,off+(off_t)done)
+                      : preadv(fd,&(left[first]),cnt,off+(off_t)done);
+    if (n<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      break;
+    } else if (n==0) {
+      if (!write) {
+	// end of file, as in PreadFully
+	for (; first<left.size(); first++) {
+	  memset(left[first].iov_base,0,left[first].iov_len);
+	  done+=left[first].iov_len;
+	}
+      }
+      break;
+    }
+    done+=n;
+    while (n>0 && first<left.size()) {
+      size_t take = (size_t)n<left[first].iov_len ? (size_t)n : left[first].iov_len;
+      left[first].iov_base=(BYTE_T*)left[first].iov_base+take;
+      left[first].iov_len-=take;
+      n-=take;
+      if (left[first].iov_len==0) {
+	first++;
+      }
+    }
+    while (first<left.size() && left[first].iov_len==0) {
+      first++;
+    }
+  }
+  return done;
+}
+
+size_t PreadvFully(int fd, const off_t off, const struct iovec *iov, const int iovcnt)
+{
+  return MoveVectorFully(false,fd,off,iov,iovcnt);
+}
+
+size_t PwritevFully(int fd, const off_t off, const struct iovec *iov, const int iovcnt)
+{
+  return MoveVectorFully(true,fd,off,iov,iovcnt);
+}
+
+
+ERROR_T ParseAsyncIOType(const char *name, AsyncIOType &type)
+{
+  if (!strcmp(name,"auto")) {
+    type=ASYNCIO_AUTO;
+  } else if (!strcmp(name,"uring")) {
+    type=ASYNCIO_URING;
+  } else if (!strcmp(name,"threads")) {
+    type=ASYNCIO_THREADS;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+AsyncIO *MakeAsyncIO(const AsyncIOType type, const SIZE_T depth)
+{
+  if (type!=ASYNCIO_THREADS) {
+    URingIO *u=new URingIO(depth);
+    if (u->IsReady()) {
+      return u;
+    }
+    delete u;
+    if (type==ASYNCIO_URING) {
+      return 0;
+    }
+  }
+  return new ThreadPoolIO(depth,depth<4 ? depth : 4);
+}
+
+
+ThreadPoolIO::ThreadPoolIO(const SIZE_T d, const SIZE_T numthreads) :
+  depth(d), inflight(0), stopping(false)
+{
+  for (SIZE_T i=0; i<numthreads || i<1; i++) {
+    workers.push_back(thread(&ThreadPoolIO::Worker,this));
+  }
+}
+
+ThreadPoolIO::~ThreadPoolIO()
+{
+  {
+    lock_guard<mutex> l(latch);
+    stopping=true;
+  }
+  work.notify_all();
+  for (vector<thread>::iterator t=workers.begin(); t!=workers.end(); ++t) {
+    (*t).join();
+  }
+}
+
+void ThreadPoolIO::Worker()
+{
+  unique_lock<mutex> l(latch);
+
+  while (true) {
+    while (jobs.empty() && !stopping) {
+      work.wait(l);
+    }
+    if (jobs.empty()) {
+      return;
+    }
+    Job j=jobs.front();
+    jobs.pop_front();
+    l.unlock();
+
+    size_t n = j.write ? PwriteFully(j.fd,j.off,j.buf,j.len) : PreadFully(j.fd,j.off,j.buf,j.len);
+
+    l.lock();
+    finished.push_back(pair<SIZE_T, ERROR_T>(j.tag, n==j.len ? ERROR_NOERROR : ERROR_IMPLBUG));
+    done.notify_one();
+  }
+}
+
+ERROR_T ThreadPoolIO::Submit(const bool write, int fd, const off_t off, BYTE_T *buf, const size_t len, const SIZE_T tag)
+{
+  if (inflight>=depth) {
+    return ERROR_NOSPACE;
+  }
+
+  Job j;
+
+  j.write=write;
+  j.fd=fd;
+  j.off=off;
+  j.buf=buf;
+  j.len=len;
+  j.tag=tag;
+  {
+    lock_guard<mutex> l(latch);
+    jobs.push_back(j);
+  }
+  inflight++;
+  work.notify_one();
+  return ERROR_NOERROR;
+}
+
+ERROR_T ThreadPoolIO::Wait(SIZE_T &tag, ERROR_T &result)
+{
+  if (inflight==0) {
+    return ERROR_NONEXISTENT;
+  }
+
+  unique_lock<mutex> l(latch);
+
+  while (finished.empty()) {
+    done.wait(l);
+  }
+  tag=finished.front().first;
+  result=finished.front().second;
+  finished.pop_front();
+  inflight--;
+  return ERROR_NOERROR;
+}
+
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+URingIO::URingIO(const SIZE_T d) :
+  ringfd(-1), sqring(MAP_FAILED), cqring(MAP_FAILED), sqringsize(0), cqringsize(0),
+  sqes(MAP_FAILED), sqessize(0), depth(d), inflight(0)
+{
+  struct io_uring_params p;
+
+  memset(&p,0,sizeof(p));
+  ringfd=syscall(__NR_io_uring_setup,(unsigned)depth,&p);
+  if (ringfd<0) {
+    // No io_uring here (old kernel, or not allowed)
+    ringfd=-1;
+    return;
+  }
+
+  sqringsize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  cqringsize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sqringsize = cqringsize>sqringsize ? cqringsize : sqringsize;
+    cqringsize=sqringsize;
+  }
+  sqring=mmap(0,sqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQ_RING);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqring=sqring;
+  } else {
+    cqring=mmap(0,cqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_CQ_RING);
+  }
+  sqessize=p.sq_entries*sizeof(struct io_uring_sqe);
+  sqes=mmap(0,sqessize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQES);
+  if (sqring==MAP_FAILED || cqring==MAP_FAILED || sqes==MAP_FAILED) {
+    // Nothing is in flight, so this only unmaps and closes
+    Teardown();
+    return;
+  }
+
+  sqhead=(unsigned*)((char*)sqring+p.sq_off.head);
+  sqtail=(unsigned*)((char*)sqring+p.sq_off.tail);
+  sqmask=(unsigned*)((char*)sqring+p.sq_off.ring_mask);
+  sqarray=(unsigned*)((char*)sqring+p.sq_off.array);
+  cqhead=(unsigned*)((char*)cqring+p.cq_off.head);
+  cqtail=(unsigned*)((char*)cqring+p.cq_off.tail);
+  cqmask=(unsigned*)((char*)cqring+p.cq_off.ring_mask);
+  cqes=(char*)cqring+p.cq_off.cqes;
+
+  // The kernel may round the ring up, but we stick to depth
+  slots.resize(depth);
+  iovs.resize(depth);
+  for (SIZE_T i=depth; i>0; i--) {
+    freeslots.push_back(i-1);
+  }
+}
+
+URingIO::~URingIO()
+{
+  SIZE_T tag;
+  ERROR_T result;
+
+  // The kernel may still be writing into buffers; let it finish
+  while (ringfd>=0 && inflight>0 && Reap(tag,result)==ERROR_NOERROR) {
+  }
+  Teardown();
+}
+
+void URingIO::Teardown()
+{
+  if (sqes!=MAP_FAILED) {
+    munmap(sqes,sqessize);
+  }
+  if (cqring!=MAP_FAILED && cqring!=sqring) {
+    munmap(cqring,cqringsize);
+  }
+  if (sqring!=MAP_FAILED) {
+    munmap(sqring,sqringsize);
+  }
+  if (ringfd>=0) {
+    close(ringfd);
+  }
+  ringfd=-1;
+  sqring=cqring=sqes=MAP_FAILED;
+}
+
+ERROR_T URingIO::Submit(const bool write, int fd, const off_t off, BYTE_T *buf, const size_t len, const SIZE_T tag)
+{
+  if (freeslots.empty()) {
+    return ERROR_NOSPACE;
+  }
+
+  SIZE_T slot=freeslots.back();
+  Slot &s=slots[slot];
+
+  s.write=write;
+  s.fd=fd;
+  s.off=off;
+  s.buf=buf;
+  s.len=len;
+  s.tag=tag;
+  iovs[slot].iov_base=buf;
+  iovs[slot].iov_len=len;
+
+  // We are the only producer, so the tail is ours to read
+  unsigned tail=*sqtail;
+  unsigned index=tail & *sqmask;
+  struct io_uring_sqe *sqe=&(((struct io_uring_sqe*)sqes)[index]);
+
+  memset(sqe,0,sizeof(*sqe));
+  sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd=fd;
+  sqe->off=off;
+  sqe->addr=(unsigned long)&(iovs[slot]);
+  sqe->len=1;
+  sqe->user_data=slot;
+  sqarray[index]=index;
+  __atomic_store_n(sqtail,tail+1,__ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter,ringfd,1,0,0,NULL,0)<0) {
+    if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY) {
+      cerr << "URingIO::Submit: io_uring_enter has failed: "<<strerror(errno)<<endl;
+      // Take the entry back, since the kernel never saw it
+      __atomic_store_n(sqtail,tail,__ATOMIC_RELEASE);
+      return ERROR_IMPLBUG;
+    }
+  }
+  freeslots.pop_back();
+  inflight++;
+  return ERROR_NOERROR;
+}
+
+ERROR_T URingIO::Reap(SIZE_T &tag, ERROR_T &result)
+{
+  unsigned head=*cqhead;
+
+  while (head==__atomic_load_n(cqtail,__ATOMIC_ACQUIRE)) {
+    if (syscall(__NR_io_uring_enter,ringfd,0,1,IORING_ENTER_GETEVENTS,NULL,0)<0 && errno!=EINTR) {
+      cerr << "URingIO::Wait: io_uring_enter has failed: "<<strerror(errno)<<endl;
+      return ERROR_IMPLBUG;
+    }
+  }
+
+  struct io_uring_cqe *cqe=&(((struct io_uring_cqe*)cqes)[head & *cqmask]);
+  SIZE_T slot=cqe->user_data;
+  int res=cqe->res;
+
+  __atomic_store_n(cqhead,head+1,__ATOMIC_RELEASE);
+
+  Slot &s=slots[slot];
+
+  if (res<0) {
+    cerr << "URingIO::Wait: request failed: "<<strerror(-res)<<endl;
+    result=ERROR_IMPLBUG;
+  } else if ((size_t)res<s.len) {
+    // Short, or off the end of the file; finish it by hand
+    size_t rest = s.write ? PwriteFully(s.fd,s.off+res,s.buf+res,s.len-res)
+                          : PreadFully(s.fd,s.off+res,s.buf+res,s.len-res);
+    result = rest==s.len-res ? ERROR_NOERROR : ERROR_IMPLBUG;
+  } else {
+    result=ERROR_NOERROR;
+  }
+  tag=s.tag;
+  freeslots.push_back(slot);
+  inflight--;
+  return ERROR_NOERROR;
+}
+
+ERROR_T URingIO::Wait(SIZE_T &tag, ERROR_T &result)
+{
+  if (inflight==0) {
+    return ERROR_NONEXISTENT;
+  }
+  return Reap(tag,result);
+}
+
+#else
+
+// No io_uring on this system, so MakeAsyncIO always falls back
+URingIO::URingIO(const SIZE_T d) : ringfd(-1), depth(d), inflight(0) {}
+URingIO::~URingIO() {}
+void URingIO::Teardown() {}
+ERROR_T URingIO::Submit(const bool write, int fd, const off_t off, BYTE_T *buf, const size_t len, const SIZE_T tag) { return ERROR_UNIMPL; }
+ERROR_T URingIO::Reap(SIZE_T &tag, ERROR_T &result) { return ERROR_UNIMPL; }
+ERROR_T URingIO::Wait(SIZE_T &tag, ERROR_T &result) { return ERROR_UNIMPL; }
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _asyncio
+#define _asyncio
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Moves all of len bytes at off in fd, looping on short transfers
+// and EINTR.  A read that runs off the end of the file fills the
+// rest of buf with zeros.  Each returns the number of bytes moved,
+// which is len unless something went wrong.
+//
+size_t PreadFully(int fd, const off_t off, BYTE_T *buf, const size_t len);
+size_t PwriteFully(int fd, const off_t off, const BYTE_T *buf, const size_t len);
+// The same for iovcnt buffers, one after another in the file, with
+// as few system calls as the kernel allows.  iov is left alone.
+size_t PreadvFully(int fd, const off_t off, const struct iovec *iov, const int iovcnt);
+size_t PwritevFully(int fd, const off_t off, const struct iovec *iov, const int iovcnt);
+
+
+enum AsyncIOType {ASYNCIO_AUTO, ASYNCIO_URING, ASYNCIO_THREADS};
+
+// Names are auto, uring, and threads.  ERROR_BADCONFIG otherwise.
+ERROR_T ParseAsyncIOType(const char *name, AsyncIOType &type);
+
+//
+// Host side of asynchronous disk I/O: requests are started by Submit
+// and finish in any order.  Each carries a tag, which Wait hands back
+// along with the request's result when it is done.  At most depth
+// requests may be in flight; Submit returns ERROR_NOSPACE beyond
+// that.  The buffer must stay put until the request is done.
+//
+// An AsyncIO is used by one thread at a time.
+//
+class AsyncIO {
+ public:
+  virtual ~AsyncIO() {}
+  virtual const char *GetName() const = 0;
+  virtual ERROR_T Submit(const bool write,
+			 int fd,
+			 const off_t off,
+			 BYTE_T *buf,
+			 const size_t len,
+			 const SIZE_T tag) = 0;
+  // Wait for any request to finish
+  // ERROR_NONEXISTENT if none are in flight
+  virtual ERROR_T Wait(SIZE_T &tag, ERROR_T &result) = 0;
+  virtual SIZE_T  GetNumInFlight() const = 0;
+};
+
+// ASYNCIO_AUTO means io_uring if the kernel has it, else threads.
+// Returns 0 if ASYNCIO_URING is asked for and can't be had.
+AsyncIO *MakeAsyncIO(const AsyncIOType type, const SIZE_T depth);
+
+
+//
+// The fallback: a few worker threads doing PreadFully and
+// PwriteFully.
+//
+class ThreadPoolIO : public AsyncIO {
+ private:
+  struct Job {
+    bool    write;
+    int     fd;
+    off_t   off;
+    BYTE_T *buf;
+    size_t  len;
+    SIZE_T  tag;
+  };
+  vector<thread>          workers;
+  mutex                   latch;
+  condition_variable      work, done;
+  deque<Job>              jobs;
+  deque<pair<SIZE_T, ERROR_T> > finished;   // (tag, result)
+  SIZE_T                  depth;
+  SIZE_T                  inflight;
+  bool                    stopping;
+
+  void Worker();
+ public:
+  ThreadPoolIO(const SIZE_T depth, const SIZE_T numthreads);
+  ~ThreadPoolIO();
+  const char *GetName() const { return "threads"; }
+  ERROR_T Submit(const bool write, int fd, const off_t off, BYTE_T *buf, const size_t len, const SIZE_T tag);
+  ERROR_T Wait(SIZE_T &tag, ERROR_T &result);
+  SIZE_T  GetNumInFlight() const { return inflight; }
+};
+
+
+//
+// io_uring, driven with the raw system calls so that we need no
+// library.  Reads and writes go in as READV and WRITEV, which every
+// kernel with io_uring has.  A request that comes back short is
+// finished with PreadFully or PwriteFully.
+//
+class URingIO : public AsyncIO {
+ private:
+  struct Slot {
+    bool         write;
+    int          fd;
+    off_t        off;
+    BYTE_T      *buf;
+    size_t       len;
+    SIZE_T       tag;
+  };
+  int             ringfd;
+  void           *sqring, *cqring;
+  size_t          sqringsize, cqringsize;
+  void           *sqes;
+  size_t          sqessize;
+  unsigned       *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned       *cqhead, *cqtail, *cqmask;
+  void           *cqes;
+  SIZE_T          depth;
+  vector<Slot>    slots;
+  vector<struct iovec> iovs;
+  vector<SIZE_T>  freeslots;
+  SIZE_T          inflight;
+
+  ERROR_T Reap(SIZE_T &tag, ERROR_T &result);
+  void    Teardown();
+ public:
+  URingIO(const SIZE_T depth);
+  ~URingIO();
+  bool        IsReady() const { return ringfd>=0; }
+  const char *GetName() const { return "io_uring"; }
+  ERROR_T Submit(const bool write, int fd, const off_t off, BYTE_T *buf, const size_t len, const SIZE_T tag);
+  ERROR_T Wait(SIZE_T &tag, ERROR_T &result);
+  SIZE_T  GetNumInFlight() const { return inflight; }
+};
+
+#endif
@@ -3,18 +3,18 @@
 
 #include "block.h"
 
-Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false), borrowed(false)
 {}
 
 
-Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false), borrowed(false)
 {
   Resize(s);
 }
 
 
 
-Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty)
+Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty), borrowed(false)
 {
   if (Resize(rhs.length)!=ERROR_NOERROR) { 
     throw GenericException();
@@ -22,7 +22,7 @@ Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccess
   memcpy(data,rhs.data,rhs.length);
 }
 
-Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false), borrowed(false)
 {
   if (Resize(strlen(str))!=ERROR_NOERROR) { 
     throw GenericException();
@@ -30,9 +30,13 @@ Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(fal
   memcpy(data,str,strlen(str));
 }
 
+Block::Block(BYTE_T *d, const SIZE_T s) : data(d), length(s), lastaccessed(-1), dirty(false), borrowed(true)
+{}
+
 Block::~Block() 
 { 
-  if (data) { delete [] data; data=0; }
+  if (data && !borrowed) { delete [] data; }
+  data=0;
   length=0;
   lastaccessed=-1;
   dirty=false;
@@ -40,7 +44,16 @@ Block::~Block()
 
 Block & Block::operator=(const Block &rhs)
 {
-  return *(new (this) Block(rhs));
+  if (this==&rhs) { 
+    return *this;
+  }
+  if (Resize(rhs.length,false)!=ERROR_NOERROR) { 
+    throw GenericException();
+  }
+  memcpy(data,rhs.data,rhs.length);
+  lastaccessed=rhs.lastaccessed;
+  dirty=rhs.dirty;
+  return *this;
 }
 
 
@@ -50,6 +63,10 @@ Block & Block::operator=(const Block &rhs)
 ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
 {
   BYTE_T *d;
+
+  if (newlen==length && data) { 
+    return ERROR_NOERROR;
+  }
   
   try {
     d = new BYTE_T [newlen];
@@ -62,8 +79,9 @@ ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
     memcpy(d,data,MIN(newlen,length));
   }
   
-  if (data) { delete [] data; }
+  if (data && !borrowed) { delete [] data; }
   data = d;
+  borrowed = false;
 
   length=newlen;
 
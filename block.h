@@ -12,16 +12,23 @@ struct Block {
   SIZE_T 	length;
   double        lastaccessed;  // for use in buffercache only
   bool          dirty;         // for use in buffercahce only
+  bool          borrowed;      // data belongs to someone else
 
   Block();
   Block(const SIZE_T size);
   Block(const Block &rhs);
   Block(const char *data);
+  // Wrap memory owned by someone else (e.g., a buffer cache frame)
+  // It is not freed when the block goes away
+  Block(BYTE_T *data, const SIZE_T size);
   virtual ~Block();
+  // Copies into the existing buffer if the lengths match
   Block & operator=(const Block &rhs);
 
   // returns one of ERROR_NOERROR (zero)
   // ERROR_NOMEM or other nonzero error code.
+  // Does nothing if the length is unchanged.  A borrowed block
+  // that changes length gets its own buffer.
   ERROR_T Resize(const SIZE_T newlength, const bool copy=true);
 
   bool operator<(const Block &rhs) const;
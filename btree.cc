@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <string.h>
 #include "btree.h"
 
 KeyValuePair::KeyValuePair()
@@ -24,6 +25,36 @@ KeyValuePair & KeyValuePair::operator=(const KeyValuePair &rhs)
   return *( new (this) KeyValuePair(rhs));
 }
 
+
+static const char *nodetypenames[] = {"free", "superblock", "root", "interior", "leaf", "other"};
+
+SIZE_T BTreeBlockClassifier::GetNumClasses() const
+{
+  return BTREE_LEAF_NODE+2;
+}
+
+const char *BTreeBlockClassifier::GetClassName(const SIZE_T c) const
+{
+  return nodetypenames[c<=BTREE_LEAF_NODE ? c : BTREE_LEAF_NODE+1];
+}
+
+SIZE_T BTreeBlockClassifier::Classify(const SIZE_T blocknum, const Block &block) const
+{
+  NodeMetadata info;
+
+  if (block.length<sizeof(info)) { 
+    return BTREE_LEAF_NODE+1;
+  }
+  memcpy(&info,block.data,sizeof(info));
+  if (info.nodetype<BTREE_UNALLOCATED_BLOCK || info.nodetype>BTREE_LEAF_NODE) { 
+    return BTREE_LEAF_NODE+1;
+  }
+  return info.nodetype;
+}
+
+// Stateless, so every index can share it
+static const BTreeBlockClassifier btreeclassifier;
+
 BTreeIndex::BTreeIndex(SIZE_T keysize, 
 		       SIZE_T valuesize,
 		       BufferCache *cache,
@@ -32,6 +63,7 @@ BTreeIndex::BTreeIndex(SIZE_T keysize,
   superblock.info.keysize=keysize;
   superblock.info.valuesize=valuesize;
   buffercache=cache;
+  buffercache->SetBlockClassifier(&btreeclassifier);
   // note: ignoring unique now
 }
 
@@ -63,52 +95,22 @@ BTreeIndex & BTreeIndex::operator=(const BTreeIndex &rhs)
 }
 
 
+//
+// The disk's allocation bitmap is the free space map, so allocating
+// doesn't read the free block and freeing doesn't write it.
+// superblock.info.freelist is no longer kept.
+//
 ERROR_T BTreeIndex::AllocateNode(SIZE_T &n)
 {
-  n=superblock.info.freelist;
-
-  if (n==0) { 
-    return ERROR_NOSPACE;
-  }
-
-  BTreeNode node;
-
-  node.Unserialize(buffercache,n);
-
-  assert(node.info.nodetype==BTREE_UNALLOCATED_BLOCK);
-
-  superblock.info.freelist=node.info.freelist;
-
-  superblock.Serialize(buffercache,superblock_index);
-
-  buffercache->NotifyAllocateBlock(n);
-
-  return ERROR_NOERROR;
+  return buffercache->AllocateBlocks(1,n);
 }
 
 
 ERROR_T BTreeIndex::DeallocateNode(const SIZE_T &n)
 {
-  BTreeNode node;
-
-  node.Unserialize(buffercache,n);
-
-  assert(node.info.nodetype!=BTREE_UNALLOCATED_BLOCK);
-
-  node.info.nodetype=BTREE_UNALLOCATED_BLOCK;
-
-  node.info.freelist=superblock.info.freelist;
-
-  node.Serialize(buffercache,n);
-
-  superblock.info.freelist=n;
-
-  superblock.Serialize(buffercache,superblock_index);
-
-  buffercache->NotifyDeallocateBlock(n);
-
-  return ERROR_NOERROR;
+  assert(buffercache->IsBlockAllocated(n));
 
+  return buffercache->NotifyDeallocateBlock(n);
 }
 
 ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
@@ -119,19 +121,27 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
   assert(superblock_index==0);
 
   if (create) {
-    // build a super block, root node, and a free space list
+    // build a super block and root node
     //
     // Superblock at superblock_index
     // root node at superblock_index+1
-    // free space list for rest
+    // rest is free in the allocation bitmap
     BTreeNode newsuperblock(BTREE_SUPERBLOCK,
 			    superblock.info.keysize,
 			    superblock.info.valuesize,
 			    buffercache->GetBlockSize());
     newsuperblock.info.rootnode=superblock_index+1;
-    newsuperblock.info.freelist=superblock_index+2;
+    newsuperblock.info.freelist=0;
     newsuperblock.info.numkeys=0;
 
+    // Whatever was here before is gone
+    rc=buffercache->ClearAllocations(superblock_index,
+				     buffercache->GetNumBlocks()-superblock_index);
+
+    if (rc) { 
+      return rc;
+    }
+
     buffercache->NotifyAllocateBlock(superblock_index);
 
     rc=newsuperblock.Serialize(buffercache,superblock_index);
@@ -145,7 +155,7 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
 			  superblock.info.valuesize,
 			  buffercache->GetBlockSize());
     newrootnode.info.rootnode=superblock_index+1;
-    newrootnode.info.freelist=superblock_index+2;
+    newrootnode.info.freelist=0;
     newrootnode.info.numkeys=0;
 
     buffercache->NotifyAllocateBlock(superblock_index+1);
@@ -155,22 +165,6 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
     if (rc) { 
       return rc;
     }
-
-    for (SIZE_T i=superblock_index+2; i<buffercache->GetNumBlocks();i++) { 
-      BTreeNode newfreenode(BTREE_UNALLOCATED_BLOCK,
-			    superblock.info.keysize,
-			    superblock.info.valuesize,
-			    buffercache->GetBlockSize());
-      newfreenode.info.rootnode=superblock_index+1;
-      newfreenode.info.freelist= ((i+1)==buffercache->GetNumBlocks()) ? 0: i+1;
-      
-      rc = newfreenode.Serialize(buffercache,i);
-
-      if (rc) {
-	return rc;
-      }
-
-    }
   }
 
   // OK, now, mounting the btree is simply a matter of reading the superblock 
@@ -190,61 +184,49 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
 					   const KEY_T &key,
 					   VALUE_T &value)
 {
-  BTreeNode b;
+  BTreeNodeView b;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T testkey;
   SIZE_T ptr;
 
-  rc= b.Unserialize(buffercache,node);
+  // Look at the node in its cached block; nothing is copied out of it
+  rc= b.Open(buffercache,node);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
   }
 
-  switch (b.info.nodetype) { 
+  switch (b.info->nodetype) { 
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
-    // Scan through key/ptr pairs
-    //and recurse if possible
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      //if (key<testkey || key==testkey) {
-      if (key<testkey) {
-      	// OK, so we now have the first key that's larger
-      	// so we ned to recurse on the ptr immediately previous to 
-      	// this one, if it exists
-      	rc=b.GetPtr(offset,ptr);
-      	if (rc) { return rc; }
-      	return LookupOrUpdateInternal(ptr,op,key,value);
-      }
-    }
-    // if we got here, we need to go to the next pointer, if it exists
-    if (b.info.numkeys>0) { 
-      rc=b.GetPtr(b.info.numkeys,ptr);
-      if (rc) { return rc; }
-      return LookupOrUpdateInternal(ptr,op,key,value);
-    } else {
+    if (b.info->numkeys==0) { 
       // There are no keys at all on this node, so nowhere to go
       return ERROR_NONEXISTENT;
     }
+    // Find the first key that's larger, and recurse on the ptr
+    // immediately previous to it, which is the last ptr if there
+    // is no such key
+    offset=b.UpperBound(key);
+    rc=b.GetPtr(offset,ptr);
+    if (rc) { return rc; }
+    // Only the child needs to stay pinned
+    rc=b.Close();
+    if (rc) { return rc; }
+    return LookupOrUpdateInternal(ptr,op,key,value);
     break;
   case BTREE_LEAF_NODE:
-    // Scan through keys looking for matching value
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (testkey==key) { 
-      	if (op==BTREE_OP_LOOKUP) { 
-      	  return b.GetVal(offset,value);
-      	} else { 
-      	  // BTREE_OP_UPDATE
-      	  // WRITE ME
-      	  rc=b.SetVal(offset, value);
-      	  if(rc) { return rc; }
-      	  return b.Serialize(buffercache, node);
-      	}
+    // Search the keys for a matching one
+    offset=b.LowerBound(key);
+    if (offset<b.info->numkeys && b.CompareKey(offset,key)==0) { 
+      if (op==BTREE_OP_LOOKUP) { 
+	return b.GetVal(offset,value);
+      } else { 
+	// BTREE_OP_UPDATE
+	// The value is changed in the cached block
+	rc=b.SetVal(offset, value);
+	if(rc) { return rc; }
+	b.MarkDirty();
+	return b.Close();
       }
     }
     return ERROR_NONEXISTENT;
@@ -359,23 +341,16 @@ ERROR_T BTreeIndex::Lookup(const KEY_T &key, VALUE_T &value)
 ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
 {
   // WRITE ME
-  BTreeNode b;
   ERROR_T rc;
   SIZE_T newnode;
   KEY_T newkey;
-  SIZE_T offset;
-  KEY_T keyhold;
-  BTreeNode root;
+  BTreeNodeView root;
         
   rc =  Lookup(key, (VALUE_T&)value);
   if(rc!=ERROR_NONEXISTENT){
     return ERROR_CONFLICT;
   }
 
-  //load root
-  rc = root.Unserialize(buffercache, superblock.info.rootnode);
-  if (rc) {  return rc; }
-
   //allocate the newnode holder
   rc = AllocateNode(newnode);
   if(rc!=ERROR_NOERROR){return rc;}
@@ -391,55 +366,18 @@ ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
         //else just add
 
   if(newnode!=0){
+    //load root, only now, so that it isn't pinned the whole way down
+    rc = root.Open(buffercache, superblock.info.rootnode);
+    if (rc) {  return rc; }
+
     //check if full
     //if not, just insert
-    if(root.info.numkeys<root.info.GetNumSlotsAsInterior()){
+    if(root.MakeRoom(newkey)){
       //get where to insert key
-      int insertAt; //save offset where key is inserted so you know where to put value
-      int found = 0;
-      for (offset=0;offset<root.info.numkeys;offset++) { 
-        rc=root.GetKey(offset,keyhold);
-        if (rc) {  return rc; }
-        if (newkey<keyhold) {
-          insertAt=offset;
-          found=1;
-          break;
-        }
-      }
-      if(found==0){
-        insertAt = root.info.numkeys;
-      }
-
-      //END CASE
-
-
-
-      //slide everything over
-      int i;
-      SIZE_T ptrhold;
-      root.info.numkeys++;
-      for(i=root.info.numkeys; i>insertAt+1; i--){
-        rc=root.GetKey(i-2,keyhold);
-        if (rc) {  return rc; }
-        rc=root.SetKey(i-1,keyhold);
-        if (rc) {  return rc; }
-      }
-        
-      //slide everything over
-      
-      // SIZE_T ptrhold;
-      // root.info.numkeys++;
-      for(i=root.info.numkeys+1; i>insertAt+2; i--){        
-        rc=root.GetPtr(i-2,ptrhold);
-        if (rc) {  return rc; }
-        rc=root.SetPtr(i-1,ptrhold);
-        if (rc) {  return rc; }
-      }
-      
-
-
-
+      SIZE_T insertAt=root.UpperBound(newkey); //save offset where key is inserted so you know where to put value
 
+      //slide everything over, in the block
+      root.OpenSlot(insertAt,insertAt+1);
 
       //insert the new stuff
       rc=root.SetKey(insertAt,newkey);
@@ -451,37 +389,44 @@ ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
       //root.info.numkeys++;
       newnode=0;
 
-      return root.Serialize(buffercache, superblock.info.rootnode);
+      root.MarkDirty();
+      return root.Close();
     }
   
     //else, split
     else{
+      //split pins the root itself
+      NodeMetadata proto = *root.info;
+      rc = root.Close();
+      if (rc) {  return rc; }
       rc = Split(superblock.info.rootnode, key, value, newnode, newkey);
       if (rc) {  return rc; }
 
       //make new root
       SIZE_T newrootptr;
-      BTreeNode newroot;
+      BTreeNodeView newroot;
 
       rc = AllocateNode(newrootptr);
       if (rc) {  return rc; }
-      newroot = root;
+      rc = newroot.Create(buffercache, newrootptr, proto, BTREE_ROOT_NODE);
+      if (rc) {  
+        DeallocateNode(newrootptr);
+        return rc; 
+      }
+
+      //set count
+      newroot.info->numkeys = 1;
 
       //set key ptrs
       newroot.SetKey(0, newkey);
       newroot.SetPtr(0, superblock.info.rootnode);
       newroot.SetPtr(1, newnode);
 
-      //reset count
-      newroot.info.numkeys = 1;
-
-      newroot.info.nodetype=BTREE_ROOT_NODE;
-
       //set superblock root
       superblock.info.rootnode = newrootptr;
 
       //write to disk
-      return newroot.Serialize(buffercache, newrootptr);
+      return newroot.Close();
 
     }
   }
@@ -491,138 +436,88 @@ ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
 
 ERROR_T BTreeIndex::InsertInternal(SIZE_T &node, const KEY_T &key, const VALUE_T &value, SIZE_T &newnode, KEY_T &newkey)
 {
-  BTreeNode b;
-  BTreeNode child;
-  BTreeNode child2;
+  BTreeNodeView b;
+  BTreeNodeView child;
   ERROR_T rc;
-  SIZE_T offset;
-  KEY_T keyhold;
   SIZE_T childptr;
   SIZE_T childptr2;
-  int found; //if insert location has been found
-  int childfound;
 
   //load node
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Open(buffercache,node);
   if (rc!=ERROR_NOERROR) { return rc;}
 
   //figure out which child it should go to
   //the desired child will be saved in childptr
-  // Scan through key/ptr pairs
-  childfound=0;
-  for (offset=0;offset<b.info.numkeys;offset++) { 
-    rc=b.GetKey(offset,keyhold);
-    if (rc) {  return rc; }
-    if (key<keyhold) {
-      // OK, so we now have the first key that's larger
-      // so we need to recurse on the ptr immediately previous to 
-      // this one, if it exists
-      rc=b.GetPtr(offset,childptr);
-      if (rc) { return rc; }
-      childfound=1;
-      break;
-    }
-  }
-  // if we got here, we need to go to the next pointer, if it exists
-  if (b.info.numkeys>0 && childfound==0) { 
-    rc=b.GetPtr(b.info.numkeys,childptr);
+  //it's the ptr immediately previous to the first key that's larger
+  if (b.info->numkeys>0) { 
+    rc=b.GetPtr(b.UpperBound(key),childptr);
     if (rc) { return rc; }
   } 
-  if (b.info.numkeys==0) {
+  if (b.info->numkeys==0) {
     // There are no keys at all on this node, so nowhere to go
     //should only get here if root on initialization
     //make TWO children 
     rc = AllocateNode(childptr);
     if (rc) {  return rc; }
     rc = AllocateNode(childptr2);
-    if (rc) {  return rc; }
-
-
-    child = b;
-    child.info.numkeys=0;
-    child.info.nodetype = BTREE_LEAF_NODE;
-    rc = child.Serialize(buffercache, childptr);
-    if (rc) {  return rc; }
-
+    if (rc) {  
+      DeallocateNode(childptr);
+      return rc; 
+    }
 
-    child2 = child;
-    rc = child2.Serialize(buffercache, childptr2);
+    //let go of b while the children are made, so that only one
+    //block is pinned at a time
+    NodeMetadata proto = *b.info;
+    rc = b.Close();
     if (rc) {  return rc; }
 
+    rc = child.Create(buffercache, childptr, proto, BTREE_LEAF_NODE);
+    if (rc==ERROR_NOERROR) { 
+      rc = child.Close();
+    }
+    if (rc==ERROR_NOERROR) { 
+      rc = child.Create(buffercache, childptr2, proto, BTREE_LEAF_NODE);
+    }
+    if (rc==ERROR_NOERROR) { 
+      rc = child.Close();
+    }
+    if (rc==ERROR_NOERROR) { 
+      rc = b.Open(buffercache,node);
+    }
+    if (rc) {  
+      DeallocateNode(childptr);
+      DeallocateNode(childptr2);
+      return rc; 
+    }
 
-    b.info.numkeys=1;
+    b.info->numkeys=1;
     b.SetKey(0, key);
     b.SetPtr(1, childptr);
     b.SetPtr(0, childptr2);
-    b.Serialize(buffercache, node);
+    b.MarkDirty();
     //return ERROR_NONEXISTENT;
   }
+  // Only the child needs to stay pinned from here on
+  rc = b.Close();
+  if (rc) {  return rc; }
 
   //check what kind of node the child is
   //load node
-  rc = child.Unserialize(buffercache,childptr);
+  rc = child.Open(buffercache,childptr);
   if (rc!=ERROR_NOERROR) { return rc;}
 
   //if leaf
-  //cout << child.info.nodetype;
-  if(child.info.nodetype==BTREE_LEAF_NODE){
+  //cout << child.info->nodetype;
+  if(child.info->nodetype==BTREE_LEAF_NODE){
 
     //if not full, insert
-    if(child.info.numkeys<child.info.GetNumSlotsAsLeaf()){
+    if(child.MakeRoom(key)){
 
       //get where to insert key
-      int insertAt; //save offset where key is inserted so you know where to put value
-      
-      if(child.info.numkeys==0){
-        insertAt=0;
-        child.info.numkeys++;
-      }
-      else{
-        found = 0;
-        for (offset=0;offset<child.info.numkeys;offset++) { 
-          rc=child.GetKey(offset,keyhold);
-          if (rc) {  return rc; }
-          if (key<keyhold) {
-            insertAt=offset;
-            found = 1;
-            break;
-          }
-        }
-        if(found==0){
-          insertAt = child.info.numkeys;
-        }     
-
-        //slide everything over
-        child.info.numkeys++;
-        int i;
-        VALUE_T valhold;
-        for(i=child.info.numkeys; i>insertAt+1; i--){
-          rc=child.GetKey(i-2,keyhold);
-          if (rc) {  return rc; }
-          rc=child.SetKey(i-1,keyhold);
-          if (rc) {  return rc; }
-          
-          rc=child.GetVal(i-2,valhold);
-          if (rc) {  return rc; }
-          rc=child.SetVal(i-1,valhold);
-          if (rc) {  return rc; }
-        }
+      SIZE_T insertAt=child.UpperBound(key); //save offset where key is inserted so you know where to put value
 
-        // //slide everything over
-        // int i;
-        // VALUE_T valhold;
-        // for(i=child.info.numkeys-1; i>=insertAt; i--){
-        //   rc=child.GetKey(i,keyhold);
-        //   if (rc) {  return rc; }
-        //   rc=child.SetKey(i+1,keyhold);
-        //   if (rc) {  return rc; }
-          
-        //   rc=child.GetVal(i,valhold);
-        //   if (rc) {  return rc; }
-        //   rc=child.SetVal(i+1,valhold);
-        //   if (rc) {  return rc; }
-        // }
-      }
+      //slide everything over, in the block
+      child.OpenSlot(insertAt,0);
 
       //insert the new stuff
       rc=child.SetKey(insertAt,key);
@@ -631,10 +526,11 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &node, const KEY_T &key, const VALUE_T
       if (rc) {  return rc; }
 
       //increment number of keys
-      //child.info.numkeys++;
+      //child.info->numkeys++;
       newnode=0;
 
-      return child.Serialize(buffercache,childptr);
+      child.MarkDirty();
+      return child.Close();
     }
 
     
@@ -642,13 +538,18 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &node, const KEY_T &key, const VALUE_T
     else{
       //call split, split will insert
       //set newnode and newkey to return
+      rc = child.Close();
+      if (rc) {  return rc; }
       return Split(childptr, key, value, newnode, newkey);
     }
   }
 
   //else, child is internal
   else{
-    //recursive call
+    //recursive call, with child let go so that only the node being
+    //changed is ever pinned
+    rc = child.Close();
+    if (rc!=ERROR_NOERROR) { return rc;}
     rc = InsertInternal(childptr, key, value, newnode, newkey);
     if (rc!=ERROR_NOERROR) { return rc;}
 
@@ -656,50 +557,36 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &node, const KEY_T &key, const VALUE_T
       //if the update makes it full now, split, rewrite newnode to be the newly added node from split
 
     if(newnode!=0){
+      rc = child.Open(buffercache,childptr);
+      if (rc!=ERROR_NOERROR) { return rc;}
+
       //check if full
       //if not, just insert
-      if(child.info.numkeys<child.info.GetNumSlotsAsInterior()){
+      if(child.MakeRoom(newkey)){
         //get where to insert key
-        int insertAt; //save offset where key is inserted so you know where to put value
-        for (offset=0;offset<child.info.numkeys;offset++) { 
-          rc=child.GetKey(offset,keyhold);
-          if (rc) {  return rc; }
-          if (newkey<keyhold) {
-            insertAt=offset;
-            break;
-          }
-        }
+        SIZE_T insertAt=child.UpperBound(newkey); //save offset where key is inserted so you know where to put value
 
-        //slide everything over
-        int i;
-        SIZE_T ptrhold;
-        for(i=child.info.numkeys-1; i>=insertAt; i--){
-          rc=child.GetKey(i,keyhold);
-          if (rc) {  return rc; }
-          rc=child.SetKey(i+1,keyhold);
-          if (rc) {  return rc; }
-          
-          rc=child.GetPtr(i,ptrhold);
-          if (rc) {  return rc; }
-          rc=child.SetPtr(i+1,ptrhold);
-          if (rc) {  return rc; }
-        }
+        //slide everything over, in the block
+        //newnode came from splitting the child left of newkey, so
+        //it goes right of newkey
+        child.OpenSlot(insertAt,insertAt+1);
 
         //insert the new stuff
         rc=child.SetKey(insertAt,newkey);
         if (rc) {  return rc; }
-        rc=child.SetPtr(insertAt,newnode);
+        rc=child.SetPtr(insertAt+1,newnode);
         if (rc) {  return rc; }
 
-        //increment number of keys
-        child.info.numkeys++;
         newnode=0;
 
-        return child.Serialize(buffercache,childptr);
+        child.MarkDirty();
+        return child.Close();
       }
       
       //else, split
       else{
+        rc = child.Close();
+        if (rc) {  return rc; }
         return Split(childptr, key, value, newnode, newkey);
       }
     }
@@ -708,177 +595,220 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &node, const KEY_T &key, const VALUE_T
 }
 
 
+//
+// Whether keys[first] through keys[first+n-1] fit in one node like
+// proto once it's emptied for them
+//
+static bool FitsInNode(const NodeMetadata &proto, const KEY_T *keys, const SIZE_T first, const SIZE_T n)
+{
+  NodeMetadata m=proto;
+
+  m.format=BTREE_FORMAT_CURRENT;
+  m.prefixlen=m.CommonPrefix(keys[first],keys[first+n-1]);
+  return n <= (m.nodetype==BTREE_LEAF_NODE ? m.GetNumSlotsAsLeaf() : m.GetNumSlotsAsInterior());
+}
+
+//
+// How many of the numkeys sorted keys to leave in the node being
+// split, the rest after skip (1 if a key goes up to the parent
+// instead) going to the new node.  Usually that's half, as given,
+// but a node holds more keys that share a long prefix than keys that
+// don't, so a key at either end that shares little with the rest
+// may have to go nearly alone.  Otherwise the nearest split to half
+// where both nodes fit.
+//
+static SIZE_T FitSplit(const NodeMetadata &proto, const KEY_T *keys, const SIZE_T numkeys, const SIZE_T half, const SIZE_T skip)
+{
+  SIZE_T d;
+  SIZE_T left;
+
+  for (d=0; d<numkeys; d++) { 
+    for (int side=0; side<2; side++) { 
+      if (side==0 ? d>half : half+d>=numkeys) { 
+	continue;
+      }
+      left = side==0 ? half-d : half+d;
+      if (left>=1 && left+skip<numkeys &&
+	  FitsInNode(proto,keys,0,left) &&
+	  FitsInNode(proto,keys,left+skip,numkeys-left-skip)) { 
+	return left;
+      }
+    }
+  }
+  return half;
+}
+
+
 ERROR_T BTreeIndex::Split(SIZE_T &node_to_split, const KEY_T &key, const VALUE_T &value, SIZE_T &newnode, KEY_T &newkey)
 {
   // // WRITE ME
-  BTreeNode old;
-  BTreeNode nnode;
+  BTreeNodeView old;
+  BTreeNodeView nnode;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T keyhold;
-  VALUE_T valhold;
-  SIZE_T ptrhold;
   SIZE_T newintnode;
   //SIZE_T ptr;
-  int counter;
-  int insertAt; //holds offset of insert
-  int inArray; //check if new key is in array yet 1 if yes, 0 if no
-
-  //generate nnode, copy of the node we want to split
-  rc = old.Unserialize(buffercache, node_to_split);
+  SIZE_T counter;
+  SIZE_T insertAt; //holds offset of insert
+  SIZE_T numold; //num keys to keep in old node
+  unsigned int i; //our for loop increment for keys
+  unsigned int k; //our loop increment for ptrs
+
+  //split the node in place, into nnode, a new node like it
+  //read everything out of old first
+  rc = old.Open(buffercache, node_to_split);
   if (rc!=ERROR_NOERROR) { return rc;}
-  nnode = old;
-  KEY_T keyarr[old.info.numkeys+1];
-  VALUE_T valarr[old.info.numkeys+1];
-  SIZE_T ptrarr[old.info.numkeys+2];
+  NodeMetadata proto = *old.info; //what both nodes will be like
+  int n = old.info->numkeys; //total number of keys before insertion
+  bool leaf = proto.nodetype==BTREE_LEAF_NODE;
+  KEY_T keyarr[n+1];
+  VALUE_T valarr[n+1];
+  SIZE_T ptrarr[n+2];
   
 
   // //two cases: leaf or not leaf
-  if(old.info.nodetype==BTREE_LEAF_NODE){
-    // int numkeys_old; //num keys to keep in old node
-    // int numkeys_new; //num keys to put in new
-    int n = old.info.numkeys; //total number of keys before insertion
-
-    // numkeys_old = (n+3)/2; //(n+3) instead of (n/2) to account for rounding cuz we want ceiling
-    // numkeys_new = n+1-numkeys_old; //total after insertion minus the keys in oldnode
-
-    // old.info.numkeys = (n+2)/2; //(n+3) instead of (n/2) to account for rounding cuz we want ceiling
-    // nnode.info.numkeys = n+1-old.info.numkeys; //total after insertion minus the keys in oldnode
-
+  if(leaf){
     //fill a sorted array with all the keys, including new keys
+    insertAt=old.UpperBound(key);
     counter=0;
-    inArray=0;
-    for (offset=0;offset<old.info.numkeys;offset++) { 
-      rc=old.GetKey(offset,keyhold);
-      if (rc) {  return rc; }
-      if (key<keyhold && inArray==0) {
+    for (offset=0;offset<old.info->numkeys;offset++) { 
+      if (offset==insertAt) {
         keyarr[counter]=key;
         valarr[counter]=value;
-        inArray=1;
-        insertAt=counter;
         counter++;
       }
-      keyarr[counter]=keyhold;
-      old.GetVal(offset, valhold);
-      valarr[counter]=valhold;
+      rc=old.GetKey(offset,keyarr[counter]);
+      if (rc) {  return rc; }
+      rc=old.GetVal(offset,valarr[counter]);
+      if (rc) {  return rc; }
       counter++;
     }
-    if(inArray==0){
-      keyarr[old.info.numkeys] = key;
-      valarr[old.info.numkeys] = value;
-    }
-
-    old.info.numkeys = (n+2)/2; //(n+3) instead of (n/2) to account for rounding cuz we want ceiling
-    nnode.info.numkeys = n+1-old.info.numkeys; //total after insertion minus the keys in oldnode
-
-    unsigned int i; //our for loop increment
-
-    //fill old node
-    for(i=0; i<old.info.numkeys; i++){
-      old.SetKey(i, keyarr[i]);
-      old.SetVal(i, valarr[i]);
+    if(insertAt==old.info->numkeys){
+      keyarr[old.info->numkeys] = key;
+      valarr[old.info->numkeys] = value;
     }
 
-    //set newkey return value
-    newkey = keyarr[i];
-
-    //fill new node
-    //note that i is not reset to 0
-    unsigned int j;
-    for(j=0; j<nnode.info.numkeys; j++){
-      nnode.SetKey(j, keyarr[i]);
-      nnode.SetVal(j, valarr[i]);
-      i++;
-    }
+    numold = FitSplit(proto, keyarr, n+1, (n+2)/2, 0); //(n+3) instead of (n/2) to account for rounding cuz we want ceiling
   }
 
   //else internal
   else{
-    if(old.info.nodetype==BTREE_ROOT_NODE){
-      old.info.nodetype=BTREE_INTERIOR_NODE;
-      nnode.info.nodetype=BTREE_INTERIOR_NODE;
+    if(proto.nodetype==BTREE_ROOT_NODE){
+      proto.nodetype=BTREE_INTERIOR_NODE;
     }
-    int n = old.info.numkeys; //total number of keys before insertion
-
-    // old.info.numkeys = (n+1)/2; //(n+1) instead of (n) account for rounding cuz we want ceiling
-    // nnode.info.numkeys = n-old.info.numkeys; //total minus the keys in oldnode
 
     //fill a sorted array with all the keys, including new keys
+    //newkey goes where key would, since it came from splitting
+    //the child key went to
+    insertAt=old.UpperBound(key);
     counter=0;
-    inArray=0;
-    for (offset=0;offset<old.info.numkeys;offset++) { 
-      rc=old.GetKey(offset,keyhold);
-      if (rc) {  return rc; }
-      if (key<keyhold && inArray==0) {
+    for (offset=0;offset<old.info->numkeys;offset++) { 
+      if (offset==insertAt) {
         keyarr[counter]=newkey;
-        inArray=1;
-        insertAt=counter;
         counter++;
       }
-      keyarr[counter]=keyhold;
+      rc=old.GetKey(offset,keyarr[counter]);
+      if (rc) {  return rc; }
       counter++;
     }
-    if(inArray==0){
-      keyarr[old.info.numkeys] = newkey;
+    if(insertAt==old.info->numkeys){
+      keyarr[old.info->numkeys] = newkey;
     }
 
-
-
-
     //fill a sorted array with all the ptrs, including new ptr
+    //right after the key
     counter=0;
-    inArray=0;
-    for (offset=0;offset<old.info.numkeys+1;offset++) { 
-      rc=old.GetPtr(offset,ptrhold);
-      if (rc) {  return rc; }
-      if (counter==insertAt+1 && inArray==0) {
+    for (offset=0;offset<old.info->numkeys+1;offset++) { 
+      if (offset==insertAt+1) {
         ptrarr[counter]=newnode;
-        inArray=1;
         counter++;
       }
-      ptrarr[counter]=ptrhold;
+      rc=old.GetPtr(offset,ptrarr[counter]);
+      if (rc) {  return rc; }
       counter++;
     }
-    if(inArray==0){
-      ptrarr[old.info.numkeys+1] = newnode;
+    if(insertAt==old.info->numkeys){
+      ptrarr[old.info->numkeys+1] = newnode;
     }
 
-    old.info.numkeys = (n+1)/2; //(n+1) instead of (n) account for rounding cuz we want ceiling
-    nnode.info.numkeys = n-old.info.numkeys; //total minus the keys in oldnode
-
+    //the key between the two goes up, not in either
+    numold = FitSplit(proto, keyarr, n+1, (n+1)/2, 1); //(n+1) instead of (n) account for rounding cuz we want ceiling
+  }
 
-    unsigned int i; //our for loop increment for keys
-    unsigned int k; //our loop increment for ptrs
-    //fill old node
-    for(i=0; i<old.info.numkeys; i++){
-      old.SetKey(i, keyarr[i]);
-    }
-    for(k=0; k<old.info.numkeys+1; k++){
-      old.SetPtr(k, ptrarr[k]);
-    }
+  //old hasn't changed, so let it go before pinning nnode.  Only one
+  //of them is pinned at a time, so a cache of one frame will do.
+  rc = old.Close();
+  if (rc!=ERROR_NOERROR) { return rc;}
 
-    //set newkey return value
-    newkey = keyarr[i];
-    i++; // not inserting this one
+  //fill the new node first, so that if it can't be made the tree
+  //is as it was
+  rc = AllocateNode(newintnode);
+  if (rc!=ERROR_NOERROR) { return rc;}
+  rc = nnode.Create(buffercache, newintnode, proto, proto.nodetype);
+  if (rc!=ERROR_NOERROR) { 
+    DeallocateNode(newintnode);
+    return rc;
+  }
 
-    //fill new node
-    //note that i,k is not reset to 0
-    unsigned int j;
-    for(j=0; j<nnode.info.numkeys; j++){
+  //start over in each node, with the prefix its keys share
+  //note that i,k start where old's keys and ptrs will end
+  if(leaf){
+    nnode.Empty(keyarr[numold], keyarr[n]);
+    nnode.info->numkeys = n+1-numold; //total after insertion minus the keys in oldnode
+    i=numold;
+    for(unsigned int j=0; j<nnode.info->numkeys; j++){
       nnode.SetKey(j, keyarr[i]);
+      nnode.SetVal(j, valarr[i]);
       i++;
     }
-    for(j=0; j<nnode.info.numkeys+1; j++){
+  }
+  else{
+    nnode.Empty(keyarr[numold+1], keyarr[n]);
+    nnode.info->numkeys = n-numold; //total minus the keys in oldnode
+    i=numold+1; // not inserting keyarr[numold]
+    k=numold+1;
+    for(unsigned int j=0; j<nnode.info->numkeys; j++){
+      nnode.SetKey(j, keyarr[i]);
+      i++;
+    }
+    for(unsigned int j=0; j<nnode.info->numkeys+1; j++){
       nnode.SetPtr(j, ptrarr[k]);
       k++;
     }
   }
+  nnode.MarkDirty();
+  rc = nnode.Close();
+  if (rc!=ERROR_NOERROR) { 
+    DeallocateNode(newintnode);
+    return rc;
+  }
 
-  //write changes to disk
-  old.Serialize(buffercache, node_to_split);
-  if (rc!=ERROR_NOERROR) { return rc;}
-  AllocateNode(newintnode);
-  rc=nnode.Serialize(buffercache, newintnode);
+  //then put the rest back in old
+  rc = old.Open(buffercache, node_to_split);
+  if (rc!=ERROR_NOERROR) { 
+    DeallocateNode(newintnode);
+    return rc;
+  }
+  old.info->nodetype = proto.nodetype;
+  old.Empty(keyarr[0], keyarr[numold-1]);
+  old.info->numkeys = numold;
+  for(i=0; i<old.info->numkeys; i++){
+    old.SetKey(i, keyarr[i]);
+    if(leaf){
+      old.SetVal(i, valarr[i]);
+    }
+  }
+  if(!leaf){
+    for(k=0; k<old.info->numkeys+1; k++){
+      old.SetPtr(k, ptrarr[k]);
+    }
+  }
+
+  //set newkey return value
+  newkey = keyarr[numold];
+
+  old.MarkDirty();
+  rc=old.Close();
   newnode=newintnode;
   return rc;
 }
@@ -901,6 +831,21 @@ ERROR_T BTreeIndex::Delete(const KEY_T &key)
 }
 
   
+//
+// While a traversal walks the subtree under child offset of an
+// interior node, start reading child offset+1 so that it is (at
+// least partly) in the cache by the time we get to it.  This is
+// only a hint, so errors, including ERROR_NOFETCH, are ignored.
+//
+void BTreeIndex::PrefetchSibling(const BTreeNode &b, const SIZE_T offset) const
+{
+  SIZE_T next;
+
+  if (offset<b.info.numkeys && b.GetPtr(offset+1,next)==ERROR_NOERROR) { 
+    buffercache->PrefetchBlock(next);
+  }
+}
+
 //
 //
 // DEPTH first traversal
@@ -942,6 +887,7 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
       for (offset=0;offset<=b.info.numkeys;offset++) { 
 	rc=b.GetPtr(offset,ptr);
 	if (rc) { return rc; }
+	PrefetchSibling(b,offset);
 	if (display_type==BTREE_DEPTH_DOT) { 
 	  o << node << " -> "<<ptr<<";\n";
 	}
@@ -1000,6 +946,70 @@ ERROR_T BTreeIndex::SanityCheck() const
   return ERROR_NOERROR;
 }
   
+ERROR_T BTreeIndex::Upgrade(SIZE_T &numupgraded)
+{
+  ERROR_T rc;
+
+  numupgraded=0;
+  rc=UpgradeInternal(superblock.info.rootnode,numupgraded);
+  if (rc) { return rc; }
+
+  if (superblock.info.format!=BTREE_FORMAT_CURRENT) { 
+    superblock.info.format=BTREE_FORMAT_CURRENT;
+    numupgraded++;
+    return superblock.Serialize(buffercache,superblock_index);
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeIndex::UpgradeInternal(const SIZE_T &node, SIZE_T &numupgraded)
+{
+  BTreeNode b;
+  ERROR_T rc;
+  SIZE_T offset;
+  SIZE_T ptr;
+  KEY_T lo, hi;
+
+  rc=b.Unserialize(buffercache,node);
+  if (rc) { return rc; }
+
+  if (b.info.nodetype!=BTREE_ROOT_NODE && 
+      b.info.nodetype!=BTREE_INTERIOR_NODE && 
+      b.info.nodetype!=BTREE_LEAF_NODE) { 
+    return ERROR_INSANE;
+  }
+
+  // The children first, while b has the pointers to them
+  if (b.info.nodetype!=BTREE_LEAF_NODE && b.info.numkeys>0) { 
+    for (offset=0;offset<=b.info.numkeys;offset++) { 
+      rc=b.GetPtr(offset,ptr);
+      if (rc) { return rc; }
+      rc=UpgradeInternal(ptr,numupgraded);
+      if (rc) { return rc; }
+    }
+  }
+
+  if (b.info.format==BTREE_FORMAT_CURRENT) { 
+    return ERROR_NOERROR;
+  }
+
+  // Rewrite the slots, keeping what all the keys share once
+  SIZE_T prefix=0;
+
+  if (b.info.numkeys>0) { 
+    rc=b.GetKey(0,lo);
+    if (rc) { return rc; }
+    rc=b.GetKey(b.info.numkeys-1,hi);
+    if (rc) { return rc; }
+    prefix=b.info.CommonPrefix(lo,hi);
+  }
+  rc=b.info.Relayout(b.data,BTREE_FORMAT_CURRENT,prefix);
+  if (rc) { return rc; }
+
+  numupgraded++;
+  return b.Serialize(buffercache,node);
+}
+
 ERROR_T BTreeIndex::InternalCheck(const SIZE_T &node) const
 {
 
@@ -1045,10 +1055,13 @@ ERROR_T BTreeIndex::InternalCheck(const SIZE_T &node) const
         for(offset=0;offset<=b.info.numkeys; offset++){
           rc=b.GetPtr(offset,ptr);
           if (rc) { return rc; }
+          PrefetchSibling(b,offset);
           rc = InternalCheck(ptr);
           if (rc) { return rc; }
         }
       }
+      //not a leaf, so don't hold it to a leaf's size
+      return ERROR_NOERROR;
     case BTREE_LEAF_NODE:
       //collect data about leaf key
       if(b.info.numkeys>b.info.GetNumSlotsAsLeaf()){
@@ -41,6 +41,20 @@ enum BTreeOp {BTREE_OP_INSERT, BTREE_OP_DELETE, BTREE_OP_UPDATE,BTREE_OP_LOOKUP}
 
 enum BTreeDisplayType {BTREE_DEPTH, BTREE_DEPTH_DOT, BTREE_SORTED_KEYVAL};
 
+//
+// Sorts cached blocks by the node type at the front of each one,
+// so the buffer cache can report misses on superblocks, roots,
+// interior nodes, leaves, and free blocks separately.
+// The classes are the BTREE_*_NODE numbers, plus one for anything
+// that isn't a node.
+//
+class BTreeBlockClassifier : public BlockClassifier {
+ public:
+  SIZE_T      GetNumClasses() const;
+  const char *GetClassName(const SIZE_T c) const;
+  SIZE_T      Classify(const SIZE_T blocknum, const Block &block) const;
+};
+
 class BTreeIndex {
  private:
   BufferCache *buffercache;
@@ -59,6 +73,8 @@ class BTreeIndex {
 				      VALUE_T &val);
   
 
+  void         PrefetchSibling(const BTreeNode &b, const SIZE_T offset) const;
+
   ERROR_T      DisplayInternal(const SIZE_T &node,
 			       ostream &o, 
 			       const BTreeDisplayType display_type=BTREE_DEPTH) const;
@@ -128,6 +144,13 @@ public:
   ERROR_T SanityCheck() const;
   ERROR_T InternalCheck(const SIZE_T &node) const;
 
+  // Rewrite every node that isn't in BTREE_FORMAT_CURRENT in it.
+  // Nodes in older formats work as they are, including on disks
+  // made before there were formats, so this only gets every node
+  // the current layout.  numupgraded says how many were rewritten.
+  ERROR_T Upgrade(SIZE_T &numupgraded);
+  ERROR_T UpgradeInternal(const SIZE_T &node, SIZE_T &numupgraded);
+
   // Display tree
   // BTREE_DEPTH means to do a depth first traversal of 
   // the tree, printing each node
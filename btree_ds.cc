@@ -5,6 +5,7 @@
 
 #include "btree_ds.h"
 #include "buffercache.h"
+#include "keysearch.h"
 
 #include "btree.h"
 
@@ -19,12 +20,34 @@ SIZE_T NodeMetadata::GetNumDataBytes() const
 
 SIZE_T NodeMetadata::GetNumSlotsAsInterior() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+sizeof(SIZE_T));  // floor intended
+  SIZE_T p=GetPrefixLength();
+  return (GetNumDataBytes()-sizeof(SIZE_T)-p)/(keysize-p+sizeof(SIZE_T));  // floor intended
 }
 
 SIZE_T NodeMetadata::GetNumSlotsAsLeaf() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+valuesize);  // floor intended
+  SIZE_T p=GetPrefixLength();
+  return (GetNumDataBytes()-sizeof(SIZE_T)-p)/(keysize-p+valuesize);  // floor intended
+}
+
+SIZE_T NodeMetadata::GetNumSlotsWithPrefix(const SIZE_T prefix) const
+{
+  NodeMetadata m=*this;
+
+  m.format=BTREE_FORMAT_PREFIX;
+  m.prefixlen=prefix;
+  return nodetype==BTREE_LEAF_NODE ? m.GetNumSlotsAsLeaf() : m.GetNumSlotsAsInterior();
+}
+
+
+SIZE_T NodeMetadata::CommonPrefix(const KEY_T &lo, const KEY_T &hi) const
+{
+  SIZE_T n=0;
+
+  while (n+1<keysize && lo.data[n]==hi.data[n]) { 
+    n++;
+  }
+  return n;
 }
 
 
@@ -36,13 +59,21 @@ ostream & NodeMetadata::Print(ostream &os) const
 				   nodetype==BTREE_INTERIOR_NODE ? "INTERIOR_NODE" :
 				   nodetype==BTREE_LEAF_NODE ? "LEAF_NODE" : "UNKNOWN_TYPE")
      << ", keysize="<<keysize<<", valuesize="<<valuesize<<", blocksize="<<blocksize
-     << ", rootnode="<<rootnode<<", freelist="<<freelist<<", numkeys="<<numkeys<<")";
+     << ", rootnode="<<rootnode<<", freelist="<<freelist<<", numkeys="<<numkeys
+     << ", format="<<(format==BTREE_FORMAT_INTERLEAVED ? "INTERLEAVED" :
+		      format==BTREE_FORMAT_SPLIT ? "SPLIT" :
+		      format==BTREE_FORMAT_PREFIX ? "PREFIX" : "UNKNOWN_FORMAT");
+  if (format==BTREE_FORMAT_PREFIX && nodetype>=BTREE_ROOT_NODE) { 
+    os << ", prefixlen="<<prefixlen;
+  }
+  os << ")";
   return os;
 }
 
 BTreeNode::BTreeNode() 
 {
   info.nodetype=BTREE_UNALLOCATED_BLOCK;
+  info.format=BTREE_FORMAT_CURRENT;
   data=0;
 }
 
@@ -59,6 +90,7 @@ BTreeNode::~BTreeNode()
 BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size)
 {
   info.nodetype=node_type;
+  info.format=BTREE_FORMAT_CURRENT;
   info.keysize=key_size;
   info.valuesize=value_size;
   info.blocksize=block_size;
@@ -75,6 +107,7 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
 BTreeNode::BTreeNode(const BTreeNode &rhs) 
 {
   info.nodetype=rhs.info.nodetype;
+  info.format=rhs.info.format;
   info.keysize=rhs.info.keysize;
   info.valuesize=rhs.info.valuesize;
   info.blocksize=rhs.info.blocksize;
@@ -95,34 +128,47 @@ BTreeNode & BTreeNode::operator=(const BTreeNode &rhs)
 }
 
 
+//
+// Both directions work on the cached frame directly through a pin,
+// rather than staging the block through a temporary copy
+//
 ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
 {
   assert((unsigned)info.blocksize==b->GetBlockSize());
 
-  Block block(sizeof(info)+info.GetNumDataBytes());
+  BlockPin pin;
+
+  // We overwrite the whole block, so there's no need to read it
+  ERROR_T rc=pin.Pin(b,blocknum,false);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
 
-  memcpy(block.data,&info,sizeof(info));
+  memcpy(pin.GetData(),&info,sizeof(info));
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
-    memcpy(block.data+sizeof(info),data,info.GetNumDataBytes());
+    memcpy(pin.GetData()+sizeof(info),data,info.GetNumDataBytes());
   }
 
-  return b->WriteBlock(blocknum,block);
+  pin.MarkDirty();
+
+  return pin.Release();
 }
 
 
 ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
 {
-  Block block;
+  BlockPin pin;
 
   ERROR_T rc;
 
-  rc=b->ReadBlock(blocknum,block);
+  rc=pin.Pin(b,blocknum);
 
   if (rc!=ERROR_NOERROR) {
     return rc;
   }
 
-  memcpy(&info,block.data,sizeof(info));
+  memcpy(&info,pin.GetData(),sizeof(info));
   
   if (data) { 
     delete [] data;
@@ -133,24 +179,37 @@ ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
 
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
     data = new char [info.GetNumDataBytes()];
-    memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    memcpy(data,pin.GetData()+sizeof(info),info.GetNumDataBytes());
   }
   
-  return ERROR_NOERROR;
+  return pin.Release();
 }
 
 
-char * BTreeNode::ResolveKey(const SIZE_T offset) const
+//
+// In BTREE_FORMAT_SPLIT and BTREE_FORMAT_PREFIX the arrays are sized
+// for a full node, so where a slot is doesn't depend on numkeys.  SPLIT
+// is PREFIX with p, the prefix length, 0.
+//
+char * NodeMetadata::ResolveKey(char *data, const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
+  SIZE_T p=GetPrefixLength();
+
+  switch (nodetype) { 
   case BTREE_INTERIOR_NODE:
   case BTREE_ROOT_NODE:
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+info.keysize);
+    assert(offset<numkeys);
+    if (format!=BTREE_FORMAT_INTERLEAVED) { 
+      return data+p+offset*(keysize-p);
+    }
+    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+keysize);
     break;
   case BTREE_LEAF_NODE:
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize);
+    assert(offset<numkeys);
+    if (format!=BTREE_FORMAT_INTERLEAVED) { 
+      return data+p+offset*(keysize-p);
+    }
+    return data+sizeof(SIZE_T)+offset*(keysize+valuesize);
     break;
   default:
     return 0;
@@ -158,16 +217,24 @@ char * BTreeNode::ResolveKey(const SIZE_T offset) const
 }
 
 
-char * BTreeNode::ResolvePtr(const SIZE_T offset) const
+char * NodeMetadata::ResolvePtr(char *data, const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
+  SIZE_T p=GetPrefixLength();
+
+  switch (nodetype) { 
   case BTREE_INTERIOR_NODE:
   case BTREE_ROOT_NODE:
-    assert(offset<=info.numkeys);
-    return data+offset*(sizeof(SIZE_T)+info.keysize);
+    assert(offset<=numkeys);
+    if (format!=BTREE_FORMAT_INTERLEAVED) { 
+      return data+p+GetNumSlotsAsInterior()*(keysize-p)+offset*sizeof(SIZE_T);
+    }
+    return data+offset*(sizeof(SIZE_T)+keysize);
     break;
   case BTREE_LEAF_NODE:
     assert(offset==0);
+    if (format!=BTREE_FORMAT_INTERLEAVED) { 
+      return data+p+GetNumSlotsAsLeaf()*(keysize-p+valuesize);
+    }
     return data;
     break;
   default:
@@ -177,12 +244,17 @@ char * BTreeNode::ResolvePtr(const SIZE_T offset) const
 
 
 
-char * BTreeNode::ResolveVal(const SIZE_T offset) const
+char * NodeMetadata::ResolveVal(char *data, const SIZE_T offset) const
 {
-  switch (info.nodetype) { 
+  SIZE_T p=GetPrefixLength();
+
+  switch (nodetype) { 
   case BTREE_LEAF_NODE:
-    assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize)+info.keysize;
+    assert(offset<numkeys);
+    if (format!=BTREE_FORMAT_INTERLEAVED) { 
+      return data+p+GetNumSlotsAsLeaf()*(keysize-p)+offset*valuesize;
+    }
+    return data+sizeof(SIZE_T)+offset*(keysize+valuesize)+keysize;
     break;
   default:
     return 0;
@@ -190,29 +262,185 @@ char * BTreeNode::ResolveVal(const SIZE_T offset) const
 }
 
 
+SIZE_T NodeMetadata::LowerBound(const char *data, const KEY_T &key) const
+{
+  if (format!=BTREE_FORMAT_INTERLEAVED) { 
+    // A key outside the prefix is before or after every key here,
+    // and the rest only need their suffixes searched
+    SIZE_T p=GetPrefixLength();
+    int c=memcmp(key.data,data,p);
+
+    if (c<0) { 
+      return 0;
+    } else if (c>0) { 
+      return numkeys;
+    }
+    return KeyLowerBound((const BYTE_T *)data+p,keysize-p,numkeys,keysize-p,key.data+p);
+  }
 
-char * BTreeNode::ResolveKeyVal(const SIZE_T offset) const
+  // Key i is at sizeof(SIZE_T)+i*stride in either kind of node
+  SIZE_T stride = nodetype==BTREE_LEAF_NODE ? keysize+valuesize : sizeof(SIZE_T)+keysize;
+
+  return KeyLowerBound((const BYTE_T *)data+sizeof(SIZE_T),stride,numkeys,keysize,key.data);
+}
+
+
+void NodeMetadata::OpenSlot(char *data, const SIZE_T offset, const SIZE_T ptroffset)
 {
-  return ResolveKey(offset);
+  bool   leaf = nodetype==BTREE_LEAF_NODE;
+  SIZE_T n = numkeys++;
+  SIZE_T i;
+
+  assert(offset<=n);
+  assert(leaf || ptroffset<=n+1);
+
+  if (format!=BTREE_FORMAT_INTERLEAVED) { 
+    // One move per array
+    SIZE_T suffix=keysize-GetPrefixLength();
+    char *keys=ResolveKey(data,offset);
+
+    memmove(keys+suffix,keys,(n-offset)*suffix);
+    if (leaf) { 
+      char *vals=ResolveVal(data,offset);
+
+      memmove(vals+valuesize,vals,(n-offset)*valuesize);
+    } else if (ptroffset<=n) { 
+      char *ptrs=ResolvePtr(data,ptroffset);
+
+      memmove(ptrs+sizeof(SIZE_T),ptrs,(n+1-ptroffset)*sizeof(SIZE_T));
+    }
+    return;
+  }
+
+  // Interleaved, one slot at a time from the top
+  for (i=n; i>offset; i--) { 
+    memcpy(ResolveKey(data,i),ResolveKey(data,i-1),keysize);
+    if (leaf) { 
+      memcpy(ResolveVal(data,i),ResolveVal(data,i-1),valuesize);
+    }
+  }
+  if (!leaf) { 
+    for (i=n+1; i>ptroffset; i--) { 
+      memcpy(ResolvePtr(data,i),ResolvePtr(data,i-1),sizeof(SIZE_T));
+    }
+  }
 }
 
-ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
+
+//
+// Built in a scratch copy of the slots, since in place a slot can
+// move onto one that hasn't been moved yet
+//
+ERROR_T NodeMetadata::Relayout(char *data, const short newformat, const SIZE_T prefix)
 {
-  char *p=ResolveKey(offset);
+  NodeMetadata to=*this;
+  bool   leaf = nodetype==BTREE_LEAF_NODE;
+  SIZE_T p=GetPrefixLength();
+  SIZE_T q;
+  SIZE_T i;
+
+  to.format=newformat;
+  if (newformat==BTREE_FORMAT_PREFIX) { 
+    to.prefixlen=prefix;
+  }
+  q=to.GetPrefixLength();
+
+  assert(numkeys>0 || q==0);
+  if (numkeys > (leaf ? to.GetNumSlotsAsLeaf() : to.GetNumSlotsAsInterior())) { 
+    return ERROR_NOSPACE;
+  }
+
+  char buf[GetNumDataBytes()];
+  char key[keysize];
+
+  memset(buf,0,GetNumDataBytes());
+  for (i=0;i<numkeys;i++) { 
+    memcpy(key,data,p);
+    memcpy(key+p,ResolveKey(data,i),keysize-p);
+    if (i==0) { 
+      memcpy(buf,key,q);
+    }
+    assert(memcmp(buf,key,q)==0);
+    memcpy(to.ResolveKey(buf,i),key+q,keysize-q);
+    if (leaf) { 
+      memcpy(to.ResolveVal(buf,i),ResolveVal(data,i),valuesize);
+    }
+  }
+  if (leaf) { 
+    memcpy(to.ResolvePtr(buf,0),ResolvePtr(data,0),sizeof(SIZE_T));
+  } else if (numkeys>0) { 
+    for (i=0;i<=numkeys;i++) { 
+      memcpy(to.ResolvePtr(buf,i),ResolvePtr(data,i),sizeof(SIZE_T));
+    }
+  }
+
+  memcpy(data,buf,GetNumDataBytes());
+  *this=to;
+  return ERROR_NOERROR;
+}
 
+
+//
+// Moving keys, values, and pointers between a slot and the caller,
+// for BTreeNode and BTreeNodeView alike.  A key is put back together
+// from the node's prefix and its slot.
+//
+static ERROR_T GetSlot(const char *p, const SIZE_T size, Buffer &b)
+{
   if (p==0) { 
     return ERROR_NOMEM;
   }
   
+  b.Resize(size,false);
+  memcpy(b.data,p,size);
+  return ERROR_NOERROR;
+}
+
+static ERROR_T SetSlot(char *p, const SIZE_T size, const Buffer &b)
+{
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+
+  memcpy(p,b.data,size);
+
+  return ERROR_NOERROR;
+}
+
+static ERROR_T GetKeySlot(const NodeMetadata &info, const char *data, const SIZE_T offset, KEY_T &k)
+{
+  const char *p=info.ResolveKey((char *)data,offset);
+  SIZE_T prefix=info.GetPrefixLength();
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+
   k.Resize(info.keysize,false);
-  memcpy(k.data,p,info.keysize);
+  memcpy(k.data,data,prefix);
+  memcpy(k.data+prefix,p,info.keysize-prefix);
   return ERROR_NOERROR;
 }
 
-ERROR_T BTreeNode::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
+static ERROR_T SetKeySlot(const NodeMetadata &info, char *data, const SIZE_T offset, const KEY_T &k)
 {
-  char *p=ResolvePtr(offset);
+  char *p=info.ResolveKey(data,offset);
+  SIZE_T prefix=info.GetPrefixLength();
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  // The node has to be made to take k first (see MakeRoom)
+  if (memcmp(k.data,data,prefix)!=0) { 
+    return ERROR_IMPLBUG;
+  }
+
+  memcpy(p,k.data+prefix,info.keysize-prefix);
+  return ERROR_NOERROR;
+}
 
+static ERROR_T GetPtrSlot(const char *p, SIZE_T &ptr)
+{
   if (p==0) { 
     return ERROR_NOMEM;
   }
@@ -221,20 +449,58 @@ ERROR_T BTreeNode::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
   return ERROR_NOERROR;
 }
 
-ERROR_T BTreeNode::GetVal(const SIZE_T offset, VALUE_T &v) const
+static ERROR_T SetPtrSlot(char *p, const SIZE_T &ptr)
 {
-  char *p=ResolveVal(offset);
-
   if (p==0) { 
     return ERROR_NOMEM;
   }
-  
-  v.Resize(info.valuesize,false);
-  memcpy(v.data,p,info.valuesize);
+
+  memcpy(p,&ptr,sizeof(SIZE_T));
+
   return ERROR_NOERROR;
 }
 
 
+char * BTreeNode::ResolveKey(const SIZE_T offset) const
+{
+  return info.ResolveKey(data,offset);
+}
+
+
+char * BTreeNode::ResolvePtr(const SIZE_T offset) const
+{
+  return info.ResolvePtr(data,offset);
+}
+
+
+char * BTreeNode::ResolveVal(const SIZE_T offset) const
+{
+  return info.ResolveVal(data,offset);
+}
+
+
+
+char * BTreeNode::ResolveKeyVal(const SIZE_T offset) const
+{
+  return ResolveKey(offset);
+}
+
+ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
+{
+  return GetKeySlot(info,data,offset,k);
+}
+
+ERROR_T BTreeNode::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
+{
+  return GetPtrSlot(ResolvePtr(offset),ptr);
+}
+
+ERROR_T BTreeNode::GetVal(const SIZE_T offset, VALUE_T &v) const
+{
+  return GetSlot(ResolveVal(offset),info.valuesize,v);
+}
+
+
 ERROR_T BTreeNode::GetKeyVal(const SIZE_T offset, KeyValuePair &p) const
 {
   ERROR_T rc= GetKey(offset,p.key);
@@ -249,44 +515,20 @@ ERROR_T BTreeNode::GetKeyVal(const SIZE_T offset, KeyValuePair &p) const
 
 ERROR_T BTreeNode::SetKey(const SIZE_T offset, const KEY_T &k)
 {
-  char *p=ResolveKey(offset);
-
-  if (p==0) { 
-    return ERROR_NOMEM;
-  }
-
-  memcpy(p,k.data,info.keysize);
-
-  return ERROR_NOERROR;
+  return SetKeySlot(info,data,offset,k);
 }
 
 
 ERROR_T BTreeNode::SetPtr(const SIZE_T offset, const SIZE_T &ptr)
 {
-  char *p=ResolvePtr(offset);
-
-  if (p==0) { 
-    return ERROR_NOMEM;
-  }
-
-  memcpy(p,&ptr,sizeof(SIZE_T));
-
-  return ERROR_NOERROR;
+  return SetPtrSlot(ResolvePtr(offset),ptr);
 }
 
 
 
 ERROR_T BTreeNode::SetVal(const SIZE_T offset, const VALUE_T &v)
 {
-  char *p=ResolveVal(offset);
-  
-  if (p==0) { 
-    return ERROR_NOMEM;
-  }
-  
-  memcpy(p,v.data,info.valuesize);
-  
-  return ERROR_NOERROR;
+  return SetSlot(ResolveVal(offset),info.valuesize,v);
 }
 
 
@@ -345,3 +587,152 @@ ostream & BTreeNode::Print(ostream &os) const
   os <<")";
   return os;
 }
+
+
+
+ERROR_T BTreeNodeView::Open(BufferCache *b, const SIZE_T blocknum)
+{
+  ERROR_T rc=pin.Pin(b,blocknum);
+
+  if (rc!=ERROR_NOERROR) { 
+    info=0;
+    data=0;
+    return rc;
+  }
+
+  info=(NodeMetadata *)pin.GetData();
+  data=(char *)pin.GetData()+sizeof(NodeMetadata);
+
+  assert(b->GetBlockSize()==(unsigned)info->blocksize);
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::Create(BufferCache *b,
+			      const SIZE_T blocknum,
+			      const NodeMetadata &proto,
+			      const int nodetype)
+{
+  assert((unsigned)proto.blocksize==b->GetBlockSize());
+
+  // We overwrite the whole block, so there's no need to read it
+  ERROR_T rc=pin.Pin(b,blocknum,false);
+
+  if (rc!=ERROR_NOERROR) { 
+    info=0;
+    data=0;
+    return rc;
+  }
+
+  info=(NodeMetadata *)pin.GetData();
+  data=(char *)pin.GetData()+sizeof(NodeMetadata);
+
+  *info=proto;
+  info->nodetype=nodetype;
+  info->format=BTREE_FORMAT_CURRENT;
+  info->prefixlen=0;
+  info->numkeys=0;
+  memset(data,0,info->GetNumDataBytes());
+
+  pin.MarkDirty();
+
+  return ERROR_NOERROR;
+}
+
+
+void BTreeNodeView::Empty(const KEY_T &lo, const KEY_T &hi)
+{
+  info->format=BTREE_FORMAT_CURRENT;
+  info->prefixlen=info->CommonPrefix(lo,hi);
+  info->numkeys=0;
+  memcpy(data,lo.data,info->GetPrefixLength());
+
+  pin.MarkDirty();
+}
+
+
+bool BTreeNodeView::MakeRoom(const KEY_T &k)
+{
+  SIZE_T p=info->GetPrefixLength();
+  SIZE_T q=0;
+
+  while (q<p && data[q]==(char)k.data[q]) { 
+    q++;
+  }
+  if (info->numkeys>=info->GetNumSlotsWithPrefix(q)) { 
+    return false;
+  }
+  if (q<p) { 
+    // Fits, per the check above
+    info->Relayout(data,info->format,q);
+    pin.MarkDirty();
+  }
+  return true;
+}
+
+
+ERROR_T BTreeNodeView::Close()
+{
+  info=0;
+  data=0;
+  return pin.Release();
+}
+
+
+int BTreeNodeView::CompareKey(const SIZE_T offset, const KEY_T &k) const
+{
+  SIZE_T p=info->GetPrefixLength();
+  int c=memcmp(data,k.data,p);
+
+  if (c!=0) { 
+    return c;
+  }
+  return memcmp(ResolveKey(offset),k.data+p,info->keysize-p);
+}
+
+
+SIZE_T BTreeNodeView::UpperBound(const KEY_T &k) const
+{
+  SIZE_T offset=LowerBound(k);
+
+  // Keys are unique, so at most one is equal to k
+  if (offset<info->numkeys && CompareKey(offset,k)==0) { 
+    offset++;
+  }
+  return offset;
+}
+
+
+ERROR_T BTreeNodeView::GetKey(const SIZE_T offset, KEY_T &k) const
+{
+  return GetKeySlot(*info,data,offset,k);
+}
+
+ERROR_T BTreeNodeView::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
+{
+  return GetPtrSlot(ResolvePtr(offset),ptr);
+}
+
+ERROR_T BTreeNodeView::GetVal(const SIZE_T offset, VALUE_T &v) const
+{
+  return GetSlot(ResolveVal(offset),info->valuesize,v);
+}
+
+
+ERROR_T BTreeNodeView::SetKey(const SIZE_T offset, const KEY_T &k)
+{
+  return SetKeySlot(*info,data,offset,k);
+}
+
+
+ERROR_T BTreeNodeView::SetPtr(const SIZE_T offset, const SIZE_T &ptr)
+{
+  return SetPtrSlot(ResolvePtr(offset),ptr);
+}
+
+
+ERROR_T BTreeNodeView::SetVal(const SIZE_T offset, const VALUE_T &v)
+{
+  return SetSlot(ResolveVal(offset),info->valuesize,v);
+}
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "global.h"
 #include "block.h"
+#include "buffercache.h"
 
 using namespace std;
 
@@ -14,6 +15,12 @@ using namespace std;
 #define BTREE_INTERIOR_NODE 3
 #define BTREE_LEAF_NODE 4
 
+// Layouts of a node's slots (NodeMetadata::format)
+#define BTREE_FORMAT_INTERLEAVED 0
+#define BTREE_FORMAT_SPLIT 1
+#define BTREE_FORMAT_PREFIX 2
+// What new nodes get
+#define BTREE_FORMAT_CURRENT BTREE_FORMAT_PREFIX
 
 typedef Block Buffer;
 typedef Buffer KeyOrValue;
@@ -21,21 +28,65 @@ typedef KeyOrValue KEY_T;
 typedef KeyOrValue VALUE_T;
 
 
-class BufferCache;
 struct KeyValuePair;
 
 struct NodeMetadata {
-  int nodetype;
+  // The type used to be an int.  Its high half, always zero then, is
+  // the format now, so (on the little-endian machines the disk files
+  // are written on) nodes from before there were formats read as
+  // BTREE_FORMAT_INTERLEAVED.
+  short nodetype;
+  short format;
   SIZE_T keysize; 
   SIZE_T valuesize;
   SIZE_T blocksize;
   SIZE_T rootnode; //meaningful only for superblock
-  SIZE_T freelist; //meaningful only for superblock or a free block
+  union { 
+    SIZE_T freelist; //meaningful only for superblock or a free block
+    SIZE_T prefixlen; //meaningful only for a node in BTREE_FORMAT_PREFIX
+  };
   SIZE_T numkeys;
 
   SIZE_T GetNumDataBytes() const;
+  // These depend on the prefix, so a node whose keys share more of
+  // their bytes has more slots
   SIZE_T GetNumSlotsAsInterior() const;
   SIZE_T GetNumSlotsAsLeaf() const;
+  // The slots this node would have in BTREE_FORMAT_PREFIX with a
+  // prefix of prefix bytes.  With none, that's what every format has.
+  SIZE_T GetNumSlotsWithPrefix(const SIZE_T prefix) const;
+
+  // How many bytes at the start of every key are kept once, before
+  // the slots, rather than in each key's slot.  0 except in
+  // BTREE_FORMAT_PREFIX.
+  SIZE_T GetPrefixLength() const { return format==BTREE_FORMAT_PREFIX ? prefixlen : 0; }
+  // How much of the start of lo hi shares, and so every key between
+  // them, leaving at least a byte of each key for its slot
+  SIZE_T CommonPrefix(const KEY_T &lo, const KEY_T &hi) const;
+  // Rewrite the slots at data in newformat, keeping prefix bytes of
+  // prefix if that's BTREE_FORMAT_PREFIX.  Every key must share them.
+  // ERROR_NOSPACE, and nothing changes, if the keys don't fit then.
+  ERROR_T Relayout(char *data, const short newformat, const SIZE_T prefix);
+
+  // Where the ith key, pointer, or value is in the slots at data, or
+  // 0 if this kind of node has none.  Shared by BTreeNode and
+  // BTreeNodeView, whose slots live in different places.  A key's
+  // slot holds all but its first GetPrefixLength() bytes, which are
+  // at data.
+  char *ResolveKey(char *data, const SIZE_T offset) const;
+  char *ResolvePtr(char *data, const SIZE_T offset) const;
+  char *ResolveVal(char *data, const SIZE_T offset) const;
+
+  // Add a slot to the slots at data: the keys (and values) from
+  // offset on, and in an interior node the pointers from ptroffset
+  // on, move up one, and numkeys goes up by one.  The slots at offset
+  // and ptroffset are left for the caller to fill in.
+  void  OpenSlot(char *data, const SIZE_T offset, const SIZE_T ptroffset);
+
+  // The first of the numkeys keys in the slots at data that is not
+  // less than key, or numkeys if they all are.  The keys are searched
+  // in place (see KeyLowerBound), comparing as KEY_T compares them.
+  SIZE_T LowerBound(const char *data, const KEY_T &key) const;
 
   ostream &Print(ostream &rhs) const;
 			  
@@ -46,6 +97,28 @@ inline ostream & operator<< (ostream &os, const NodeMetadata &node) { return nod
 
 
 
+//
+// BTREE_FORMAT_PREFIX, with n slots (GetNumSlotsAsInterior or
+// GetNumSlotsAsLeaf):
+//
+// Interior node:
+//
+// PREFIX SUFFIX SUFFIX ... SUFFIX (n of them) PTR PTR ... PTR (n+1)
+//
+// Leaf:
+//
+// PREFIX SUFFIX SUFFIX ... SUFFIX (n) VALUE VALUE ... VALUE (n) PTR*
+//
+// PREFIX is the first prefixlen bytes of every key in the node, and
+// each key's SUFFIX is the rest of it.  The suffixes are one dense
+// array, so searching them doesn't pull pointers and values into
+// the cache.  The prefix is set when a node is split, to what its
+// keys share, and shrinks when a key that doesn't share it goes in.
+//
+// BTREE_FORMAT_SPLIT is the same with no prefix.
+//
+// BTREE_FORMAT_INTERLEAVED, which nodes were written in before the
+// format was recorded:
 //
 // Interior node:
 //
@@ -104,6 +177,75 @@ struct BTreeNode {
 inline ostream & operator<<(ostream &os, const BTreeNode &node) { return node.Print(os); }
 
 
+//
+// A node looked at where it sits in the buffer cache.  The block
+// stays pinned while the view is open, and info and data point at
+// the NodeMetadata and the slots inside the cached frame, so nothing
+// is allocated or copied to read the node, and Set* and changes to
+// *info change the cached block itself.  MarkDirty says so, and the
+// block is marked dirty when the view is closed.
+//
+// The layout is BTreeNode's, so a view and a BTreeNode of the same
+// block agree.
+//
+class BTreeNodeView {
+ private:
+  BlockPin pin;
+ public:
+  NodeMetadata *info;
+  char         *data;
+
+  BTreeNodeView() : info(0), data(0) {}
+  BTreeNodeView(const BTreeNodeView &rhs) { throw GenericException(); }
+  BTreeNodeView & operator=(const BTreeNodeView &rhs) { throw GenericException(); return *this; }
+  ~BTreeNodeView() { Close(); }
+
+  // Look at the node in block
+  ERROR_T Open(BufferCache *b, const SIZE_T block);
+  // Make block a new, empty node of type nodetype, in
+  // BTREE_FORMAT_CURRENT, that is otherwise like proto.  Whatever was
+  // in the block is not read.
+  ERROR_T Create(BufferCache *b,
+		 const SIZE_T block,
+		 const NodeMetadata &proto,
+		 const int nodetype);
+  // Throw away the node's keys, to fill it again with the keys from
+  // lo to hi, and put it in BTREE_FORMAT_CURRENT with the prefix they
+  // share
+  void    Empty(const KEY_T &lo, const KEY_T &hi);
+  // Whether k can go in without a split.  If it can, but doesn't
+  // share the node's prefix, the prefix is cut back so that it does.
+  bool    MakeRoom(const KEY_T &k);
+  void    MarkDirty() { pin.MarkDirty(); }
+  // Unpin the block, writing it back if the cache wants to
+  ERROR_T Close();
+  bool    IsOpen() const { return pin.IsPinned(); }
+
+  char *ResolveKey(const SIZE_T offset) const { return info->ResolveKey(data,offset); }
+  char *ResolvePtr(const SIZE_T offset) const { return info->ResolvePtr(data,offset); }
+  char *ResolveVal(const SIZE_T offset) const { return info->ResolveVal(data,offset); }
+
+  // <0, 0, >0 as the ith key is before, the same as, or after k,
+  // compared in place the way KEY_T compares
+  int     CompareKey(const SIZE_T offset, const KEY_T &k) const;
+  // The first key not less than k, or numkeys
+  SIZE_T  LowerBound(const KEY_T &k) const { return info->LowerBound(data,k); }
+  // The first key greater than k, or numkeys.  This is where k goes
+  // in, and, for an interior node, which pointer to follow for k.
+  SIZE_T  UpperBound(const KEY_T &k) const;
+
+  void    OpenSlot(const SIZE_T offset, const SIZE_T ptroffset) { info->OpenSlot(data,offset,ptroffset); }
+
+  ERROR_T GetKey(const SIZE_T offset, KEY_T &k) const;
+  ERROR_T GetPtr(const SIZE_T offset, SIZE_T &p) const;
+  ERROR_T GetVal(const SIZE_T offset, VALUE_T &v) const;
+
+  ERROR_T SetKey(const SIZE_T offset, const KEY_T &k);
+  ERROR_T SetPtr(const SIZE_T offset, const SIZE_T &p);
+  ERROR_T SetVal(const SIZE_T offset, const VALUE_T &v);
+};
+
+
 
 
 
@@ -1,5 +1,7 @@
 #include <stdlib.h>
+#include <memory>
 #include "btree.h"
+#include "stripeddisk.h"
 
 void usage() 
 {
@@ -20,11 +22,18 @@ int main(int argc, char **argv)
   }
 
   filestem=argv[1];
-  cachesize=atoi(argv[2]);
   key=argv[3];
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(filestem));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<filestem<<"\n";
+    return -1;
+  }
+  if (ParseCacheSize(argv[2],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  BufferCache cache(disk.get(),cachesize);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -66,6 +75,7 @@ int main(int argc, char **argv)
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+    DumpStatsJSON(cache,"btree_lookup");
 
     return 0;
   }
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <memory>
+#include "btree.h"
+#include "stripeddisk.h"
+
+void usage()
+{
+  cerr << "usage: btree_upgrade filestem cachesize\n";
+}
+
+
+int main(int argc, char **argv)
+{
+  char *filestem;
+  SIZE_T cachesize;
+  SIZE_T superblocknum;
+  SIZE_T numupgraded;
+
+  if (argc!=3) {
+    usage();
+    return -1;
+  }
+
+  filestem=argv[1];
+
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(filestem));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<filestem<<"\n";
+    return -1;
+  }
+  if (ParseCacheSize(argv[2],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) {
+    usage();
+    return -1;
+  }
+  BufferCache cache(disk.get(),cachesize);
+  BTreeIndex btree(0,0,&cache);
+
+  ERROR_T rc;
+
+
+  if ((rc=cache.Attach())!=ERROR_NOERROR) {
+    cerr << "Can't attach buffer cache due to error"<<rc<<endl;
+    return -1;
+  }
+
+  if ((rc=btree.Attach(0))!=ERROR_NOERROR) {
+    cerr << "Can't attach to index  due to error "<<rc<<endl;
+    return -1;
+  }
+  cerr << "Index attached!"<<endl;
+
+  if ((rc=btree.Upgrade(numupgraded))!=ERROR_NOERROR) {
+    cerr << "Can't upgrade the index due to error "<<rc<<endl;
+    return -1;
+  }
+  cerr << "Rewrote "<<numupgraded<<" nodes in the current format"<<endl;
+
+  if ((rc=btree.Detach(superblocknum))!=ERROR_NOERROR) {
+    cerr <<"Can't detach from index due to error "<<rc<<endl;
+    return -1;
+  }
+  if ((rc=cache.Detach())!=ERROR_NOERROR) {
+    cerr <<"Can't detach from cache due to error "<<rc<<endl;
+    return -1;
+  }
+  DumpStatsJSON(cache,"btree_upgrade");
+
+  return 0;
+}
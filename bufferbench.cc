@@ -0,0 +1,127 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "buffercache.h"
+#include "stripeddisk.h"
+
+
+void usage()
+{
+  cerr << "usage: bufferbench filestem cachesize numshards numblocks readsperthread [maxthreads]\n";
+}
+
+static double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+//
+// Each thread reads random blocks out of the first numblocks
+//
+static void reader(BufferCache *cache,
+		   const SIZE_T numblocks,
+		   const SIZE_T numreads,
+		   unsigned seed,
+		   ERROR_T *result)
+{
+  Block block(cache->GetBlockSize());
+
+  *result=ERROR_NOERROR;
+  for (SIZE_T i=0;i<numreads;i++) {
+    ERROR_T rc=cache->ReadBlock(rand_r(&seed)%numblocks,block);
+    if (rc!=ERROR_NOERROR) {
+      *result=rc;
+      return;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc<6) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T cachesize;
+  SIZE_T numshards=atoi(argv[3]);
+  SIZE_T numblocks=atoi(argv[4]);
+  SIZE_T numreads=atoi(argv[5]);
+  SIZE_T maxthreads=argc>6 ? atoi(argv[6]) : 16;
+
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(argv[1]));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<argv[1]<<endl;
+    return -1;
+  }
+  if (ParseCacheSize(argv[2],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  BufferCache cache(disk.get(),cachesize,REPLACE_LRU,numshards);
+
+  if (numblocks==0 || numblocks>disk->GetNumBlocks()) {
+    cerr << "numblocks must be between 1 and "<<disk->GetNumBlocks()<<endl;
+    return -1;
+  }
+
+  cache.Attach();
+
+  // Warm the cache so that a working set that fits measures hits
+  Block block(disk->GetBlockSize());
+  for (SIZE_T i=0;i<numblocks;i++) {
+    cache.ReadBlock(i,block);
+  }
+
+  cerr << "cachesize="<<cachesize<<" shards="<<cache.GetNumShards()
+       << " numblocks="<<numblocks<<" readsperthread="<<numreads<<endl;
+
+  double base=0;
+
+  for (SIZE_T n=1;n<=maxthreads;n*=2) {
+    vector<thread>  threads;
+    vector<ERROR_T> results(n);
+    SIZE_T          hits=cache.GetNumHits();
+    SIZE_T          misses=cache.GetNumMisses();
+    double          start=now();
+
+    for (SIZE_T t=0;t<n;t++) {
+      threads.push_back(thread(reader,&cache,numblocks,numreads,(unsigned)(t+1),&(results[t])));
+    }
+    for (SIZE_T t=0;t<n;t++) {
+      threads[t].join();
+    }
+
+    double elapsed=now()-start;
+    double rate=(double)(n*numreads)/elapsed;
+
+    for (SIZE_T t=0;t<n;t++) {
+      if (results[t]!=ERROR_NOERROR) {
+	cerr << "Error "<<results[t]<<" occured in thread "<<t<<endl;
+	return -1;
+      }
+    }
+    if (n==1) {
+      base=rate;
+    }
+    cout << "threads="<<n
+	 << " reads="<<n*numreads
+	 << " seconds="<<elapsed
+	 << " reads/s="<<rate
+	 << " speedup="<<rate/base
+	 << " hits="<<cache.GetNumHits()-hits
+	 << " misses="<<cache.GetNumMisses()-misses
+	 << endl;
+  }
+
+  cache.Detach();
+  DumpStatsJSON(cache,"bufferbench");
+
+  return 0;
+}
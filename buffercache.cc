@@ -1,53 +1,631 @@
+#include <algorithm>
+#include <ctype.h>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest()
+
+BufferShard::BufferShard(const ReplacementPolicyType type) :
+  frames(0), first(0), numframes(0), capacity(0),
+  policy(MakeReplacementPolicy(type)), hashshift(31), numresident(0),
+  freeframes(BUFFERCACHE_NOFRAME),
+  readhits(0), readmisses(0), writehits(0), writemisses(0),
+  reads(0), writes(0), evictions(0), dirtyevictions(0),
+  residencies(0), residencetime(0)
+{}
+
+BufferShard::~BufferShard()
+{
+  delete policy;
+  policy=0;
+}
+
+
+void BufferCache::LockAllShards(vector<unique_lock<mutex> > &held) const
+{
+  for (vector<BufferShard *>::const_iterator s=shards.begin(); s!=shards.end(); ++s) {
+    held.push_back(unique_lock<mutex>((*s)->latch));
+  }
+}
+
+SIZE_T BufferCache::SumShards(atomic<SIZE_T> BufferShard::*counter) const
+{
+  SIZE_T n=0;
+
+  for (vector<BufferShard *>::const_iterator s=shards.begin(); s!=shards.end(); ++s) {
+    n+=(*s)->*counter;
+  }
+  return n;
+}
+
+void BufferCache::Touch(BufferShard &s, const SIZE_T f)
+{
+  if (frames[f].prefetched) { 
+    // First use of a prefetched block: wait out the rest of the read
+    lock_guard<mutex> d(disklatch);
+    double stall = frames[f].readytime>curtime ? frames[f].readytime-curtime : 0;
+    curtime=curtime+stall;
+    prefetchstall=prefetchstall+stall;
+    prefetchhidden=prefetchhidden+frames[f].fetchtime-stall;
+    prefetchhits++;
+    frames[f].prefetched=false;
+  }
+  frames[f].lastaccessed=curtime;
+  s.policy->Touch(f-s.first,curtime);
+}
+
+SIZE_T BufferCache::FindFrame(const SIZE_T blocknum) const
+{
+  const BufferShard &s=ShardOf(blocknum);
+  SIZE_T f;
+
+  for (f=s.buckets[s.Bucket(blocknum)];
+       f!=BUFFERCACHE_NOFRAME && frames[f].blocknum!=blocknum;
+       f=frames[f].nexthash) {
+  }
+  return f;
+}
+
+// Takes a frame off the shard's free list
+// The caller must have made room with CheckDeleteOldest first
+SIZE_T BufferCache::GrabFrame(BufferShard &s)
+{
+  SIZE_T f=s.freeframes;
+
+  s.freeframes=frames[f].nextfree;
+  frames[f].inuse=false;
+  frames[f].pincount=0;
+  frames[f].prefetched=false;
+  frames[f].reading=false;
+  frames[f].readytime=curtime;
+  frames[f].fetchtime=0;
+  frames[f].unclassified=false;
+  return f;
+}
+
+// Makes a grabbed and filled frame resident for blocknum
+void BufferCache::InstallFrame(BufferShard &s, const SIZE_T f, const SIZE_T blocknum, const double now)
+{
+  SIZE_T b=s.Bucket(blocknum);
+
+  frames[f].blocknum=blocknum;
+  frames[f].inuse=true;
+  frames[f].installtime=curtime;
+  frames[f].nexthash=s.buckets[b];
+  s.buckets[b]=f;
+  s.numresident++;
+  s.policy->Insert(f-s.first,blocknum,now);
+}
+
+void BufferCache::ReturnFrame(BufferShard &s, const SIZE_T f)
+{
+  frames[f].inuse=false;
+  MarkFrameClean(f);
+  frames[f].nextfree=s.freeframes;
+  s.freeframes=f;
+}
+
+void BufferCache::ReleaseFrame(BufferShard &s, const SIZE_T f)
+{
+  if (frames[f].prefetched) { 
+    prefetchwasted++;
+  }
+  // The frame may be reused, so the read must not land later;
+  // its data is going anyway, so a failure doesn't matter
+  SettleFrame(f,false);
+  s.policy->Remove(f-s.first);
+
+  SIZE_T *link=&(s.buckets[s.Bucket(frames[f].blocknum)]);
+  while (*link!=f) { 
+    link=&(frames[*link].nexthash);
+  }
+  *link=frames[f].nexthash;
+  s.numresident--;
+  s.residencies++;
+  s.residencetime=s.residencetime+(curtime-frames[f].installtime);
+
+  ReturnFrame(s,f);
+}
+
+//
+// Find or make a frame for blocknum and touch it.  On a miss the
+// block is read from disk only if fetch is set; otherwise the
+// caller is about to overwrite all of it.
+//
+ERROR_T BufferCache::FetchFrame(BufferShard &s, const SIZE_T blocknum, const bool fetch, SIZE_T &f)
+{
+  f=FindFrame(blocknum);
+
+  if (blocknum<accesscounts.size()) { 
+    accesscounts[blocknum]++;
+  }
+
+  if (f!=BUFFERCACHE_NOFRAME && SettleFrame(f,true)!=ERROR_NOERROR) { 
+    // The prefetch failed, so this is a miss after all
+    ReleaseFrame(s,f);
+    f=BUFFERCACHE_NOFRAME;
+  }
+
+  if (f!=BUFFERCACHE_NOFRAME) { 
+    Touch(s,f);
+    if (fetch) { 
+      s.readhits++;
+    } else {
+      s.writehits++;
+    }
+    return ERROR_NOERROR;
+  }
+
+  if (fetch) { 
+    s.readmisses++;
+  } else {
+    s.writemisses++;
+  }
+
+  // It's not in cache, so time to allocate it
+  int rc=CheckDeleteOldest(blocknum);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  f=GrabFrame(s);
+  {
+    lock_guard<mutex> d(disklatch);
+    if (!(disk->IsBlockAllocated(blocknum))) { 
+      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) { 
+	cerr << "BufferCache: Attempt to " << (fetch ? "read" : "write")
+	     << " unallocated block " << blocknum << endl;
+      }
+    }
+    if (fetch) { 
+      // read it from disk
+      double reqtime, donetime;
+      rc = disk->ReadQueued(blocknum,
+			    1,
+			    blocks[f].data,
+			    curtime,
+			    reqtime,
+			    donetime);
+      ChargeDiskTime(reqtime,donetime);
+      diskreads++;
+    }
+  }
+  if (rc!=ERROR_NOERROR) { 
+    ReturnFrame(s,f);
+    f=BUFFERCACHE_NOFRAME;
+    return rc;
+  }
+  frames[f].lastaccessed=curtime;
+  frames[f].dirty=false;
+  InstallFrame(s,f,blocknum,curtime);
+  if (classifier) { 
+    if (fetch) { 
+      ClassifyMiss(f);
+    } else {
+      frames[f].unclassified=true;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// A prefetched frame's data is being read in the background.  Wait
+// for it to be there before anything looks at the frame or reuses
+// it.  If the frame is about to be used, also find out when the
+// read is done in simulated time; the simulated wait is Touch's
+// business.
+//
+ERROR_T BufferCache::SettleFrame(const SIZE_T f, const bool use)
+{
+  if (!frames[f].reading) { 
+    return ERROR_NOERROR;
+  }
+
+  lock_guard<mutex> d(disklatch);
+
+  if (use && frames[f].prefetched) { 
+    double reqtime, readytime;
+    if (disk->GetDoneTime(frames[f].ticket,reqtime,readytime)==ERROR_NOERROR) { 
+      frames[f].fetchtime=reqtime;
+      frames[f].readytime=readytime;
+    }
+  }
+  frames[f].reading=false;
+  return disk->Complete(frames[f].ticket);
+}
+
+//
+// The caller waited for a request that queued on the disk behind
+// the prefetches and background writes the scheduler put first.
+//
+void BufferCache::ChargeDiskTime(const double reqtime, const double donetime)
+{
+  if (donetime-reqtime>curtime) { 
+    diskqueuewait=diskqueuewait+(donetime-reqtime-curtime);
+  }
+  if (donetime>curtime) { 
+    curtime=donetime;
+  }
+}
+
+//
+// A background request queues behind the disk's current work and
+// nobody waits for it, unless the disk's queue was full and it had
+// to wait to get in (admit).
+//
+void BufferCache::QueueDiskTime(const double admit)
+{
+  if (admit>curtime) { 
+    diskqueuewait=diskqueuewait+(admit-curtime);
+    curtime=admit;
+  }
+}
+
+//
+// Complete background writes, oldest first, until at most keep are
+// outstanding, and recycle their buffers.  Returns the first error
+// among them; the blocks were marked clean when they were submitted.
+//
+ERROR_T BufferCache::ReapWrites(const SIZE_T keep)
+{
+  ERROR_T first=ERROR_NOERROR;
+
+  while (pendingwrites.size()>keep) { 
+    ERROR_T rc=disk->Complete(pendingwrites.front().ticket);
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) { 
+      first=rc;
+    }
+    sparebuffers.push_back(AlignedBytes());
+    sparebuffers.back().swap(pendingwrites.front().data);
+    pendingwrites.pop_front();
+  }
+  return first;
+}
+
+ERROR_T BufferCache::WriteBackFrame(const SIZE_T f)
+{
+  vector<pair<SIZE_T, SIZE_T> > run(1,pair<SIZE_T, SIZE_T>(frames[f].blocknum,1));
+  double reqtime, donetime;
+  int rc;
+
+  {
+    lock_guard<mutex> d(disklatch);
+    rc=disk->WriteQueued(run,
+			 blocks[f].data,
+			 curtime,
+			 reqtime,
+			 donetime);
+    ChargeDiskTime(reqtime,donetime);
+    diskwrites++;
+  }
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  MarkFrameClean(f);
+  return ERROR_NOERROR;
+}
+
+void BufferCache::MarkFrameDirty(const SIZE_T f)
+{
+  if (!frames[f].dirty) { 
+    frames[f].dirty=true;
+    numdirty++;
+  }
+  if (frames[f].unclassified) { 
+    ClassifyMiss(f);
+  }
+}
+
+void BufferCache::MarkFrameClean(const SIZE_T f)
+{
+  if (frames[f].dirty) { 
+    frames[f].dirty=false;
+    numdirty--;
+  }
+}
+
+void BufferCache::ClassifyMiss(const SIZE_T f)
+{
+  SIZE_T c=classifier->Classify(frames[f].blocknum,blocks[f]);
+
+  if (c<BUFFERCACHE_MAXCLASSES) { 
+    classmisses[c]++;
+  }
+  frames[f].unclassified=false;
+}
+
+//
+// Write a run of frames holding consecutive blocks as one disk
+// request in the background.  It is submitted like a prefetch, from
+// a copy of its own that stays put until the write is reaped.
+//
+ERROR_T BufferCache::WriteRun(const vector<SIZE_T> &run)
+{
+  SIZE_T blocksize=GetBlockSize();
+  int rc;
+
+  {
+    lock_guard<mutex> d(disklatch);
+    // Keep no more writes than the disk will queue
+    rc=ReapWrites(disk->GetQueueDepth()-1);
+    if (rc==ERROR_NOERROR) { 
+      PendingWrite w;
+      double admit;
+
+      if (!sparebuffers.empty()) { 
+	w.data.swap(sparebuffers.back());
+	sparebuffers.pop_back();
+      }
+      if (w.data.size()<run.size()*blocksize) { 
+	w.data.resize(run.size()*blocksize);
+      }
+      for (SIZE_T i=0; i<run.size(); i++) {
+	memcpy(&(w.data[i*blocksize]),blocks[run[i]].data,blocksize);
+      }
+      rc=disk->SubmitWrite(frames[run.front()].blocknum,
+			   run.size(),
+			   &(w.data[0]),
+			   curtime,
+			   w.ticket,
+			   admit);
+      if (rc==ERROR_NOERROR) { 
+	QueueDiskTime(admit);
+	pendingwrites.push_back(PendingWrite());
+	pendingwrites.back().ticket=w.ticket;
+	pendingwrites.back().data.swap(w.data);
+      } else {
+	sparebuffers.push_back(AlignedBytes());
+	sparebuffers.back().swap(w.data);
+      }
+    }
+    diskwrites+=run.size();
+  }
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  for (vector<SIZE_T>::const_iterator i=run.begin(); i!=run.end(); ++i) {
+    MarkFrameClean(*i);
+  }
+  writebacks++;
+  writebackblocks+=run.size();
+  return ERROR_NOERROR;
+}
+
+//
+// Write back the dirty frames among blocknums as one batch.
+// Consecutive blocks are merged into one request, and the requests
+// go in C-LOOK order: up from the disk head, then around to the
+// lowest block.
+//
+// The disk model gets the last word, though.  A batch is a one-shot
+// sweep, so going straight up from the lowest block can beat C-LOOK,
+// whose return seek may cost a full stroke.  And the model charges
+// a run that crosses a track boundary a full track-to-track seek,
+// which can cost more than separate requests.  So we estimate fully
+// merged runs, runs split at track boundaries, and single blocks,
+// each in both orders, and use the cheapest.
+// saved is the time this saves over writing the same blocks one at
+// a time in block order.
+//
+ERROR_T BufferCache::FlushBatch(const vector<SIZE_T> &blocknums, double &saved)
+{
+  vector<SIZE_T> dirty;
+
+  saved=0;
+  for (vector<SIZE_T>::const_iterator i=blocknums.begin(); i!=blocknums.end(); ++i) {
+    SIZE_T f=FindFrame(*i);
+    if (f!=BUFFERCACHE_NOFRAME && frames[f].dirty) { 
+      dirty.push_back(*i);
+    }
+  }
+  if (dirty.empty()) { 
+    return ERROR_NOERROR;
+  }
+  sort(dirty.begin(),dirty.end());
+  dirty.erase(unique(dirty.begin(),dirty.end()),dirty.end());
+
+  vector<pair<SIZE_T, SIZE_T> > plans[3];   // (offset, numblocks)
+  vector<pair<SIZE_T, SIZE_T> > runs;
+  SIZE_T pertrack=disk->GetBlocksPerCylinder();
+
+  for (SIZE_T i=0; i<dirty.size(); i++) {
+    bool next = i>0 && dirty[i]==dirty[i-1]+1;
+    if (next) { 
+      plans[0].back().second++;
+    } else {
+      plans[0].push_back(pair<SIZE_T, SIZE_T>(dirty[i],1));
+    }
+    if (next && dirty[i]%pertrack!=0) { 
+      plans[1].back().second++;
+    } else {
+      plans[1].push_back(pair<SIZE_T, SIZE_T>(dirty[i],1));
+    }
+    plans[2].push_back(pair<SIZE_T, SIZE_T>(dirty[i],1));
+  }
+
+  {
+    lock_guard<mutex> d(disklatch);
+    SIZE_T head=disk->GetHeadPosition();
+    double oneatatime=disk->EstimateAccessTime(plans[2],true);
+    double best=-1;
+
+    for (SIZE_T p=0; p<3; p++) {
+      vector<pair<SIZE_T, SIZE_T> > clook(plans[p]);
+      SIZE_T r;
+
+      for (r=0; r<clook.size() && clook[r].first<head; r++) {
+      }
+      rotate(clook.begin(),clook.begin()+r,clook.end());
+
+      double clooktime=disk->EstimateAccessTime(clook,true);
+      double sweeptime=disk->EstimateAccessTime(plans[p],true);
+
+      if (best<0 || clooktime<best) { 
+	best=clooktime;
+	runs=clook;
+      }
+      if (sweeptime<best) { 
+	best=sweeptime;
+	runs=plans[p];
+      }
+    }
+    saved=oneatatime-best;
+  }
+
+  // The frames need not be next to each other in the arena
+  SIZE_T blocksize=GetBlockSize();
+
+  if (staging.size()<dirty.size()*blocksize) { 
+    staging.resize(dirty.size()*blocksize);
+  }
+
+  SIZE_T at=0;
+
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=runs.begin(); r!=runs.end(); ++r) {
+    for (SIZE_T b=(*r).first; b<(*r).first+(*r).second; b++, at++) {
+      memcpy(&(staging[at*blocksize]),blocks[FindFrame(b)].data,blocksize);
+    }
+  }
+
+  int rc;
+
+  {
+    // The whole batch goes to the disk at once, so that its
+    // scheduler can weave it in with whatever is already queued
+    lock_guard<mutex> d(disklatch);
+    double reqtime, donetime;
+
+    rc=disk->WriteQueued(runs,&(staging[0]),curtime,reqtime,donetime);
+    if (rc==ERROR_NOERROR) { 
+      ChargeDiskTime(reqtime,donetime);
+    }
+    diskwrites+=dirty.size();
+  }
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  for (vector<SIZE_T>::const_iterator i=dirty.begin(); i!=dirty.end(); ++i) {
+    MarkFrameClean(FindFrame(*i));
+  }
+  flushsaved=flushsaved+saved;
+  return ERROR_NOERROR;
+}
+
+//
+// Once more than dirtyratio of the frames are dirty, write back
+// unpinned dirty frames in block order, coalescing consecutive
+// blocks, until at most half that many are dirty.
+//
+ERROR_T BufferCache::CheckWriteBack()
+{
+  if (dirtyratio<=0 || (double)numdirty<=dirtyratio*frames.size()) { 
+    return ERROR_NOERROR;
+  }
+
+  vector<unique_lock<mutex> > held;
+
+  LockAllShards(held);
+
+  SIZE_T target=(SIZE_T)(dirtyratio*frames.size()/2);
+  vector<pair<SIZE_T, SIZE_T> > dirty;  // (blocknum, frame)
+
+  for (SIZE_T f=0; f<frames.size(); f++) {
+    if (frames[f].inuse && frames[f].dirty && frames[f].pincount==0) { 
+      dirty.push_back(pair<SIZE_T, SIZE_T>(frames[f].blocknum,f));
+    }
+  }
+  sort(dirty.begin(),dirty.end());
+
+  vector<SIZE_T> run;
+  SIZE_T i=0;
+
+  while (i<dirty.size() && numdirty>target) { 
+    run.clear();
+    run.push_back(dirty[i].second);
+    for (i++; i<dirty.size() && dirty[i].first==dirty[i-1].first+1; i++) {
+      run.push_back(dirty[i].second);
+    }
+    int rc=WriteRun(run);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+void BufferCache::GetResidentBlocks(vector<SIZE_T> &blocknums) const
 {
-  // In a real buffer cache, we would use a priority queue to make this O(1)
+  blocknums.clear();
+  for (SIZE_T f=0; f<frames.size(); f++) {
+    if (frames[f].inuse) { 
+      blocknums.push_back(frames[f].blocknum);
+    }
+  }
+  sort(blocknums.begin(),blocknums.end());
+}
+
 
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr=blockmap.end();
-  double oldest = curtime+1;
+ERROR_T BufferCache::CheckDeleteOldest(const SIZE_T incoming)
+{
+  BufferShard &s=ShardOf(incoming);
 
-  // Only delete if the cache is full
-  if (blockmap.size() < cachesize) {
+  // Only delete if the shard is full
+  if (s.numresident < s.capacity && s.freeframes!=BUFFERCACHE_NOFRAME) { 
     return ERROR_NOERROR;
   }
 
-  // Find oldest
-
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-       if ((*i).second.lastaccessed<oldest) { 
-	 oldestptr=i;
-	 oldest=(*i).second.lastaccessed;
-       }
-  }
-  
-  // write and delete it if it exists
- 
-  if (oldestptr!=blockmap.end()) { 
-    if ((*oldestptr).second.dirty) {
-      double reqtime;
-      int rc=disk->Write((*oldestptr).first,
-			 (*oldestptr).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
+  // write and delete the oldest if it exists
+
+  if (s.numresident>0) { 
+    SIZE_T oldest=s.policy->ChooseVictim(s,incoming,curtime);
+    if (oldest==BUFFERCACHE_NOFRAME) { 
+      // everything is pinned
+      return ERROR_NOSPACE;
+    }
+    oldest+=s.first;
+    if (frames[oldest].dirty) { 
+      int rc=WriteBackFrame(oldest);
       if (rc!=ERROR_NOERROR) { 
 	return rc;
       }
+      s.dirtyevictions++;
     }
-    blockmap.erase(oldestptr);
+    s.evictions++;
+    ReleaseFrame(s,oldest);
   }
   return ERROR_NOERROR;
 }
 
 BufferCache::BufferCache(DiskSystem *d,
-			 SIZE_T cs) : 
-   disk(d), cachesize(cs), curtime(0),
-   allocs(0), deallocs(0), reads(0), writes(0),
-   diskreads(0), diskwrites(0)
-{}
+			 SIZE_T cs,
+			 ReplacementPolicyType pt,
+			 SIZE_T ns) :
+   disk(d), cachesize(cs), numshards(ns), policytype(pt), arena(0),
+   curtime(0),
+   allocs(0), deallocs(0), diskreads(0), diskwrites(0),
+   prefetches(0), prefetchhits(0), prefetchwasted(0),
+   prefetchhidden(0), prefetchstall(0), diskqueuewait(0),
+   dirtyratio(0), numdirty(0), writebacks(0), writebackblocks(0),
+   flushsaved(0), classifier(0)
+{
+  // Every shard needs a frame of its own
+  SIZE_T numframes = cachesize>0 ? cachesize : 1;
+
+  if (numshards<1) { 
+    numshards=1;
+  }
+  if (numshards>numframes) { 
+    numshards=numframes;
+  }
+  for (SIZE_T i=0; i<numshards; i++) {
+    shards.push_back(new BufferShard(policytype));
+  }
+  for (SIZE_T c=0; c<BUFFERCACHE_MAXCLASSES; c++) {
+    classmisses[c]=0;
+  }
+}
 
 
 BufferCache::~BufferCache()
@@ -55,36 +633,112 @@ BufferCache::~BufferCache()
   if (disk) { 
     Detach();
   }
+  for (vector<BufferShard *>::iterator s=shards.begin(); s!=shards.end(); ++s) {
+    delete *s;
+  }
+  shards.clear();
+  blocks.clear();
+  free(arena);
+  arena=0;
   disk=0; cachesize=0; curtime=0;
 }
 
+//
+// Carve mem, which must hold NumFrames(size) blocks, into empty
+// frames for a cache of size blocks and deal them out over the
+// shards.  Whatever the old frames held is forgotten, and the old
+// arena is left for the caller to free.
+//
+void BufferCache::LayoutFrames(BYTE_T *mem, const SIZE_T size)
+{
+  SIZE_T numframes = NumFrames(size);
+  SIZE_T blocksize = GetBlockSize();
+
+  arena=mem;
+  blocks.clear();
+  blocks.reserve(numframes);
+  for (SIZE_T f=0; f<numframes; f++) {
+    blocks.emplace_back(arena+(size_t)f*blocksize,blocksize);
+  }
+
+  frames.clear();
+  frames.resize(numframes);
+
+  // Deal the frames out as evenly as we can
+  SIZE_T first=0;
+
+  for (SIZE_T i=0; i<numshards; i++) {
+    BufferShard &s=*(shards[i]);
+    s.frames=&(frames[0]);
+    s.first=first;
+    s.numframes=numframes/numshards + (i<numframes%numshards);
+    s.capacity=size/numshards + (i<size%numshards);
+    s.hashshift=31;
+    while (((SIZE_T)1<<(32-s.hashshift))<s.numframes) { 
+      s.hashshift--;
+    }
+    s.buckets.assign((SIZE_T)1<<(32-s.hashshift),BUFFERCACHE_NOFRAME);
+    s.numresident=0;
+    s.policy->Reset(s.numframes);
+    s.freeframes=BUFFERCACHE_NOFRAME;
+    for (SIZE_T f=first+s.numframes; f>first; f--) {
+      frames[f-1].pincount=0;
+      frames[f-1].prefetched=false;
+      frames[f-1].reading=false;
+      ReturnFrame(s,f-1);
+    }
+    first+=s.numframes;
+  }
+}
+
 ERROR_T BufferCache::Attach()
 {
-  blockmap.clear();
+  void *mem;
+
+  // All of the block data lives in one arena, carved into frames
+  blocks.clear();
+  free(arena);
+  arena=0;
+  if (posix_memalign(&mem,BUFFERCACHE_ALIGNMENT,(size_t)NumFrames(cachesize)*GetBlockSize())) { 
+    return ERROR_NOMEM;
+  }
+  LayoutFrames((BYTE_T*)mem,cachesize);
+  accesscounts.resize(GetNumBlocks(),0);
+  disk->RestartQueueModel();
+  numdirty=0;
   return ERROR_NOERROR;
 }
 
 ERROR_T BufferCache::Detach()
 {
-  // write out all of our data and then throw it away
-
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-    if ((*i).second.dirty) { 
-      double reqtime;
-      int rc=disk->Write((*i).first,
-			 (*i).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
-    }
+  // write out all of our data as one batch and then throw it away
+
+  vector<unique_lock<mutex> > held;
+  vector<SIZE_T> resident;
+  double saved;
+
+  LockAllShards(held);
+  GetResidentBlocks(resident);
+
+  int rc=FlushBatch(resident,saved);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
   }
-  blockmap.clear();
-  return ERROR_NOERROR;
+  for (vector<SIZE_T>::const_iterator i=resident.begin(); i!=resident.end(); ++i) {
+    ReleaseFrame(ShardOf(*i),FindFrame(*i));
+  }
+  // and let any outstanding prefetches and background writes drain
+  lock_guard<mutex> d(disklatch);
+  double idle=disk->GetIdleTime();
+  if (idle>curtime) { 
+    curtime=idle;
+  }
+  rc=ReapWrites(0);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  // A mapped disk only writes back when asked
+  return disk->Sync();
 }
 
 
@@ -93,6 +747,144 @@ SIZE_T BufferCache::GetCacheSize() const
   return cachesize;
 }
 
+// The hash table has up to two buckets per frame
+static const size_t FRAME_OVERHEAD=sizeof(BufferFrame)+sizeof(Block)+2*sizeof(SIZE_T);
+
+SIZE_T BufferCache::FramesForBudget(const size_t bytes, const SIZE_T blocksize)
+{
+  return bytes/(blocksize+FRAME_OVERHEAD);
+}
+
+size_t BufferCache::GetMemoryFootprint() const
+{
+  return frames.size()*(GetBlockSize()+FRAME_OVERHEAD);
+}
+
+ERROR_T BufferCache::Resize(const SIZE_T newsize)
+{
+  if (!arena) { 
+    // Not attached yet, so Attach will do the work
+    cachesize=newsize;
+    return ERROR_NOERROR;
+  }
+
+  vector<unique_lock<mutex> > held;
+
+  LockAllShards(held);
+
+  for (SIZE_T f=0; f<frames.size(); f++) {
+    if (frames[f].inuse && frames[f].pincount>0) { 
+      return ERROR_CONFLICT;
+    }
+  }
+
+  SIZE_T blocksize=GetBlockSize();
+  void *mem;
+
+  // Get the memory first so that failing leaves everything alone
+  if (posix_memalign(&mem,BUFFERCACHE_ALIGNMENT,(size_t)NumFrames(newsize)*blocksize)) { 
+    return ERROR_NOMEM;
+  }
+
+  // Nothing may still be arriving in the old arena
+  for (SIZE_T f=0; f<frames.size(); f++) {
+    if (frames[f].inuse && SettleFrame(f,true)!=ERROR_NOERROR) { 
+      ReleaseFrame(ShardOf(frames[f].blocknum),f);
+    }
+  }
+
+  // Each shard's policy picks what goes, just as if it were making
+  // room for new blocks.  The victims stay in the block map so that
+  // they can be flushed together.
+  vector<bool>   leaving(frames.size(),false);
+  vector<SIZE_T> victims;
+  vector<bool>   wasdirty;
+
+  for (SIZE_T i=0; i<numshards; i++) {
+    BufferShard &s=*(shards[i]);
+    SIZE_T capacity=newsize/numshards + (i<newsize%numshards);
+
+    for (SIZE_T n=s.numresident; n>capacity; n--) {
+      SIZE_T v=s.policy->ChooseVictim(s,BUFFERCACHE_NOFRAME,curtime);
+      if (v==BUFFERCACHE_NOFRAME) { 
+	break;
+      }
+      s.policy->Remove(v);
+      v+=s.first;
+      leaving[v]=true;
+      victims.push_back(frames[v].blocknum);
+      wasdirty.push_back(frames[v].dirty);
+    }
+  }
+
+  double saved;
+  int rc=FlushBatch(victims,saved);
+
+  for (SIZE_T i=0; i<victims.size(); i++) {
+    BufferShard &s=ShardOf(victims[i]);
+    SIZE_T v=FindFrame(victims[i]);
+
+    if (rc!=ERROR_NOERROR) { 
+      // Put the victims back and leave the size alone
+      s.policy->Insert(v-s.first,victims[i],frames[v].lastaccessed);
+      continue;
+    }
+    s.evictions++;
+    if (wasdirty[i]) { 
+      s.dirtyevictions++;
+    }
+    if (frames[v].prefetched) { 
+      prefetchwasted++;
+    }
+    s.residencies++;
+    s.residencetime=s.residencetime+(curtime-frames[v].installtime);
+  }
+  if (rc!=ERROR_NOERROR) { 
+    free(mem);
+    return rc;
+  }
+
+  // The rest move over in the order they were last used, so that
+  // the policies see the same recency order
+  vector<pair<double, SIZE_T> > keep;   // (lastaccessed, frame)
+
+  for (SIZE_T f=0; f<frames.size(); f++) {
+    if (frames[f].inuse && !leaving[f]) { 
+      keep.push_back(pair<double, SIZE_T>(frames[f].lastaccessed,f));
+    }
+  }
+  sort(keep.begin(),keep.end());
+
+  BYTE_T *oldarena=arena;
+  vector<BufferFrame> oldframes(frames);
+
+  LayoutFrames((BYTE_T*)mem,newsize);
+  cachesize=newsize;
+
+  for (vector<pair<double, SIZE_T> >::const_iterator k=keep.begin(); k!=keep.end(); ++k) {
+    const BufferFrame &old=oldframes[(*k).second];
+    BufferShard &s=ShardOf(old.blocknum);
+    SIZE_T f=GrabFrame(s);
+
+    memcpy(blocks[f].data,oldarena+(size_t)(*k).second*blocksize,blocksize);
+    frames[f].lastaccessed=old.lastaccessed;
+    frames[f].readytime=old.readytime;
+    frames[f].fetchtime=old.fetchtime;
+    frames[f].prefetched=old.prefetched;
+    frames[f].dirty=old.dirty;
+    frames[f].unclassified=old.unclassified;
+    InstallFrame(s,f,old.blocknum,old.lastaccessed);
+    frames[f].installtime=old.installtime;
+  }
+  free(oldarena);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::SetMemoryBudget(const size_t bytes)
+{
+  return Resize(FramesForBudget(bytes,GetBlockSize()));
+}
+
 
 SIZE_T BufferCache::GetBlockSize() const
 {
@@ -109,14 +901,30 @@ double BufferCache::GetCurrentTime() const
   return curtime;
 }
 
+const char *BufferCache::GetPolicyName() const
+{
+  return shards[0]->policy->GetName();
+}
+
+ERROR_T BufferCache::SetDirtyThreshold(const double ratio)
+{
+  if (ratio<0 || ratio>1) { 
+    return ERROR_BADCONFIG;
+  }
+  dirtyratio=ratio;
+  return CheckWriteBack();
+}
+
 ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
 {
+  lock_guard<mutex> d(disklatch);
   allocs++;
   return disk->NotifyAllocateBlocks(outblocknum,1);
 }
 
 ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
 {
+  lock_guard<mutex> d(disklatch);
   deallocs++;
   return disk->NotifyDeallocateBlocks(inblocknum,1);
 }
@@ -124,135 +932,623 @@ ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
 
 bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
 {
+  lock_guard<mutex> d(disklatch);
   return disk->IsBlockAllocated(inblocknum);
 }
 
+ERROR_T BufferCache::AllocateBlocks(const SIZE_T numblocks, SIZE_T &outblocknum)
+{
+  lock_guard<mutex> d(disklatch);
+  ERROR_T rc=disk->AllocateBlocks(numblocks,outblocknum);
+  if (rc==ERROR_NOERROR) { 
+    allocs+=numblocks;
+  }
+  return rc;
+}
+
+ERROR_T BufferCache::ClearAllocations(const SIZE_T inblocknum, const SIZE_T numblocks)
+{
+  lock_guard<mutex> d(disklatch);
+  return disk->ClearAllocations(inblocknum,numblocks);
+}
+
+SIZE_T BufferCache::GetNumFreeBlocks()
+{
+  lock_guard<mutex> d(disklatch);
+  return disk->GetNumFreeBlocks();
+}
+
 
 ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+  BufferShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.latch);
+  SIZE_T f;
+  ERROR_T rc=FetchFrame(s,inblocknum,true,f);
 
-  b = blockmap.find(inblocknum);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  outblock=blocks[f];
+  s.reads++;
+  return ERROR_NOERROR;
+}
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, just update its lastaccessed and return it
-    outblock=(*b).second;
-    (*b).second.lastaccessed=curtime;
-    reads++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    // read it from disk
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum<<endl;
+ERROR_T BufferCache::ReadBlocks(const SIZE_T inblocknum, const SIZE_T numblocks, vector<Block> &outblocks)
+{
+  vector<unique_lock<mutex> > held;
+  vector<SIZE_T> run;
+  vector<BYTE_T *> bufs;
+  SIZE_T i=0;
+
+  outblocks.clear();
+  if (inblocknum+numblocks>GetNumBlocks()) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+  outblocks.resize(numblocks);
+
+  // A run can cross shards
+  LockAllShards(held);
+
+  while (i<numblocks) { 
+    SIZE_T blocknum=inblocknum+i;
+    SIZE_T f;
+
+    if (FindFrame(blocknum)!=BUFFERCACHE_NOFRAME) { 
+      BufferShard &s=ShardOf(blocknum);
+      ERROR_T rc=FetchFrame(s,blocknum,true,f);
+      if (rc!=ERROR_NOERROR) { 
+	return rc;
       }
+      outblocks[i++]=blocks[f];
+      s.reads++;
+      continue;
+    }
+
+    // Gather frames for the uncached blocks from here on.  They are
+    // not resident until the read is done, so making room for one
+    // can't take another.
+    run.clear();
+    bufs.clear();
+    for (; i+run.size()<numblocks && FindFrame(blocknum+run.size())==BUFFERCACHE_NOFRAME; ) {
+      SIZE_T b=blocknum+run.size();
+      BufferShard &s=ShardOf(b);
+      ERROR_T rc=CheckDeleteOldest(b);
+      if (rc!=ERROR_NOERROR || s.freeframes==BUFFERCACHE_NOFRAME) { 
+	if (run.empty()) { 
+	  return rc!=ERROR_NOERROR ? rc : ERROR_NOSPACE;
+	}
+	break;
+      }
+      run.push_back(GrabFrame(s));
+      bufs.push_back(blocks[run.back()].data);
+    }
+
+    ERROR_T rc;
+
+    {
+      lock_guard<mutex> d(disklatch);
+      double reqtime, donetime;
+
+      for (SIZE_T j=0; j<run.size(); j++) { 
+	if (!(disk->IsBlockAllocated(blocknum+j)) && PRINT_BUFFERCACHE_ALLOCATION_ERRORS) { 
+	  cerr << "BufferCache: Attempt to read unallocated block " << blocknum+j << endl;
+	}
+      }
+      rc=disk->ReadQueued(blocknum,run.size(),&(bufs[0]),curtime,reqtime,donetime);
+      ChargeDiskTime(reqtime,donetime);
+      diskreads+=run.size();
+    }
+    for (SIZE_T j=0; j<run.size(); j++) {
+      BufferShard &s=ShardOf(blocknum+j);
+      if (rc!=ERROR_NOERROR) { 
+	ReturnFrame(s,run[j]);
+	continue;
+      }
+      if (blocknum+j<accesscounts.size()) { 
+	accesscounts[blocknum+j]++;
+      }
+      s.readmisses++;
+      frames[run[j]].lastaccessed=curtime;
+      frames[run[j]].dirty=false;
+      InstallFrame(s,run[j],blocknum+j,curtime);
+      if (classifier) { 
+	ClassifyMiss(run[j]);
+      }
+      outblocks[i+j]=blocks[run[j]];
+      s.reads++;
     }
-    double reqtime;
-    int rc = disk->Read(inblocknum,
-			outblock,
-			reqtime);
-    curtime+=reqtime;
-    diskreads++;
     if (rc!=ERROR_NOERROR) { 
       return rc;
-    } else {
-      outblock.lastaccessed=curtime;
-      outblock.dirty=false;
-      blockmap[inblocknum]=outblock;
-      reads++;
-      return ERROR_NOERROR;
     }
+    i+=run.size();
   }
-} 
- 
+  return ERROR_NOERROR;
+}
+
 ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(inblocknum);
+  if (inblock.length!=GetBlockSize()) { 
+    return ERROR_WRONGSIZEBLOCK;
+  }
+  {
+    BufferShard &s=ShardOf(inblocknum);
+    lock_guard<mutex> l(s.latch);
+    SIZE_T f;
+    ERROR_T rc=FetchFrame(s,inblocknum,false,f);
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, so just replace the block
-    (*b).second=inblock;
-    (*b).second.lastaccessed=curtime;
-    (*b).second.dirty=true;
-    writes++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
-      }
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
     }
-    Block myblock=inblock;
-    myblock.lastaccessed=curtime;
-    myblock.dirty=true;
-    blockmap[inblocknum]=myblock;
-    writes++;
-    return ERROR_NOERROR;
+    memcpy(blocks[f].data,inblock.data,blocks[f].length);
+    frames[f].lastaccessed=curtime;
+    MarkFrameDirty(f);
+    s.writes++;
   }
+  return CheckWriteBack();
 }
-  
+
+ERROR_T BufferCache::PinBlock(const SIZE_T blocknum, Block *&block, const bool fetch)
+{
+  BufferShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.latch);
+  SIZE_T f;
+  ERROR_T rc=FetchFrame(s,blocknum,fetch,f);
+
+  if (rc!=ERROR_NOERROR) { 
+    block=0;
+    return rc;
+  }
+  if (fetch) { 
+    s.reads++;
+  }
+  frames[f].pincount++;
+  block=&(blocks[f]);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::UnpinBlock(const SIZE_T blocknum, const bool dirty)
+{
+  {
+    BufferShard &s=ShardOf(blocknum);
+    lock_guard<mutex> l(s.latch);
+    SIZE_T f=FindFrame(blocknum);
+
+    if (f==BUFFERCACHE_NOFRAME || frames[f].pincount==0) { 
+      return ERROR_NOSUCHBLOCK;
+    }
+    frames[f].pincount--;
+    if (!dirty) { 
+      return ERROR_NOERROR;
+    }
+    frames[f].lastaccessed=curtime;
+    MarkFrameDirty(f);
+    s.writes++;
+  }
+  return CheckWriteBack();
+}
+
+ERROR_T BufferCache::MarkBlockDirty(const SIZE_T blocknum)
+{
+  {
+    BufferShard &s=ShardOf(blocknum);
+    lock_guard<mutex> l(s.latch);
+    SIZE_T f=FindFrame(blocknum);
+
+    if (f==BUFFERCACHE_NOFRAME) { 
+      return ERROR_NOSUCHBLOCK;
+    }
+    frames[f].lastaccessed=curtime;
+    MarkFrameDirty(f);
+    s.writes++;
+  }
+  return CheckWriteBack();
+}
+
 ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
 {
-  // Not implemented yet
-  return ERROR_IMPLBUG;
+  if (blocknum>=disk->GetNumBlocks()) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+
+  BufferShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.latch);
+
+  if (FindFrame(blocknum)!=BUFFERCACHE_NOFRAME) { 
+    // already here or on its way
+    return ERROR_NOERROR;
+  }
+
+  if (s.numresident >= s.capacity || s.freeframes==BUFFERCACHE_NOFRAME) { 
+    // Only take the place of a clean block, since writing back
+    // a dirty one would make the caller wait
+    SIZE_T victim=s.policy->ChooseVictim(s,blocknum,curtime);
+    if (victim==BUFFERCACHE_NOFRAME || frames[s.first+victim].dirty) { 
+      return ERROR_NOFETCH;
+    }
+    ReleaseFrame(s,s.first+victim);
+    s.evictions++;
+  }
+
+  double admit;
+  SIZE_T ticket=0;
+  SIZE_T f=GrabFrame(s);
+  int rc;
+
+  {
+    lock_guard<mutex> d(disklatch);
+    rc = disk->SubmitRead(blocknum,
+			  1,
+			  blocks[f].data,
+			  curtime,
+			  ticket,
+			  admit);
+    diskreads++;
+    if (rc==ERROR_NOERROR) { 
+      QueueDiskTime(admit);
+    }
+  }
+  if (rc!=ERROR_NOERROR) { 
+    ReturnFrame(s,f);
+    return rc;
+  }
+
+  frames[f].lastaccessed=curtime;
+  frames[f].dirty=false;
+  frames[f].prefetched=true;
+  frames[f].reading=true;
+  frames[f].ticket=ticket;
+  // The scheduler decides when the read is done; SettleFrame asks
+  frames[f].readytime=curtime;
+  frames[f].fetchtime=0;
+  InstallFrame(s,f,blocknum,curtime);
+  prefetches++;
+
+  return ERROR_NOERROR;
 }
-  
+
 ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(blocknum);
+  BufferShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.latch);
+  SIZE_T f=FindFrame(blocknum);
 
-  if (b==blockmap.end()) { 
+  if (f==BUFFERCACHE_NOFRAME) { 
     return ERROR_NOERROR;
   } else {
-    if ((*b).second.dirty) { 
-      double reqtime;
-      int rc;
-      rc=disk->Write((*b).first,
-		     (*b).second,
-		     reqtime);
-      diskwrites++;
-      curtime+=reqtime;
+    if (frames[f].dirty) { 
+      int rc=WriteBackFrame(f);
       if (rc!=ERROR_NOERROR) { 
 	return rc;
       }
     }
-    blockmap.erase(b);
+    if (frames[f].pincount==0) { 
+      ReleaseFrame(s,f);
+    }
     return ERROR_NOERROR;
   }
 }
-  
+
+ERROR_T BufferCache::FlushBlocks(const vector<SIZE_T> &blocknums, double &saved)
+{
+  vector<unique_lock<mutex> > held;
+
+  LockAllShards(held);
+
+  int rc=FlushBatch(blocknums,saved);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  for (vector<SIZE_T>::const_iterator i=blocknums.begin(); i!=blocknums.end(); ++i) {
+    SIZE_T f=FindFrame(*i);
+    if (f!=BUFFERCACHE_NOFRAME && frames[f].pincount==0) { 
+      ReleaseFrame(ShardOf(*i),f);
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T BufferCache::GetNumReads() const
+{
+  return SumShards(&BufferShard::reads);
+}
+
+SIZE_T BufferCache::GetNumWrites() const
+{
+  return SumShards(&BufferShard::writes);
+}
+
+SIZE_T BufferCache::GetNumHits() const
+{
+  return GetNumReadHits()+GetNumWriteHits();
+}
+
+SIZE_T BufferCache::GetNumMisses() const
+{
+  return GetNumReadMisses()+GetNumWriteMisses();
+}
+
+static double Ratio(const SIZE_T hits, const SIZE_T misses)
+{
+  return hits+misses>0 ? (double)hits/(double)(hits+misses) : 0;
+}
+
+double BufferCache::GetHitRatio() const
+{
+  return Ratio(GetNumHits(),GetNumMisses());
+}
+
+double BufferCache::GetReadHitRatio() const
+{
+  return Ratio(GetNumReadHits(),GetNumReadMisses());
+}
+
+double BufferCache::GetWriteHitRatio() const
+{
+  return Ratio(GetNumWriteHits(),GetNumWriteMisses());
+}
+
+double BufferCache::GetAverageResidency() const
+{
+  SIZE_T n=0;
+  double total=0;
+
+  for (vector<BufferShard *>::const_iterator s=shards.begin(); s!=shards.end(); ++s) {
+    n+=(*s)->residencies;
+    total+=(*s)->residencetime;
+  }
+  return n>0 ? total/n : 0;
+}
+
+void BufferCache::GetAccessHistogram(vector<SIZE_T> &hist) const
+{
+  vector<unique_lock<mutex> > held;
+
+  LockAllShards(held);
+  hist.clear();
+  for (vector<SIZE_T>::const_iterator a=accesscounts.begin(); a!=accesscounts.end(); ++a) {
+    if (*a==0) { 
+      continue;
+    }
+    SIZE_T k=0;
+    while ((*a>>(k+1))>0) { 
+      k++;
+    }
+    if (hist.size()<=k) { 
+      hist.resize(k+1,0);
+    }
+    hist[k]++;
+  }
+}
+
+void BufferCache::SetBlockClassifier(const BlockClassifier *c)
+{
+  classifier=c;
+}
+
+SIZE_T BufferCache::GetNumClassMisses(const SIZE_T c) const
+{
+  return c<BUFFERCACHE_MAXCLASSES ? (SIZE_T)classmisses[c] : 0;
+}
+
 ostream & BufferCache::Print(ostream &os) const
 {
+  vector<unique_lock<mutex> > held;
+
+  LockAllShards(held);
+
   os << "BufferCache(cachesize="<<cachesize
      << ", blocksize="<<GetBlockSize()
+     << ", shards="<<numshards
+     << ", arenabytes="<<(size_t)blocks.size()*GetBlockSize()
+     << ", policy="<<GetPolicyName()
+     << ", hits="<<GetNumHits()
+     << ", misses="<<GetNumMisses()
+     << ", hitratio="<<GetHitRatio()
+     << ", evictions="<<GetNumEvictions()
+     << ", dirtyevictions="<<GetNumDirtyEvictions()
      << ", curtime="<<curtime
      << ", allocs="<<allocs
      << ", deallocs="<<deallocs
-     << ", reads="<<reads
-     << ", writes="<<writes
+     << ", reads="<<GetNumReads()
+     << ", writes="<<GetNumWrites()
      << ", diskreads="<<diskreads
      << ", diskwrites="<<diskwrites
+     << ", prefetches="<<prefetches
+     << ", prefetchhits="<<prefetchhits
+     << ", prefetchwasted="<<prefetchwasted
+     << ", prefetchhidden="<<prefetchhidden
+     << ", prefetchstall="<<prefetchstall
+     << ", diskqueuewait="<<diskqueuewait
+     << ", dirtyratio="<<dirtyratio
+     << ", dirty="<<numdirty
+     << ", writebacks="<<writebacks
+     << ", writebackblocks="<<writebackblocks
+     << ", flushsaved="<<flushsaved
      << ", blocks = {";
 
-  
-  for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b=blockmap.begin(); 
-       b!=blockmap.end(); 
+  vector<SIZE_T> resident;
+
+  GetResidentBlocks(resident);
+
+  for (vector<SIZE_T>::const_iterator b=resident.begin(); 
+       b!=resident.end(); 
        ++b) {
-    if (b!=blockmap.begin()) { 
+    if (b!=resident.begin()) { 
       os << ", ";
     }
-    os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+    os << (*b) << (frames[FindFrame(*b)].dirty ? "(dirty)" : "");
   }
+
+  lock_guard<mutex> d(disklatch);
+
   os << "}, disk="<<*disk<<")";
-  
+
+  return os;
+}
+
+
+//
+// One flat object, so that a run's numbers can be pulled out
+// with any JSON reader.  Ratios and times are plain numbers.
+//
+ostream & BufferCache::PrintJSON(ostream &os) const
+{
+  vector<SIZE_T> hist;
+
+  GetAccessHistogram(hist);
+
+  os << "{\n"
+     << "  \"cachesize\": "<<cachesize<<",\n"
+     << "  \"blocksize\": "<<GetBlockSize()<<",\n"
+     << "  \"shards\": "<<numshards<<",\n"
+     << "  \"policy\": \""<<GetPolicyName()<<"\",\n"
+     << "  \"time\": "<<GetCurrentTime()<<",\n"
+     << "  \"allocs\": "<<allocs<<",\n"
+     << "  \"deallocs\": "<<deallocs<<",\n"
+     << "  \"reads\": "<<GetNumReads()<<",\n"
+     << "  \"writes\": "<<GetNumWrites()<<",\n"
+     << "  \"diskreads\": "<<diskreads<<",\n"
+     << "  \"diskwrites\": "<<diskwrites<<",\n"
+     << "  \"hits\": "<<GetNumHits()<<",\n"
+     << "  \"misses\": "<<GetNumMisses()<<",\n"
+     << "  \"hitratio\": "<<GetHitRatio()<<",\n"
+     << "  \"readhits\": "<<GetNumReadHits()<<",\n"
+     << "  \"readmisses\": "<<GetNumReadMisses()<<",\n"
+     << "  \"readhitratio\": "<<GetReadHitRatio()<<",\n"
+     << "  \"writehits\": "<<GetNumWriteHits()<<",\n"
+     << "  \"writemisses\": "<<GetNumWriteMisses()<<",\n"
+     << "  \"writehitratio\": "<<GetWriteHitRatio()<<",\n"
+     << "  \"evictions\": "<<GetNumEvictions()<<",\n"
+     << "  \"dirtyevictions\": "<<GetNumDirtyEvictions()<<",\n"
+     << "  \"averageresidency\": "<<GetAverageResidency()<<",\n"
+     << "  \"prefetches\": "<<prefetches<<",\n"
+     << "  \"prefetchhits\": "<<prefetchhits<<",\n"
+     << "  \"prefetchwasted\": "<<prefetchwasted<<",\n"
+     << "  \"prefetchhidden\": "<<prefetchhidden<<",\n"
+     << "  \"prefetchstall\": "<<prefetchstall<<",\n"
+     << "  \"diskqueuewait\": "<<diskqueuewait<<",\n"
+     << "  \"dirtyratio\": "<<dirtyratio<<",\n"
+     << "  \"writebacks\": "<<writebacks<<",\n"
+     << "  \"writebackblocks\": "<<writebackblocks<<",\n"
+     << "  \"flushsaved\": "<<flushsaved<<",\n"
+     << "  \"diskscheduler\": \""<<DiskSchedName(disk->GetScheduler())<<"\",\n"
+     << "  \"diskrequests\": "<<disk->GetSchedStats().requests<<",\n"
+     << "  \"diskseektime\": "<<disk->GetSchedStats().seektime<<",\n"
+     << "  \"diskrotationtime\": "<<disk->GetSchedStats().rotationtime<<",\n"
+     << "  \"disktransfertime\": "<<disk->GetSchedStats().transfertime<<",\n"
+     << "  \"diskschedqueuetime\": "<<disk->GetSchedStats().queuetime<<",\n"
+     << "  \"diskdevice\": \""<<DiskDeviceName(disk->GetDeviceModel())<<"\",\n"
+     << "  \"diskcelltime\": "<<disk->GetSchedStats().celltime<<",\n"
+     << "  \"diskgctime\": "<<disk->GetSchedStats().gctime<<",\n"
+     << "  \"diskhostpages\": "<<disk->GetSchedStats().hostpages<<",\n"
+     << "  \"diskflashpages\": "<<disk->GetSchedStats().flashpages<<",\n"
+     << "  \"diskerases\": "<<disk->GetSchedStats().erases<<",\n"
+     << "  \"missesbytype\": {";
+  if (classifier) { 
+    for (SIZE_T c=0; c<classifier->GetNumClasses() && c<BUFFERCACHE_MAXCLASSES; c++) {
+      os << (c>0 ? ", " : "") << "\""<<classifier->GetClassName(c)<<"\": "<<classmisses[c];
+    }
+  }
+  os << "},\n"
+     << "  \"accesshistogram\": [";
+  for (SIZE_T k=0; k<hist.size(); k++) {
+    os << (k>0 ? ", " : "")
+       << "{\"min\": "<<((SIZE_T)1<<k)
+       << ", \"max\": "<<(((SIZE_T)2<<k)-1)
+       << ", \"blocks\": "<<hist[k]<<"}";
+  }
+  os << "]\n"
+     << "}\n";
+
   return os;
 }
-  
+
+ERROR_T ParseCacheSize(const char *arg, const SIZE_T blocksize, SIZE_T &cachesize)
+{
+  char *end;
+  unsigned long long n=strtoull(arg,&end,10);
+
+  if (end==arg || blocksize==0) { 
+    return ERROR_BADCONFIG;
+  }
+  if (*end==0) { 
+    cachesize=n;
+    return ERROR_NOERROR;
+  }
+
+  const char *units="BKMG";
+  const char *u=strchr(units,toupper(*end));
+
+  if (!u) { 
+    return ERROR_BADCONFIG;
+  }
+  for (; u>units; u--) {
+    n*=1024;
+  }
+  end++;
+  if (toupper(*end)=='B' && *(end-1)!='B' && *(end-1)!='b') { 
+    // as in 4MB
+    end++;
+  }
+  if (*end!=0) { 
+    return ERROR_BADCONFIG;
+  }
+  cachesize=BufferCache::FramesForBudget(n,blocksize);
+  return ERROR_NOERROR;
+}
+
+ERROR_T WriteStatsJSON(const BufferCache &cache, const char *program, const char *path)
+{
+  ofstream out(path);
+
+  if (!out) { 
+    cerr << "Can't write statistics to "<<path<<endl;
+    return ERROR_NOFILE;
+  }
+  out << "{\"program\": \""<<program<<"\", \"buffercache\": ";
+  cache.PrintJSON(out);
+  out << "}\n";
+  return out ? ERROR_NOERROR : ERROR_NOFILE;
+}
+
+ERROR_T DumpStatsJSON(const BufferCache &cache, const char *program)
+{
+  const char *path=getenv(BUFFERCACHE_STATS_ENV);
+
+  if (!path || !*path) { 
+    return ERROR_NOERROR;
+  }
+  return WriteStatsJSON(cache,program,path);
+}
+
+
+ERROR_T BlockPin::Pin(BufferCache *c, const SIZE_T b, const bool fetch)
+{
+  ERROR_T rc=Release();
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  rc=c->PinBlock(b,block,fetch);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  cache=c;
+  blocknum=b;
+  dirty=false;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BlockPin::Release()
+{
+  if (!block) { 
+    return ERROR_NOERROR;
+  }
+  ERROR_T rc=cache->UnpinBlock(blocknum,dirty);
+  cache=0;
+  block=0;
+  dirty=false;
+  return rc;
+}
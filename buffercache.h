@@ -2,39 +2,218 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "replacementpolicy.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-  bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-    return s1<s2;
+// Alignment of the frame arena, and of the other buffers that go to
+// the disk, so that DISK_IO_DIRECT can use them without a copy
+const SIZE_T BUFFERCACHE_ALIGNMENT=4096;
+
+template <typename T>
+struct AlignedAllocator {
+  typedef T value_type;
+  AlignedAllocator() {}
+  template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+  T *allocate(size_t n) {
+    void *mem;
+    if (posix_memalign(&mem,BUFFERCACHE_ALIGNMENT,n*sizeof(T))) { 
+      throw bad_alloc();
+    }
+    return (T*)mem;
   }
+  void deallocate(T *p, size_t) { free(p); }
+  template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+  template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+typedef vector<BYTE_T, AlignedAllocator<BYTE_T> > AlignedBytes;
+
+//
+// A frame holds one cached block.  The block data of all the frames
+// is one arena allocated at Attach; frame f's data starts at
+// f*blocksize.  The metadata is this separate array, and each shard
+// owns a contiguous slice of it.  Empty frames are threaded onto
+// their shard's free list through nextfree; which resident frame
+// goes next is up to the shard's replacement policy.
+//
+struct BufferFrame {
+  SIZE_T blocknum;
+  SIZE_T pincount;      // pinned frames are never chosen for eviction
+  SIZE_T nextfree;
+  SIZE_T nexthash;      // next frame in the same hash bucket
+  SIZE_T ticket;        // the disk request filling it, while reading
+  double lastaccessed;
+  double readytime;     // simulated time at which the data is in the frame
+  double fetchtime;     // disk time spent filling a prefetched frame
+  double installtime;   // simulated time at which the block came in
+  bool   inuse;
+  bool   dirty;
+  bool   prefetched;    // filled by PrefetchBlock and not yet touched
+  bool   reading;       // the prefetch read has not been Completed
+  bool   unclassified;  // a write miss whose kind we learn once it is written
+};
+
+
+// Most kinds of block a BlockClassifier may report
+const SIZE_T BUFFERCACHE_MAXCLASSES=8;
+
+//
+// Tells the cache what kind of data a block holds, so that misses
+// can be broken down by kind.  Classify sees the block as read on a
+// miss, or, for a block that was not read because the caller meant
+// to overwrite it, as first written.  It may be called with a shard
+// latch held, so it must not call back into the cache.
+//
+class BlockClassifier {
+ public:
+  virtual ~BlockClassifier() {}
+  virtual SIZE_T      GetNumClasses() const = 0;
+  virtual const char *GetClassName(const SIZE_T c) const = 0;
+  virtual SIZE_T      Classify(const SIZE_T blocknum, const Block &block) const = 0;
 };
 
 
 //
-// LRU block cache with single step prefetch
+// A shard caches the blocks whose numbers are congruent to its
+// index modulo the number of shards.  Its latch protects its block
+// map, free list, replacement state, and the frames in its slice.
+// The policy numbers frames from zero within the slice.
+//
+// The block map is a hash table chained through the frames, with
+// at least as many buckets as frames, so nothing is allocated after
+// Attach.
+//
+struct BufferShard : public EvictionCheck {
+  mutex                         latch;
+  const BufferFrame            *frames;     // the cache's frame array
+  SIZE_T                        first;      // first frame of the slice
+  SIZE_T                        numframes;
+  SIZE_T                        capacity;   // blocks it may hold
+  ReplacementPolicy            *policy;
+  vector<SIZE_T>                buckets;    // first frame in each chain
+  SIZE_T                        hashshift;
+  SIZE_T                        numresident;
+  SIZE_T                        freeframes; // head of the free list
+  atomic<SIZE_T>                readhits, readmisses, writehits, writemisses;
+  atomic<SIZE_T>                reads, writes;
+  atomic<SIZE_T>                evictions, dirtyevictions;
+  atomic<SIZE_T>                residencies;   // blocks that have left
+  atomic<double>                residencetime; // total time they spent here
+
+  BufferShard(const ReplacementPolicyType type);
+  ~BufferShard();
+
+  bool   CanEvict(const SIZE_T frame) const { return frames[first+frame].pincount==0; }
+  // Fibonacci hashing, since the low bits of our block numbers agree
+  SIZE_T Bucket(const SIZE_T blocknum) const { return (SIZE_T)(blocknum*2654435761U)>>hashshift; }
+};
+
+
+//
+// Block cache with single step prefetch
 //
 // Write Back
 // Write Allocate
+//
+// Optionally, dirty blocks are also written back in the background
+// once too many frames are dirty, so that evictions find clean
+// frames.  Contiguous dirty blocks go to the disk as one request.
+//
+// Lookup is through a hash table from block number to frame.
+// Replacement is LRU by default, or any of the policies in
+// replacementpolicy.h.
+//
+// With more than one shard, any number of threads may use the
+// cache at once.  Each call holds only its block's shard latch
+// (plus the disk latch while it is using the disk), so hits on
+// different shards proceed in parallel.  Detach, background
+// writeback, and Print take every shard latch, in shard order.
+// A pin keeps a block resident but does not serialize access to
+// its contents; that is up to the caller.  Attach must not race
+// with anything.
+//
 class BufferCache {
  private:
   DiskSystem *disk;
   SIZE_T cachesize;
-  map<SIZE_T, Block, cache_compare_lessthan> blockmap;
-  double curtime;
-  SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+  SIZE_T numshards;
+  ReplacementPolicyType policytype;
+  BYTE_T *arena;
+  vector<Block> blocks;                     // views of the arena, one per frame
+  vector<BufferFrame> frames;
+  vector<BufferShard *> shards;
+  AlignedBytes staging;                     // for writing back batches
+  struct PendingWrite {
+    SIZE_T         ticket;
+    AlignedBytes   data;                    // must outlive the request
+  };
+  deque<PendingWrite> pendingwrites;        // background writes, oldest first
+  vector<AlignedBytes> sparebuffers;        // for the next ones
+  mutable mutex disklatch;                  // disk, pendingwrites, time totals
+  atomic<double> curtime;
+  atomic<SIZE_T> allocs, deallocs, diskreads, diskwrites;
+  atomic<SIZE_T> prefetches, prefetchhits, prefetchwasted;
+  atomic<double> prefetchhidden, prefetchstall, diskqueuewait;
+  double dirtyratio;                        // 0 means no background writeback
+  atomic<SIZE_T> numdirty;
+  atomic<SIZE_T> writebacks, writebackblocks;
+  atomic<double> flushsaved;
+  const BlockClassifier *classifier;
+  atomic<SIZE_T> classmisses[BUFFERCACHE_MAXCLASSES];
+  vector<SIZE_T> accesscounts;              // per block, under its shard latch
+
+  BufferShard &ShardOf(const SIZE_T blocknum) const { return *(shards[blocknum%shards.size()]); }
+  // Every shard needs a frame of its own, even in a zero-sized cache
+  SIZE_T  NumFrames(const SIZE_T size) const { return size>numshards ? size : numshards; }
+  void    LayoutFrames(BYTE_T *mem, const SIZE_T size);
+  void    LockAllShards(vector<unique_lock<mutex> > &held) const;
+  SIZE_T  SumShards(atomic<SIZE_T> BufferShard::*counter) const;
+
+  // These expect the shard latch (or all of them) to be held
+  void    Touch(BufferShard &s, const SIZE_T frame);
+  SIZE_T  FindFrame(const SIZE_T blocknum) const;
+  SIZE_T  GrabFrame(BufferShard &s);
+  void    InstallFrame(BufferShard &s, const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void    ReturnFrame(BufferShard &s, const SIZE_T frame);
+  void    ReleaseFrame(BufferShard &s, const SIZE_T frame);
+  ERROR_T FetchFrame(BufferShard &s, const SIZE_T blocknum, const bool fetch, SIZE_T &frame);
+  ERROR_T SettleFrame(const SIZE_T frame, const bool use);
+  ERROR_T WriteBackFrame(const SIZE_T frame);
+  void    MarkFrameDirty(const SIZE_T frame);
+  void    MarkFrameClean(const SIZE_T frame);
+  void    ClassifyMiss(const SIZE_T frame);
+  ERROR_T WriteRun(const vector<SIZE_T> &run);
+  ERROR_T FlushBatch(const vector<SIZE_T> &blocknums, double &saved);
+  void    GetResidentBlocks(vector<SIZE_T> &blocknums) const;
+
+  // These expect the disk latch to be held
+  void    ChargeDiskTime(const double reqtime, const double donetime);
+  void    QueueDiskTime(const double admit);
+  ERROR_T ReapWrites(const SIZE_T keep);
+
+  // This expects no latch to be held
+  ERROR_T CheckWriteBack();
  protected:
-  ERROR_T CheckDeleteOldest();
+  // Make room for incoming in its shard if the shard is full
+  // The shard latch must be held
+  ERROR_T CheckDeleteOldest(const SIZE_T incoming);
  public:
-  // Cache size is in number of blocks
+  // Cache size is in number of blocks, split evenly over the shards
   BufferCache(DiskSystem *disk,
-	      const SIZE_T cachesize);
+	      const SIZE_T cachesize,
+	      const ReplacementPolicyType policy=REPLACE_LRU,
+	      const SIZE_T numshards=1);
   BufferCache() { throw 0; }
   BufferCache(const BufferCache &rhs) { throw 0; } 
   BufferCache & operator=(const BufferCache &rhs) { throw 0; return *this; } 
@@ -42,17 +221,49 @@ class BufferCache {
 
   // Call Attach before your first read or write
   // Call Detach after your last read or write
+  // Detach also Syncs the disk
+  // Attach allocates all of the cache's memory at once
+  // (cachesize*blocksize bytes), or returns ERROR_NOMEM
   ERROR_T Attach();
   ERROR_T Detach();
 
   // Number of blocks in the cache
   SIZE_T GetCacheSize() const;
+
+  // Number of frames that fit in a memory budget of bytes, counting
+  // each frame's bookkeeping as well as its data
+  static SIZE_T FramesForBudget(const size_t bytes, const SIZE_T blocksize);
+  // Bytes the frames take now, by the same count
+  size_t GetMemoryFootprint() const;
+
+  // Change the number of blocks the cache holds.  If it is attached,
+  // the frames move to a new arena of the new size: on a shrink each
+  // shard's policy picks the blocks that go, and the dirty ones are
+  // written back as one batch; the rest stay cached.  Recency order
+  // survives, but other policy history starts over.
+  // ERROR_CONFLICT if any block is pinned, ERROR_NOMEM if the new
+  // arena can't be had (the cache is then unchanged)
+  ERROR_T Resize(const SIZE_T cachesize);
+  // Resize to whatever fits in bytes
+  ERROR_T SetMemoryBudget(const size_t bytes);
   // Number of bytes per block
   SIZE_T GetBlockSize() const;
   // Number of blocks in the underlying device
   SIZE_T GetNumBlocks() const;
   // Current time in the simulation (starts at zero)
   double GetCurrentTime() const;
+  // Name of the replacement policy in use
+  const char *GetPolicyName() const;
+  // Number of shards (never more than the number of frames)
+  SIZE_T GetNumShards() const { return numshards; }
+
+  // Start background writeback whenever more than this fraction
+  // of the frames is dirty.  It cleans until at most half that
+  // fraction is dirty.  Zero (the default) turns it off.
+  // ERROR_BADCONFIG if ratio is not between 0 and 1
+  // Set this before other threads start using the cache.
+  ERROR_T SetDirtyThreshold(const double ratio);
+  double  GetDirtyThreshold() const { return dirtyratio; }
 
   // outblocknum is the number of the block that we just allocated
   // if the error return is nonzero
@@ -61,35 +272,129 @@ class BufferCache {
   ERROR_T NotifyDeallocateBlock(const SIZE_T inblocknum);
   // check to see if we think the block was allocated
   bool  IsBlockAllocated(const SIZE_T inblocknum);
+  // or let the disk's allocator pick: the lowest numblocks free
+  // blocks in a row, first one in outblocknum.  Nothing is read.
+  ERROR_T AllocateBlocks(const SIZE_T numblocks, SIZE_T &outblocknum);
+  // forget what was allocated in a range, as when formatting
+  ERROR_T ClearAllocations(const SIZE_T inblocknum, const SIZE_T numblocks);
+  SIZE_T  GetNumFreeBlocks();
   
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK or other nonzero error codes
   ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock);
+
+  // Read numblocks consecutive blocks into outblocks, which is
+  // cleared first.  Each run of blocks that are not cached is filled
+  // with a single disk request, as for a sequential scan or a bulk
+  // load.  A run stops early if some shard has no frame left to give
+  // it.
+  ERROR_T ReadBlocks(const SIZE_T inblocknum, const SIZE_T numblocks, vector<Block> &outblocks);
   
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK
-  // ERROR_WRONGSIZEBLOCK or other nonzero error codes
+  // ERROR_WRONGSIZEBLOCK (inblock must be exactly one block long)
+  // or other nonzero error codes
   ERROR_T WriteBlock(const SIZE_T inblocknum, const Block &inblock);
   
+  // Pin a block in the cache and point frame at the cached copy,
+  // so that it can be read or modified in place without copying.
+  // A pinned block is never evicted, and the pointer stays valid
+  // until the matching UnpinBlock.  Pins nest.
+  // If fetch is false and the block is not cached, it is not read
+  // from disk; use this when the caller will overwrite all of it.
+  // ERROR_NOSPACE means every frame is pinned
+  ERROR_T PinBlock(const SIZE_T blocknum, Block *&frame, const bool fetch=true);
+
+  // Drop a pin.  If dirty is set, this also counts as a write.
+  ERROR_T UnpinBlock(const SIZE_T blocknum, const bool dirty=false);
+
+  // Note that a pinned block was changed in place
+  ERROR_T MarkBlockDirty(const SIZE_T blocknum);
+
   // Request that a block be read into the cache
   // This returns immediately.
   // ERROR_NOFETCH means that there is no room currently
   // to prefetch the block and it was not prefetched.
+  //
+  // The read joins the disk's queue, where its scheduler decides
+  // when it is served, and does not advance the current time,
+  // unless the disk already has its queue depth of requests
+  // outstanding.  The first read or write of the block waits only
+  // for whatever part of the read has not finished by then.  The
+  // data really is read in the background, and is waited for only
+  // at that first use.
   ERROR_T PrefetchBlock (const SIZE_T blocknum);
   
   // Request that a block be flushed to disk
   // Note that this blocks until the block is finished.
+  // A pinned block is written back but stays in the cache.
   ERROR_T FlushBlock(const SIZE_T blocknum);
+
+  // Flush a batch of blocks.  Whichever of them are cached and
+  // dirty are written back with consecutive blocks merged into one
+  // request and the requests in C-LOOK order from the disk head.
+  // They go to the disk together, so a scheduler other than FCFS
+  // may reorder them among whatever else is queued.  Like
+  // FlushBlock, this waits for the writes, and blocks that are not
+  // pinned leave the cache.  saved is the simulated time saved over
+  // writing the same blocks one at a time in block order.  Detach
+  // flushes everything this way.
+  ERROR_T FlushBlocks(const vector<SIZE_T> &blocknums, double &saved);
   
  
   SIZE_T GetNumAllocs() const { return allocs; }
   SIZE_T GetNumDeallocs() const { return deallocs; }
-  SIZE_T GetNumReads() const { return reads;}
-  SIZE_T GetNumWrites() const { return writes;}
+  SIZE_T GetNumReads() const;
+  SIZE_T GetNumWrites() const;
   SIZE_T GetNumDiskReads() const { return diskreads;}
   SIZE_T GetNumDiskWrites() const { return diskwrites;}
+  // A hit is a read or write of a block that is already resident
+  SIZE_T GetNumHits() const;
+  SIZE_T GetNumMisses() const;
+  double GetHitRatio() const;
+  // Reads are accesses that need the block's contents (ReadBlock,
+  // and PinBlock with fetch); writes are the ones that don't
+  SIZE_T GetNumReadHits() const { return SumShards(&BufferShard::readhits); }
+  SIZE_T GetNumReadMisses() const { return SumShards(&BufferShard::readmisses); }
+  double GetReadHitRatio() const;
+  SIZE_T GetNumWriteHits() const { return SumShards(&BufferShard::writehits); }
+  SIZE_T GetNumWriteMisses() const { return SumShards(&BufferShard::writemisses); }
+  double GetWriteHitRatio() const;
+  // Blocks pushed out to make room, and how many of them were dirty
+  SIZE_T GetNumEvictions() const { return SumShards(&BufferShard::evictions); }
+  SIZE_T GetNumDirtyEvictions() const { return SumShards(&BufferShard::dirtyevictions); }
+  // Mean simulated time from a block coming in to its leaving,
+  // over the blocks that have left (after Detach, all of them)
+  double GetAverageResidency() const;
+  // hist[k] is the number of blocks accessed between 2^k and
+  // 2^(k+1)-1 times.  Blocks never accessed are not counted.
+  void   GetAccessHistogram(vector<SIZE_T> &hist) const;
+  SIZE_T GetNumPrefetches() const { return prefetches;}
+  SIZE_T GetNumPrefetchHits() const { return prefetchhits;}
+  SIZE_T GetNumPrefetchesWasted() const { return prefetchwasted;}
+  // Disk time of used prefetches that overlapped other work
+  double GetPrefetchHiddenTime() const { return prefetchhidden;}
+  // Time spent waiting on prefetches that had not finished
+  double GetPrefetchStallTime() const { return prefetchstall;}
+  // Time foreground requests spent queued behind prefetches
+  double GetDiskQueueWaitTime() const { return diskqueuewait;}
+  SIZE_T GetNumDirty() const { return numdirty;}
+  // Background writes, each of one or more contiguous blocks
+  SIZE_T GetNumWriteBacks() const { return writebacks;}
+  SIZE_T GetNumWriteBackBlocks() const { return writebackblocks;}
+  // Total time saved by batched flushes, Detach included
+  double GetFlushTimeSaved() const { return flushsaved;}
+
+  // Break misses down by the kind of block, as told by classifier.
+  // It must outlive the cache or be replaced.  Zero turns this off.
+  // Set this before other threads start using the cache.
+  void   SetBlockClassifier(const BlockClassifier *classifier);
+  const BlockClassifier *GetBlockClassifier() const { return classifier; }
+  SIZE_T GetNumClassMisses(const SIZE_T c) const;
 
   ostream & Print(ostream &os) const;
+  // All of the statistics as one JSON object
+  ostream & PrintJSON(ostream &os) const;
   
 };
 
@@ -97,4 +402,47 @@ class BufferCache {
 inline ostream & operator<< (ostream &os, const BufferCache &b) { return b.Print(os);}
 
 
+// The environment variable that names a file for DumpStatsJSON
+#define BUFFERCACHE_STATS_ENV "BUFFERCACHE_STATS"
+
+// Cache sizes on command lines are a number of blocks, or, with a
+// suffix of B, K, M, or G (e.g., 4M), a memory budget in bytes from
+// which the number of blocks is worked out for the given blocksize.
+// ERROR_BADCONFIG if arg is neither.
+ERROR_T ParseCacheSize(const char *arg, const SIZE_T blocksize, SIZE_T &cachesize);
+
+// Write the cache's statistics to path as JSON, tagged with the
+// name of the program.  ERROR_NOFILE if the file can't be written.
+ERROR_T WriteStatsJSON(const BufferCache &cache, const char *program, const char *path);
+// The same, to wherever BUFFERCACHE_STATS says, if it is set.
+// The tools call this on their way out.
+ERROR_T DumpStatsJSON(const BufferCache &cache, const char *program);
+
+
+//
+// Holds a pin on one cached block and drops it when it goes out
+// of scope.  A MarkDirty is applied when the pin is released.
+//
+class BlockPin {
+ private:
+  BufferCache *cache;
+  SIZE_T       blocknum;
+  Block       *block;
+  bool         dirty;
+ public:
+  BlockPin() : cache(0), blocknum(0), block(0), dirty(false) {}
+  BlockPin(const BlockPin &rhs) { throw GenericException(); }
+  BlockPin & operator=(const BlockPin &rhs) { throw GenericException(); return *this; }
+  ~BlockPin() { Release(); }
+
+  ERROR_T Pin(BufferCache *cache, const SIZE_T blocknum, const bool fetch=true);
+  ERROR_T Release();
+
+  void    MarkDirty() { dirty=true; }
+  bool    IsPinned() const { return block!=0; }
+  Block  *GetBlock() const { return block; }
+  BYTE_T *GetData() const { return block->data; }
+};
+
+
 #endif
@@ -20,6 +20,7 @@ int main(int argc, char *argv[])
   remove((string(argv[1])+".data").c_str());
   remove((string(argv[1])+".bitmap").c_str());
   remove((string(argv[1])+".config").c_str());
+  remove((string(argv[1])+".stripe").c_str());
 
   cerr << "Done.\n";
 
@@ -1,15 +1,108 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 
 #include <math.h>
 
 #include "disksystem.h"
 
 
+ERROR_T ParseDiskIOMode(const string &name, DiskIOMode &mode)
+{
+  if (name=="pread") { 
+    mode=DISK_IO_PREAD;
+  } else if (name=="mmap") { 
+    mode=DISK_IO_MMAP;
+  } else if (name=="direct") { 
+    mode=DISK_IO_DIRECT;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T ParseDiskSchedType(const string &name, DiskSchedType &type)
+{
+  if (name=="fcfs") { 
+    type=DISK_SCHED_FCFS;
+  } else if (name=="sstf") { 
+    type=DISK_SCHED_SSTF;
+  } else if (name=="scan") { 
+    type=DISK_SCHED_SCAN;
+  } else if (name=="clook") { 
+    type=DISK_SCHED_CLOOK;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *DiskSchedName(const DiskSchedType type)
+{
+  switch (type) { 
+  case DISK_SCHED_SSTF:
+    return "sstf";
+  case DISK_SCHED_SCAN:
+    return "scan";
+  case DISK_SCHED_CLOOK:
+    return "clook";
+  default:
+    return "fcfs";
+  }
+}
+
+ERROR_T ParseDiskDataLayout(const string &name, DiskDataLayout &layout)
+{
+  if (name=="grow") { 
+    layout=DISK_DATA_GROW;
+  } else if (name=="prealloc") { 
+    layout=DISK_DATA_PREALLOC;
+  } else if (name=="sparse") { 
+    layout=DISK_DATA_SPARSE;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *DiskDataLayoutName(const DiskDataLayout layout)
+{
+  switch (layout) { 
+  case DISK_DATA_PREALLOC:
+    return "prealloc";
+  case DISK_DATA_SPARSE:
+    return "sparse";
+  default:
+    return "grow";
+  }
+}
+
+ERROR_T ParseDiskDeviceType(const string &name, DiskDeviceType &type)
+{
+  if (name=="hdd") { 
+    type=DISK_DEVICE_HDD;
+  } else if (name=="ssd") { 
+    type=DISK_DEVICE_SSD;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *DiskDeviceName(const DiskDeviceType type)
+{
+  return type==DISK_DEVICE_SSD ? "ssd" : "hdd";
+}
+
+// The config and bitmap files are small and still go through stdio
 static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int len)
 {
   SIZE_T left=len;
@@ -29,7 +122,7 @@ static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int le
   return len-left;
 }
 
-static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool trunconeof=true)
+static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len)
 {
   SIZE_T left=len;
   SIZE_T sent;
@@ -37,32 +130,8 @@ static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool
   fseek(f,off,SEEK_SET);
   while (left>0) {
     sent=fread(&(buf[len-left]),1,left,f);
-    if (sent<0) {	
-      return 0;
-    } else if (sent==0) {
-      // if we reached this point, the likely cause is that we
-      // are trying to read a block which has not been allocated yet
-      // Hence, we will try to ftruncate to this size and then retry the
-      // read.  However, we don't want to loop forever doing this,
-      // hence the trunconeof parameter
-      if (!feof(f)) { 
-	// OK, the end of file is not the problem
-	break;
-      } else {
-	// EOF case... should we truncate and try again?
-	if (!trunconeof) { 
-	  break;
-	} else {
-	  // yes!
-	  if (ftruncate(fileno(f),off+len)) { 
-	    // uh oh, something weird is going on
-	    break;
-	  } else {
-	    // OK, now retry, but don't truncate a second time
-	    return myread(f,off,buf,len,false);
-	  }
-	}
-      }
+    if (sent==0) {
+      break;
     } else {
       left-=sent;
     }
@@ -82,38 +151,88 @@ DiskSystem::DiskSystem(const string &filestem,
 		       const double avgseek,
 		       const double trackseek,
 		       const double rotlat) :
+  DiskSystem(filestem,blcks,blcksize)
+{
+  this->offset=offset;
+  numheads=heads;
+  blockspertrack=blckspertrack;
+  numtracks=tracks;
+  averageseeklatency=avgseek;
+  trackseeklatency=trackseek;
+  rotationallatency=rotlat;
+  if (create) { 
+    // Only in this case are the parameters used:
+    InitFromInMemoryConfig();
+  } else {
+    InitFromConfigFile();
+  }
+}
+
+DiskSystem::DiskSystem(const string &filestem,
+		       const SIZE_T blcks,
+		       const SIZE_T blcksize) :
   bitmap(0),
-  datafilefd(0),
+  numbitmapwords(0),
+  allocfrom(0),
+  datafd(-1),
+  directfd(-1),
+  diomemalign(1),
+  diooffalign(1),
+  bounce(0),
+  bouncesize(0),
+  iomode(DISK_IO_PREAD),
+  datalayout(DISK_DATA_GROW),
+  device(DISK_DEVICE_HDD),
+  flash(0),
+  mapping(0),
+  mappedbytes(0),
+  dirtylo(0),
+  dirtyhi(0),
   configfilefd(0),
   bitmapfilefd(0),
+  aio(0),
+  aiotype(ASYNCIO_AUTO),
+  queuedepth(DISKSYSTEM_QUEUEDEPTH),
+  nextticket(0),
+  busyuntil(0),
+  sched(DISK_SCHED_FCFS),
+  scanup(true),
   diskfilestem(filestem), 
-  offset(offset),
+  offset(0),
   numblocks(blcks),
   blocksize(blcksize),
-  numheads(heads),
-  blockspertrack(blckspertrack),
-  numtracks(tracks),
+  numheads(0),
+  blockspertrack(0),
+  numtracks(0),
   last_track(0),
   last_sector(0),
-  averageseeklatency(avgseek),
-  trackseeklatency(trackseek),
-  rotationallatency(rotlat)
+  averageseeklatency(0),
+  trackseeklatency(0),
+  rotationallatency(0)
 {
-  if (create) { 
-    // Only in this case are the parameters used:
-    InitFromInMemoryConfig();
-  } else {
-    InitFromConfigFile();
-  }
+  ResetSchedStats();
 }
 
 DiskSystem::~DiskSystem()
 {
-  WriteConfig();
-  WriteBitMap();
-  fclose(configfilefd);
-  fclose(bitmapfilefd);
-  fclose(datafilefd);
+  // Either may never have been opened
+  if (configfilefd) { 
+    WriteConfig();
+    fclose(configfilefd);
+  }
+  if (bitmapfilefd) { 
+    WriteBitMap();
+    fclose(bitmapfilefd);
+  }
+  // Nothing may still be moving into or out of the file
+  Drain();
+  delete aio;
+  Unmap();
+  CloseDirect();
+  if (datafd>=0) { 
+    close(datafd);
+  }
+  delete flash;
   delete [] bitmap;
 }
 
@@ -157,6 +276,26 @@ ERROR_T DiskSystem::WriteConfig()
   fprintf(configfilefd,"%lf\n",trackseeklatency);
   fprintf(configfilefd,"# rotationalatency\n");
   fprintf(configfilefd,"%lf\n",rotationallatency);
+  fprintf(configfilefd,"# datalayout\n");
+  fprintf(configfilefd,"%s\n",DiskDataLayoutName(datalayout));
+  fprintf(configfilefd,"# device\n");
+  fprintf(configfilefd,"%s\n",DiskDeviceName(device));
+  if (device==DISK_DEVICE_SSD) { 
+    fprintf(configfilefd,"# channels\n");
+    fprintf(configfilefd,"%u\n",flashgeom.channels);
+    fprintf(configfilefd,"# pagesperblock\n");
+    fprintf(configfilefd,"%u\n",flashgeom.pagesperblock);
+    fprintf(configfilefd,"# readlatency\n");
+    fprintf(configfilefd,"%lf\n",flashgeom.readlatency);
+    fprintf(configfilefd,"# programlatency\n");
+    fprintf(configfilefd,"%lf\n",flashgeom.programlatency);
+    fprintf(configfilefd,"# eraselatency\n");
+    fprintf(configfilefd,"%lf\n",flashgeom.eraselatency);
+    fprintf(configfilefd,"# transferlatency\n");
+    fprintf(configfilefd,"%lf\n",flashgeom.transferlatency);
+    fprintf(configfilefd,"# overprovision\n");
+    fprintf(configfilefd,"%lf\n",flashgeom.overprovision);
+  }
   fflush(configfilefd);
 
   return ERROR_NOERROR;
@@ -171,6 +310,8 @@ ERROR_T DiskSystem::ReadConfig()
 #define GETNEXTVAL do { fgets(buf,80,configfilefd); } while (buf[0]=='#')  
 #define PARSEUNSIGNED(x) do { sscanf(buf,"%u",x); } while (0)
 #define PARSEDOUBLE(x) do { sscanf(buf,"%lf",x); } while (0)
+// For values older config files don't have; buf is empty at the end
+#define GETOPTVAL do { buf[0]=0; } while (fgets(buf,80,configfilefd) && buf[0]=='#')
 
   rewind(configfilefd);
   GETNEXTVAL;
@@ -196,18 +337,71 @@ ERROR_T DiskSystem::ReadConfig()
   PARSEDOUBLE(&trackseeklatency);
   GETNEXTVAL;
   PARSEDOUBLE(&rotationallatency);
+  GETOPTVAL;
+  if (strlen(buf)>0 && buf[strlen(buf)-1]=='\n') { 
+    buf[strlen(buf)-1]=0;
+  }
+  datalayout=DISK_DATA_GROW;
+  if (buf[0] && ParseDiskDataLayout(buf,datalayout)!=ERROR_NOERROR) { 
+    cerr << "Unknown data layout "<<buf<<".\n";
+    return ERROR_BADCONFIG;
+  }
+  GETOPTVAL;
+  if (strlen(buf)>0 && buf[strlen(buf)-1]=='\n') { 
+    buf[strlen(buf)-1]=0;
+  }
+  device=DISK_DEVICE_HDD;
+  if (buf[0] && ParseDiskDeviceType(buf,device)!=ERROR_NOERROR) { 
+    cerr << "Unknown device "<<buf<<".\n";
+    return ERROR_BADCONFIG;
+  }
+  if (device==DISK_DEVICE_SSD) { 
+    GETNEXTVAL;
+    PARSEUNSIGNED(&flashgeom.channels);
+    GETNEXTVAL;
+    PARSEUNSIGNED(&flashgeom.pagesperblock);
+    GETNEXTVAL;
+    PARSEDOUBLE(&flashgeom.readlatency);
+    GETNEXTVAL;
+    PARSEDOUBLE(&flashgeom.programlatency);
+    GETNEXTVAL;
+    PARSEDOUBLE(&flashgeom.eraselatency);
+    GETNEXTVAL;
+    PARSEDOUBLE(&flashgeom.transferlatency);
+    GETNEXTVAL;
+    PARSEDOUBLE(&flashgeom.overprovision);
+    if (FlashModel::Check(flashgeom)!=ERROR_NOERROR) { 
+      cerr << "Impossible flash geometry.\n";
+      return ERROR_BADCONFIG;
+    }
+    delete flash;
+    flash=new FlashModel(flashgeom,numblocks);
+  }
 
   return ERROR_NOERROR;
 }
 
 
+//
+// The bitmap file keeps block i in bit 7-i%8 of byte i/8, as it
+// always has.  In memory it is kept in words so that the allocator
+// can look at 64 blocks at a time.
+//
 ERROR_T DiskSystem::WriteBitMap()
 {
   rewind(bitmapfilefd);
   
   SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
+  vector<BYTE_T> bytes(numbitmapbytes,0);
 
-  if (mywrite(bitmapfilefd,0,bitmap,numbitmapbytes)!=numbitmapbytes) { 
+  for (SIZE_T i=0;i<numblocks;i++) { 
+    if ((bitmap[i/64]>>(i%64)) & 0x1) { 
+      bytes[i/8] |= 0x1 << (7-(i%8));
+    }
+  }
+
+  if (numbitmapbytes>0 && 
+      mywrite(bitmapfilefd,0,&(bytes[0]),numbitmapbytes)!=numbitmapbytes) { 
     cerr << "Can't write bitmap file\n";
     return ERROR_IMPLBUG;
   }
@@ -219,25 +413,62 @@ ERROR_T DiskSystem::ReadBitMap()
   rewind(bitmapfilefd);
   
   SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
+  vector<BYTE_T> bytes(numbitmapbytes,0);
 
-  if (bitmap) { delete [] bitmap; } ;
-
-  bitmap = new BYTE_T [numbitmapbytes];
-
-  if (myread(bitmapfilefd,0,bitmap,numbitmapbytes,false)!=numbitmapbytes) { 
+  if (numbitmapbytes>0 && 
+      myread(bitmapfilefd,0,&(bytes[0]),numbitmapbytes)!=numbitmapbytes) { 
     cerr << "Can't read bitmap file\n";
     return ERROR_IMPLBUG;
   }
+
+  NewBitMap();
+  for (SIZE_T i=0;i<numblocks;i++) { 
+    if ((bytes[i/8] >> (7-(i%8))) & 0x1) { 
+      bitmap[i/64] |= (uint64_t)0x1 << (i%64);
+    }
+  }
+  allocfrom=FindBit(0,false);
   return ERROR_NOERROR;
 }
 
+// Open filestem.bitmap and read it, or make it with nothing allocated
+ERROR_T DiskSystem::OpenBitMap(const bool create)
+{
+  string bitmapname = diskfilestem + ".bitmap";
+
+  if (bitmapfilefd) { fclose(bitmapfilefd); }
+
+  if ((bitmapfilefd = fopen(bitmapname.c_str(),create ? "w+" : "r+"))==0) { 
+    return ERROR_NOFILE;
+  }
+  if (create) { 
+    NewBitMap();
+    return WriteBitMap();
+  }
+  return ReadBitMap();
+}
+
+// An empty bitmap, with the bits past the last block set so that the
+// allocator never hands them out
+void DiskSystem::NewBitMap()
+{
+  if (bitmap) { delete [] bitmap; } ;
+
+  numbitmapwords = numblocks / 64 + (numblocks%64 != 0);
+  bitmap = new uint64_t [numbitmapwords+1];
+  memset(bitmap,0,sizeof(uint64_t)*(numbitmapwords+1));
+  if (numblocks%64) { 
+    bitmap[numblocks/64] = ~(uint64_t)0 << (numblocks%64);
+  }
+  allocfrom=0;
+}
+
 
 
 ERROR_T DiskSystem::InitFromConfigFile()
 {
   string configname = diskfilestem + ".config";
   string dataname = diskfilestem + ".data";
-  string bitmapname = diskfilestem + ".bitmap";
   
   if (configfilefd) { fclose(configfilefd); }
   
@@ -257,26 +488,20 @@ ERROR_T DiskSystem::InitFromConfigFile()
     return rc;
   }
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafd>=0) { close(datafd);}
 
-  if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+  if ((datafd = open(dataname.c_str(),O_RDWR))<0) { 
     return ERROR_NOFILE;
   }
+  datafilename=dataname;
 
-
-  if (bitmapfilefd) { fclose(bitmapfilefd);}
-
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"r+"))==0) { 
-    return ERROR_NOFILE;
-  }
-  
-  rc = ReadBitMap();
+  rc=LayOutDataFile(false);
 
   if (rc) { 
     return rc;
   }
 
-  return ERROR_NOERROR;
+  return OpenBitMap(false);
 }
 
 
@@ -322,23 +547,9 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   }
 
 
-  // allocate in-memory bitmap
-
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-  
-  bitmap = new BYTE_T [numbitmapbytes];
-
-  memset(bitmap,0,numbitmapbytes);
-
   // create the bitmap file and write out the bitmap
 
-  if (bitmapfilefd) { fclose(bitmapfilefd); }
-
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"w+"))==0) { 
-    return ERROR_NOFILE;
-  }
-
-  rc = WriteBitMap();
+  rc = OpenBitMap(true);
   
   if (rc) { 
     return rc;
@@ -348,19 +559,20 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   // notice that we will REUSE an existing data file if it exists
   // The idea is that we will write only from offset to offset+blocksize*numblocks
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafd>=0) { close(datafd);}
 
   if (stat(dataname.c_str(),&s)!=-1) { 
     // reuse existing datafile
-    if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+    if ((datafd = open(dataname.c_str(),O_RDWR))<0) { 
       return ERROR_NOFILE;
     }
   } else {
     // create new data file
-    if ((datafilefd = fopen(dataname.c_str(),"w+"))==0) { 
+    if ((datafd = open(dataname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
       return ERROR_NOFILE;
     }
   }
+  datafilename=dataname;
 
   return ERROR_NOERROR;
 }
@@ -373,7 +585,73 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
 // Note, this assumes disk is kept continously busy
 // or that time does not advance except during a disk op
 //
-double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) 
+double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write) 
+{
+  if (flash) { 
+    FlashCost cost;
+    double t=flash->Access(offblock,numblock,write,cost);
+
+    CountFlash(offblock,numblock,write,cost);
+    return t;
+  }
+
+  double seek, rotation, transfer;
+  double t=ModelAccessFrom(last_track,last_sector,offblock,numblock,seek,rotation,transfer);
+
+  schedstats.requests++;
+  schedstats.seektime+=seek;
+  schedstats.rotationtime+=rotation;
+  schedstats.transfertime+=transfer;
+  return t;
+}
+
+double DiskSystem::ServeFlash(const SIZE_T offblock, const SIZE_T numblock, const bool write, const double start)
+{
+  FlashCost cost;
+  double done=flash->Serve(offblock,numblock,write,start,cost);
+
+  CountFlash(offblock,numblock,write,cost);
+  return done;
+}
+
+void DiskSystem::CountFlash(const SIZE_T offblock, const SIZE_T numblock, const bool write, const FlashCost &cost)
+{
+  // There is no head, but the schedulers still go by where the last
+  // request ended
+  if (numblock>0) { 
+    last_track=(offblock+numblock-1)/(numheads*blockspertrack);
+    last_sector=(offblock+numblock-1)%(numheads*blockspertrack);
+  }
+  schedstats.requests++;
+  schedstats.transfertime+=cost.transfertime;
+  schedstats.celltime+=cost.celltime;
+  schedstats.gctime+=cost.gctime;
+  schedstats.hostpages+=write ? numblock : 0;
+  schedstats.flashpages+=cost.programs;
+  schedstats.erases+=cost.erases;
+}
+
+double DiskSystem::ModelAccessFrom(SIZE_T &last_track,
+				   SIZE_T &last_sector,
+				   const SIZE_T offblock,
+				   const SIZE_T numblock) const
+{
+  double seek, rotation, transfer;
+
+  return ModelAccessFrom(last_track,last_sector,offblock,numblock,seek,rotation,transfer);
+}
+
+//
+// The model itself.  The head starts at the given last_track and
+// last_sector, and they are left where the request ends.
+//
+double DiskSystem::ModelAccessFrom(SIZE_T &last_track,
+				   SIZE_T &last_sector,
+				   const SIZE_T offblock,
+				   const SIZE_T numblock,
+				   double &seek,
+				   double &rotation,
+				   double &transfer) const
 {
 
   SIZE_T req_trackstart = (offblock) / (numheads*blockspertrack);
@@ -409,161 +687,1346 @@ double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock)
   last_track=req_trackend;
   last_sector=req_sectorend;
 
+  seek=timeinseek+timeintrackbytrackhops;
+  rotation=timeinrotation;
+  transfer=timeinreadsectors;
+
   return timeinseek+timeinrotation+timeintrackbytrackhops+timeinreadsectors;
 }
 
 
-ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
-			 const SIZE_T   numblock,
-			 vector<Block> &blocks,
-			 double        &reqtime)
+//
+// Which of the requests that have arrived by now goes next.  There
+// is at least one.
+//
+SIZE_T DiskSystem::PickNext(const double now) const
 {
-  reqtime=0;
+  SIZE_T head=GetHeadPosition();
+  SIZE_T percylinder=GetBlocksPerCylinder();
+  SIZE_T best=pending.size();
 
-  if (inoffblock+numblock > numblocks) { 
-    cerr << "DiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
-    return ERROR_NOSPACE;
-  }
+  for (SIZE_T i=0; i<pending.size(); i++) {
+    const QueuedAccess &q=pending[i];
+
+    if (q.arrival>now) { 
+      continue;
+    }
+    if (best==pending.size()) { 
+      best=i;
+      continue;
+    }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+    const QueuedAccess &b=pending[best];
 
-  for (SIZE_T i=0;i<numblock;i++) { 
-    Block b(blocksize);
-    if (!IsBlockAllocated(inoffblock+i)) { 
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
+    switch (sched) { 
+    case DISK_SCHED_SSTF: {
+      SIZE_T qhop=(SIZE_T)fabs((double)(q.off/percylinder)-(double)last_track);
+      SIZE_T bhop=(SIZE_T)fabs((double)(b.off/percylinder)-(double)last_track);
+      if (qhop<bhop) { 
+	best=i;
       }
+      break;
     }
-    if (myread(datafilefd,offset+(inoffblock+i)*blocksize,b.data,blocksize,true)!=blocksize) { 
-      cerr << "DiskSystem::Read: myread has failed"<<endl;
-      return ERROR_IMPLBUG;
+    case DISK_SCHED_SCAN:
+    case DISK_SCHED_CLOOK: {
+      // Prefer the ones ahead of the head, then the nearest
+      bool up = sched==DISK_SCHED_CLOOK || scanup;
+      bool qahead = up ? q.off>=head : q.off<=head;
+      bool bahead = up ? b.off>=head : b.off<=head;
+      if (qahead!=bahead) { 
+	if (qahead) { 
+	  best=i;
+	}
+      } else if (sched==DISK_SCHED_CLOOK || qahead) { 
+	if (up ? q.off<b.off : q.off>b.off) { 
+	  best=i;
+	}
+      } else {
+	// SCAN turning around: the nearest the other way
+	if (up ? q.off>b.off : q.off<b.off) { 
+	  best=i;
+	}
+      }
+      break;
+    }
+    default:
+      // Arrival order, which is the order they are in
+      break;
     }
-    blocks.push_back(b);
   }
-
-  return ERROR_NOERROR;
+  return best;
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
-			  const SIZE_T   numblock,
-			  const vector<Block> &blocks,
-			  double        &reqtime)
+//
+// Start the next request if the disk would by until.  Returns
+// whether it did.
+//
+bool DiskSystem::StartNext(const double until)
 {
-  reqtime=0;
-
-  if (inoffblock+numblock > numblocks) { 
-    cerr << "DiskSystem::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
-    return ERROR_NOSPACE;
+  if (pending.empty()) { 
+    return false;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  // The first to arrive is first in line
+  double start = pending.front().arrival>busyuntil ? pending.front().arrival : busyuntil;
 
-  for (SIZE_T i=0;i<numblock;i++) { 
-    if (!IsBlockAllocated(inoffblock+i)) { 
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
-      }
-    }
-    if (mywrite(datafilefd,offset+(inoffblock+i)*blocksize,blocks[i].data,blocksize)!=blocksize) {  
-      cerr << "DiskSystem::Write: mywrite has failed"<<endl;
-      return ERROR_IMPLBUG;
-    }
+  if (start>until) { 
+    return false;
   }
 
-  return ERROR_NOERROR;
-}
+  SIZE_T i=PickNext(start);
+  QueuedAccess q=pending[i];
 
+  if (sched==DISK_SCHED_SCAN && q.off!=GetHeadPosition()) { 
+    scanup = q.off>GetHeadPosition();
+  }
+  pending.erase(pending.begin()+i);
+
+  double done;
+
+  if (flash) { 
+    // Its channels are what make it wait
+    done=ServeFlash(q.off,q.num,q.write,start);
+    busyuntil=start;
+    inflight.push_back(done);
+  } else { 
+    done=start+ModelAccess(q.off,q.num,q.write);
+    busyuntil=done;
+  }
+  schedstats.queuetime+=start-q.arrival;
+  if (q.want) { 
+    started[q.ticket]=pair<double, double>(done-start,done);
+  }
+  return true;
+}
 
-ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
+SIZE_T DiskSystem::GetOutstanding(const double now)
 {
-  vector<Block> bl;
-
-  ERROR_T rc = Read(inoffblock,1,bl,reqtime);
-
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  if (!flash) { 
+    // The queued ones and the one being served
+    return pending.size()+(busyuntil>now ? 1 : 0);
   }
 
-  blocks = bl[0];
+  SIZE_T kept=0;
 
-  return ERROR_NOERROR;
+  for (SIZE_T i=0; i<inflight.size(); i++) {
+    if (inflight[i]>now) { 
+      inflight[kept++]=inflight[i];
+    }
+  }
+  inflight.resize(kept);
+  return pending.size()+kept;
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+double DiskSystem::GetNextDone(const double now) const
 {
-  vector<Block> bl;
-
-  bl.push_back(blocks);
+  if (!flash) { 
+    return busyuntil;
+  }
 
-  ERROR_T rc = Write(inoffblock,1,bl,reqtime);
+  double next=HUGE_VAL;
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  for (SIZE_T i=0; i<inflight.size(); i++) {
+    if (inflight[i]>now && inflight[i]<next) { 
+      next=inflight[i];
+    }
   }
-
-  return ERROR_NOERROR;
+  return next;
 }
 
-
-SIZE_T DiskSystem::GetBlockSize() const
+void DiskSystem::Dispatch(const double until)
 {
-  return blocksize;
+  while (StartNext(until)) {
+  }
 }
 
-SIZE_T DiskSystem::GetNumBlocks() const
+double DiskSystem::QueueAccess(const SIZE_T ticket,
+			       const SIZE_T off,
+			       const SIZE_T num,
+			       const bool write,
+			       const double now)
 {
-  return numblocks;
-}
+  double admit=now;
 
+  Dispatch(admit);
+  while (GetOutstanding(admit)>=queuedepth) { 
+    // Full: the request waits for a slot
+    admit=GetNextDone(admit);
+    Dispatch(admit);
+  }
 
+  QueuedAccess q;
+
+  q.ticket=ticket;
+  q.off=off;
+  q.num=num;
+  q.write=write;
+  q.arrival=admit;
+  q.want=true;
+  pending.push_back(q);
+  Dispatch(admit);
+  return admit;
+}
 
-#define GETBIT(x) ((bitmap[(x)/8] >> (7-((x)%8))) & 0x1)
-#define SETBIT(x) do { bitmap[(x)/8] |= 0x1 << (7-((x)%8)); } while (0)
-#define CLEARBIT(x) do { bitmap[(x)/8] &= ~(0x1 << (7-((x)%8))); } while (0)
+ERROR_T DiskSystem::FinishAccess(const SIZE_T ticket, double &reqtime, double &donetime)
+{
+  map<SIZE_T, pair<double, double> >::iterator s;
 
+  while ((s=started.find(ticket))==started.end()) { 
+    if (!StartNext(HUGE_VAL)) { 
+      return ERROR_NONEXISTENT;
+    }
+  }
+  reqtime=(*s).second.first;
+  donetime=(*s).second.second;
+  return ERROR_NOERROR;
+}
 
-bool DiskSystem::IsBlockAllocated(const SIZE_T block)
+ERROR_T DiskSystem::GetDoneTime(const SIZE_T ticket, double &reqtime, double &donetime)
 {
-  return GETBIT(block);
+  return FinishAccess(ticket,reqtime,donetime);
 }
 
+double DiskSystem::GetIdleTime()
+{
+  Dispatch(HUGE_VAL);
+  if (flash && flash->GetIdleTime()>busyuntil) { 
+    return flash->GetIdleTime();
+  }
+  return busyuntil;
+}
 
-ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innumblocks)
+void DiskSystem::RestartQueueModel()
 {
-  if (offset+innumblocks > numblocks) { 
-    cerr << "Disksystem: NotifyAllocateBlocks: Attempt to allocate"<<offset<<" to "<<(offset+innumblocks-1)<<" but maximum block is "<<(numblocks-1)<<endl;
-    return ERROR_NOSUCHBLOCK;
+  // The head still has to get through what was queued
+  Dispatch(HUGE_VAL);
+  busyuntil=0;
+  inflight.clear();
+  if (flash) { 
+    flash->RestartClock();
   }
+}
+
+void DiskSystem::ResetSchedStats()
+{
+  schedstats.requests=0;
+  schedstats.seektime=0;
+  schedstats.rotationtime=0;
+  schedstats.transfertime=0;
+  schedstats.queuetime=0;
+  schedstats.celltime=0;
+  schedstats.gctime=0;
+  schedstats.hostpages=0;
+  schedstats.flashpages=0;
+  schedstats.erases=0;
+}
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr << "Disksystem: NotifyAllocateBlocks: Block "<<i<<" is being allocated, but it's already allocated!"<<endl;
-      }
+double DiskSystem::EstimateAccessTime(const vector<pair<SIZE_T, SIZE_T> > &requests,
+				      const bool write) const
+{
+  SIZE_T track=last_track;
+  SIZE_T sector=last_sector;
+  double total=0;
+
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=requests.begin();
+       r!=requests.end();
+       ++r) {
+    if (flash) { 
+      total+=flash->Estimate((*r).first,(*r).second,write);
+    } else {
+      total+=ModelAccessFrom(track,sector,(*r).first,(*r).second);
     }
-    SETBIT(i);
   }
+  return total;
+}
 
-  return ERROR_NOERROR;
+SIZE_T DiskSystem::GetHeadPosition() const
+{
+  return last_track*numheads*blockspertrack + last_sector;
 }
 
-ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset,const SIZE_T innumblocks)
+SIZE_T DiskSystem::GetBlocksPerCylinder() const
 {
-  if (offset+innumblocks > numblocks) { 
-    cerr << "Disksystem: NotifyDeallocateBlocks: Attempt to deallocate"<<offset<<" to "<<(offset+innumblocks-1)<<" but maximum block is "<<(numblocks-1)<<endl;
-    return ERROR_NOSUCHBLOCK;
+  return numheads*blockspertrack;
+}
+
+
+ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
+			 const SIZE_T   numblock,
+			 BYTE_T        *buf,
+			 double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // Whatever was queued goes first
+  Dispatch(HUGE_VAL);
+  reqtime=ModelAccess(inoffblock,numblock,false);
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+  // The blocks are consecutive, so this is one request
+  return ReadData(ByteOffset(inoffblock),buf,(size_t)numblock*blocksize);
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  const BYTE_T  *buf,
+			  double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // Whatever was queued goes first
+  Dispatch(HUGE_VAL);
+  reqtime=ModelAccess(inoffblock,numblock,true);
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+  return WriteData(ByteOffset(inoffblock),buf,(size_t)numblock*blocksize);
+}
+
+
+ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
+			 const SIZE_T   numblock,
+			 vector<Block> &blocks,
+			 double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // Whatever was queued goes first
+  Dispatch(HUGE_VAL);
+  reqtime=ModelAccess(inoffblock,numblock,false);
+
+  if (numblock==0) { 
+    return ERROR_NOERROR;
+  }
+
+  // The new blocks get their buffers in place, and then the whole
+  // run is one request
+  SIZE_T first=blocks.size();
+  vector<BYTE_T *> bufs(numblock);
+
+  blocks.resize(first+numblock);
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+    if (blocks[first+i].Resize(blocksize,false)!=ERROR_NOERROR) { 
+      blocks.resize(first);
+      return ERROR_NOMEM;
+    }
+    bufs[i]=blocks[first+i].data;
+  }
+
+  ERROR_T rc=ReadDataV(ByteOffset(inoffblock),&(bufs[0]),numblock);
+
+  if (rc!=ERROR_NOERROR) { 
+    blocks.resize(first);
+  }
+  return rc;
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  const vector<Block> &blocks,
+			  double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // Whatever was queued goes first
+  Dispatch(HUGE_VAL);
+  reqtime=ModelAccess(inoffblock,numblock,true);
+
+  if (numblock==0) { 
+    return ERROR_NOERROR;
+  }
+
+  vector<const BYTE_T *> bufs(numblock);
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+    if (blocks[i].length<blocksize) { 
+      return ERROR_WRONGSIZEBLOCK;
+    }
+    bufs[i]=blocks[i].data;
+  }
+
+  return WriteDataV(ByteOffset(inoffblock),&(bufs[0]),numblock);
+}
+
+
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
+{
+  if (blocks.Resize(blocksize,false)!=ERROR_NOERROR) { 
+    reqtime=0;
+    return ERROR_NOMEM;
+  }
+
+  return Read(inoffblock,1,blocks.data,reqtime);
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+{
+  if (blocks.length<blocksize) { 
+    reqtime=0;
+    return ERROR_WRONGSIZEBLOCK;
+  }
+
+  return Write(inoffblock,1,blocks.data,reqtime);
+}
+
+
+ERROR_T DiskSystem::ReadData(const off_t off, BYTE_T *buf, const size_t len)
+{
+  // Nothing in flight can be writing a hole
+  if (!mapping && IsHole(off,len)) { 
+    memset(buf,0,len);
+    return ERROR_NOERROR;
+  }
+  WaitForOverlaps(off,len,false);
+  if (mapping) { 
+    memcpy(buf,mapping+off,len);
+    return ERROR_NOERROR;
+  }
+  if (directfd>=0) { 
+    return MoveDirect(false,off,buf,len);
+  }
+  if (PreadFully(datafd,off,buf,len)!=len) { 
+    cerr << "DiskSystem::Read: pread has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::WriteData(const off_t off, const BYTE_T *buf, const size_t len)
+{
+  MarkWritten(off,len);
+  WaitForOverlaps(off,len,true);
+  if (mapping) { 
+    memcpy(mapping+off,buf,len);
+    if (dirtyhi==dirtylo) { 
+      dirtylo=off;
+      dirtyhi=off+len;
+    } else {
+      dirtylo = (size_t)off<dirtylo ? off : dirtylo;
+      dirtyhi = off+len>dirtyhi ? off+len : dirtyhi;
+    }
+    return ERROR_NOERROR;
+  }
+  if (directfd>=0) { 
+    // MoveDirect only reads from buf when writing
+    return MoveDirect(true,off,(BYTE_T*)buf,len);
+  }
+  if (PwriteFully(datafd,off,buf,len)!=len) {  
+    cerr << "DiskSystem::Write: pwrite has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// numblock blocks starting at off, each in its own buffer, with one
+// preadv or pwritev.  In DISK_IO_DIRECT mode all of the buffers must
+// be aligned, or the run goes through the bounce buffer.
+//
+ERROR_T DiskSystem::ReadDataV(const off_t off, BYTE_T *const *bufs, const SIZE_T numblock)
+{
+  size_t len=(size_t)numblock*blocksize;
+  bool aligned = directfd<0;
+
+  if (!mapping && IsHole(off,len)) { 
+    for (SIZE_T i=0; i<numblock; i++) {
+      memset(bufs[i],0,blocksize);
+    }
+    return ERROR_NOERROR;
+  }
+  WaitForOverlaps(off,len,false);
+  if (mapping) { 
+    for (SIZE_T i=0; i<numblock; i++) {
+      memcpy(bufs[i],mapping+off+(size_t)i*blocksize,blocksize);
+    }
+    return ERROR_NOERROR;
+  }
+  for (SIZE_T i=0; !aligned && i<numblock && IsDirectAligned(bufs[i],off,blocksize); i++) {
+    aligned = i==numblock-1;
+  }
+  if (!aligned) { 
+    ERROR_T rc=MoveDirect(false,off,0,len);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    for (SIZE_T i=0; i<numblock; i++) {
+      memcpy(bufs[i],bounce+(size_t)i*blocksize,blocksize);
+    }
+    return ERROR_NOERROR;
+  }
+
+  vector<struct iovec> iov(numblock);
+
+  for (SIZE_T i=0; i<numblock; i++) {
+    iov[i].iov_base=bufs[i];
+    iov[i].iov_len=blocksize;
+  }
+  if (PreadvFully(directfd>=0 ? directfd : datafd,off,&(iov[0]),numblock)!=len) { 
+    cerr << "DiskSystem::Read: preadv has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::WriteDataV(const off_t off, const BYTE_T *const *bufs, const SIZE_T numblock)
+{
+  size_t len=(size_t)numblock*blocksize;
+  bool aligned = directfd<0;
+
+  MarkWritten(off,len);
+  WaitForOverlaps(off,len,true);
+  if (mapping) { 
+    for (SIZE_T i=0; i<numblock; i++) {
+      WriteData(off+(off_t)i*blocksize,bufs[i],blocksize);
+    }
+    return ERROR_NOERROR;
+  }
+  for (SIZE_T i=0; !aligned && i<numblock && IsDirectAligned(bufs[i],off,blocksize); i++) {
+    aligned = i==numblock-1;
+  }
+  if (!aligned) { 
+    ERROR_T rc=GrowBounce(len);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    for (SIZE_T i=0; i<numblock; i++) {
+      memcpy(bounce+(size_t)i*blocksize,bufs[i],blocksize);
+    }
+    return MoveDirect(true,off,bounce,len);
+  }
+
+  vector<struct iovec> iov(numblock);
+
+  for (SIZE_T i=0; i<numblock; i++) {
+    // iovec is used both ways, so it can't promise not to write
+    iov[i].iov_base=(BYTE_T*)bufs[i];
+    iov[i].iov_len=blocksize;
+  }
+  if (PwritevFully(directfd>=0 ? directfd : datafd,off,&(iov[0]),numblock)!=len) { 
+    cerr << "DiskSystem::Write: pwritev has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::Map()
+{
+  size_t len=(size_t)ByteOffset(numblocks);
+  struct stat st;
+
+  if (fstat(datafd,&st) || len==0) { 
+    return ERROR_NOFILE;
+  }
+  // Touching a page past the end of the file would fault
+  if ((size_t)st.st_size<len && ftruncate(datafd,len)) { 
+    return ERROR_NOSPACE;
+  }
+
+  void *m=mmap(0,len,PROT_READ|PROT_WRITE,MAP_SHARED,datafd,0);
+
+  if (m==MAP_FAILED) { 
+    return ERROR_NOMEM;
+  }
+  mapping=(BYTE_T*)m;
+  mappedbytes=len;
+  dirtylo=dirtyhi=0;
+  return ERROR_NOERROR;
+}
+
+void DiskSystem::Unmap()
+{
+  if (mapping) { 
+    Sync();
+    munmap(mapping,mappedbytes);
+    mapping=0;
+    mappedbytes=0;
+  }
+}
+
+//
+// Ask the file system what O_DIRECT needs, where it can say.
+// Otherwise assume the usual 512 byte sectors.
+//
+ERROR_T DiskSystem::OpenDirect()
+{
+  SIZE_T memalign=512, offalign=512;
+
+#if defined(__linux__) && defined(STATX_DIOALIGN)
+  struct statx stx;
+
+  if (statx(datafd,"",AT_EMPTY_PATH,STATX_DIOALIGN,&stx)==0 && (stx.stx_mask & STATX_DIOALIGN)) { 
+    if (stx.stx_dio_offset_align==0) { 
+      cerr << "DiskSystem::SetIOMode: the file system does not do O_DIRECT"<<endl;
+      return ERROR_UNIMPL;
+    }
+    memalign=stx.stx_dio_mem_align;
+    offalign=stx.stx_dio_offset_align;
+  }
+#endif
+
+  if (blocksize%offalign || offset%offalign) { 
+    cerr << "DiskSystem::SetIOMode: O_DIRECT needs a blocksize and offset that are multiples of "<<offalign<<", not "<<blocksize<<" and "<<offset<<endl;
+    return ERROR_BADCONFIG;
+  }
+
+  int fd=open(datafilename.c_str(),O_RDWR|O_DIRECT);
+
+  if (fd<0) { 
+    cerr << "DiskSystem::SetIOMode: can't open "<<datafilename<<" with O_DIRECT: "<<strerror(errno)<<endl;
+    return ERROR_UNIMPL;
+  }
+  directfd=fd;
+  diomemalign=memalign;
+  diooffalign=offalign;
+  return ERROR_NOERROR;
+}
+
+void DiskSystem::CloseDirect()
+{
+  if (directfd>=0) { 
+    close(directfd);
+    directfd=-1;
+  }
+  free(bounce);
+  bounce=0;
+  bouncesize=0;
+  diomemalign=diooffalign=1;
+}
+
+bool DiskSystem::IsDirectAligned(const BYTE_T *buf, const off_t off, const size_t len) const
+{
+  return (uintptr_t)buf%diomemalign==0 && off%diooffalign==0 && len%diooffalign==0;
+}
+
+ERROR_T DiskSystem::GrowBounce(const size_t len)
+{
+  if (bouncesize<len) { 
+    void *mem;
+    if (posix_memalign(&mem,diomemalign,len)) { 
+      return ERROR_NOMEM;
+    }
+    free(bounce);
+    bounce=(BYTE_T*)mem;
+    bouncesize=len;
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// A buf of 0 means the bounce buffer itself
+//
+ERROR_T DiskSystem::MoveDirect(const bool write, const off_t off, BYTE_T *buf, const size_t len)
+{
+  BYTE_T *io=buf;
+
+  // Offsets and lengths are whole blocks, so only buf can be off
+  if (!buf || !IsDirectAligned(buf,off,len)) { 
+    ERROR_T rc=GrowBounce(len);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    io=bounce;
+    if (write && buf) { 
+      memcpy(io,buf,len);
+    }
+  }
+
+  if (write) { 
+    if (PwriteFully(directfd,off,io,len)!=len) { 
+      cerr << "DiskSystem::Write: pwrite has failed"<<endl;
+      return ERROR_IMPLBUG;
+    }
+  } else {
+    if (PreadFully(directfd,off,io,len)!=len) { 
+      cerr << "DiskSystem::Read: pread has failed"<<endl;
+      return ERROR_IMPLBUG;
+    }
+    if (buf && io!=buf) { 
+      memcpy(buf,io,len);
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SetIOMode(const DiskIOMode mode)
+{
+  if (mode==iomode) { 
+    return ERROR_NOERROR;
+  }
+  // Submitted requests have the old mode's buffers and descriptor
+  Drain();
+
+  // Set up the new mode before tearing down the old, so that
+  // failing leaves the old one working
+  ERROR_T rc=ERROR_NOERROR;
+
+  if (mode==DISK_IO_MMAP) { 
+    rc=Map();
+  } else if (mode==DISK_IO_DIRECT) { 
+    rc=OpenDirect();
+  }
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  if (iomode==DISK_IO_MMAP) { 
+    Unmap();
+  } else if (iomode==DISK_IO_DIRECT) { 
+    CloseDirect();
+  }
+  iomode=mode;
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SetDataLayout(const DiskDataLayout layout)
+{
+  DiskDataLayout old=datalayout;
+
+  // Nothing may be moving while the file changes under it
+  Drain();
+  datalayout=layout;
+
+  ERROR_T rc=LayOutDataFile(true);
+
+  if (rc!=ERROR_NOERROR) { 
+    datalayout=old;
+  }
+  return rc;
+}
+
+ERROR_T DiskSystem::SetDeviceModel(const DiskDeviceType type, const FlashGeometry &geom)
+{
+  FlashModel *model=0;
+
+  if (type==DISK_DEVICE_SSD) { 
+    if (FlashModel::Check(geom)!=ERROR_NOERROR) { 
+      return ERROR_BADCONFIG;
+    }
+    model=new FlashModel(geom,numblocks);
+    flashgeom=geom;
+  }
+  // What is queued was served by the old device, and the new one
+  // starts when that is done
+  busyuntil=GetIdleTime();
+  inflight.clear();
+  delete flash;
+  flash=model;
+  device=type;
+  return ERROR_NOERROR;
+}
+
+//
+// Give the data file the space datalayout says it should have.  When
+// opening an existing disk (whole is false) that was presumably done
+// when it was made, so only a short file is dealt with.
+//
+ERROR_T DiskSystem::LayOutDataFile(const bool whole)
+{
+  off_t len=ByteOffset(numblocks);
+  struct stat st;
+
+  if (fstat(datafd,&st)) { 
+    return ERROR_NOFILE;
+  }
+
+  switch (datalayout) { 
+  case DISK_DATA_PREALLOC:
+    if ((whole || st.st_size<len) && fallocate(datafd,0,0,len)) { 
+      return errno==ENOSPC ? ERROR_NOSPACE : ERROR_UNIMPL;
+    }
+    break;
+  case DISK_DATA_SPARSE:
+    if (st.st_size<len && ftruncate(datafd,len)) { 
+      return ERROR_NOSPACE;
+    }
+    return MapHoles();
+  default:
+    break;
+  }
+  written.clear();
+  return ERROR_NOERROR;
+}
+
+//
+// Find which blocks have data with SEEK_DATA and SEEK_HOLE.  A file
+// system that can't say is taken to have data everywhere.
+//
+ERROR_T DiskSystem::MapHoles()
+{
+  SIZE_T numwords=numblocks/64+(numblocks%64!=0);
+  off_t  end=ByteOffset(numblocks);
+  off_t  pos=ByteOffset(0);
+
+  written.assign(numwords,0);
+
+  while (pos<end) { 
+    off_t data=lseek(datafd,pos,SEEK_DATA);
+    if (data<0 && errno==ENXIO) { 
+      // only a hole from here on
+      break;
+    }
+    off_t hole = data<0 ? -1 : lseek(datafd,data,SEEK_HOLE);
+    if (hole<0) { 
+      written.assign(numwords,~(uint64_t)0);
+      return ERROR_NOERROR;
+    }
+    if (data>=end) { 
+      break;
+    }
+    MarkWritten(data,(size_t)((hole<end ? hole : end)-data));
+    pos=hole;
+  }
+  return ERROR_NOERROR;
+}
+
+// Whether len bytes at off are all in blocks that have never been written
+bool DiskSystem::IsHole(const off_t off, const size_t len) const
+{
+  if (written.empty() || len==0 || off<ByteOffset(0)) { 
+    return false;
+  }
+
+  SIZE_T first=(off-ByteOffset(0))/blocksize;
+  SIZE_T last=(off+len-1-ByteOffset(0))/blocksize;
+
+  for (SIZE_T i=first; i<=last; i++) { 
+    if (i>=numblocks || ((written[i/64]>>(i%64)) & 0x1)) { 
+      return false;
+    }
+  }
+  return true;
+}
+
+void DiskSystem::MarkWritten(const off_t off, const size_t len)
+{
+  if (written.empty() || len==0) { 
+    return;
+  }
+
+  off_t  start = off>ByteOffset(0) ? off : ByteOffset(0);
+  SIZE_T first=(start-ByteOffset(0))/blocksize;
+  SIZE_T last=(off+len-1-ByteOffset(0))/blocksize;
+
+  for (SIZE_T i=first; i<=last && i<numblocks; i++) { 
+    written[i/64] |= (uint64_t)0x1 << (i%64);
+  }
+}
+
+ERROR_T DiskSystem::Sync()
+{
+  if (!mapping || dirtyhi==dirtylo) { 
+    return ERROR_NOERROR;
+  }
+
+  // msync wants a page aligned start
+  size_t page=sysconf(_SC_PAGESIZE);
+  size_t lo=dirtylo-dirtylo%page;
+
+  if (msync(mapping+lo,dirtyhi-lo,MS_SYNC)) { 
+    cerr << "DiskSystem::Sync: msync has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  dirtylo=dirtyhi=0;
+  return ERROR_NOERROR;
+}
+
+
+//
+// Start a request.  In DISK_IO_MMAP mode there is nothing worth
+// handing off, so the copy is done here and the request is born
+// done.  So is one in DISK_IO_DIRECT mode whose buffer would need
+// copying through the bounce buffer.
+//
+ERROR_T DiskSystem::Submit(const bool write,
+			   const SIZE_T inoffblock,
+			   const SIZE_T numblock,
+			   BYTE_T *buf,
+			   SIZE_T &ticket)
+{
+  DiskRequest r;
+
+  r.ticket=nextticket++;
+  r.off=ByteOffset(inoffblock);
+  r.len=(size_t)numblock*blocksize;
+  r.write=write;
+  r.done=false;
+  r.rc=ERROR_NOERROR;
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Submit"<<(write ? "Write" : "Read")<<": "<<(write ? "writing" : "reading")<<" unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+
+  if (write) { 
+    MarkWritten(r.off,r.len);
+  }
+  if (mapping || 
+      (directfd>=0 && !IsDirectAligned(buf,r.off,r.len)) ||
+      (!write && IsHole(r.off,r.len))) { 
+    r.rc = write ? WriteData(r.off,buf,r.len) : ReadData(r.off,buf,r.len);
+    r.done=true;
+  } else {
+    WaitForOverlaps(r.off,r.len,write);
+    if (!aio) { 
+      aio=MakeAsyncIO(aiotype,queuedepth);
+      if (!aio) { 
+	return ERROR_UNIMPL;
+      }
+    }
+    while (aio->GetNumInFlight()>=queuedepth) { 
+      ERROR_T rc=ReapOne();
+      if (rc!=ERROR_NOERROR) { 
+	return rc;
+      }
+    }
+    ERROR_T rc=aio->Submit(write,directfd>=0 ? directfd : datafd,r.off,buf,r.len,r.ticket);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  requests.push_back(r);
+  ticket=r.ticket;
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SubmitRead(const SIZE_T inoffblock,
+			       const SIZE_T numblock,
+			       BYTE_T *buf,
+			       const double now,
+			       SIZE_T &ticket,
+			       double &admit)
+{
+  admit=now;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::SubmitRead: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
   }
 
+  ERROR_T rc=Submit(false,inoffblock,numblock,buf,ticket);
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (!IsBlockAllocated(i)) {
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  admit=QueueAccess(ticket,inoffblock,numblock,false,now);
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SubmitWrite(const SIZE_T inoffblock,
+				const SIZE_T numblock,
+				const BYTE_T *buf,
+				const double now,
+				SIZE_T &ticket,
+				double &admit)
+{
+  admit=now;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::SubmitWrite: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // AsyncIO takes one kind of buffer for both directions
+  ERROR_T rc=Submit(true,inoffblock,numblock,(BYTE_T*)buf,ticket);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  admit=QueueAccess(ticket,inoffblock,numblock,true,now);
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::ReadQueued(const SIZE_T inoffblock,
+			       const SIZE_T numblock,
+			       BYTE_T *buf,
+			       const double now,
+			       double &reqtime,
+			       double &donetime)
+{
+  vector<BYTE_T *> bufs(numblock);
+
+  for (SIZE_T i=0; i<numblock; i++) {
+    bufs[i]=buf+(size_t)i*blocksize;
+  }
+  return ReadQueued(inoffblock,numblock,&(bufs[0]),now,reqtime,donetime);
+}
+
+ERROR_T DiskSystem::ReadQueued(const SIZE_T inoffblock,
+			       const SIZE_T numblock,
+			       BYTE_T *const *bufs,
+			       const double now,
+			       double &reqtime,
+			       double &donetime)
+{
+  reqtime=0;
+  donetime=now;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::ReadQueued: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
       if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr << "Disksystem: NotifyDeallocateBlocks: Block "<<i<<" is being deallocated, but it's already deallocated!"<<endl;
+	cerr <<"DiskSystem::ReadQueued: reading unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+
+  SIZE_T ticket=nextticket++;
+
+  QueueAccess(ticket,inoffblock,numblock,false,now);
+  FinishAccess(ticket,reqtime,donetime);
+  started.erase(ticket);
+  return ReadDataV(ByteOffset(inoffblock),bufs,numblock);
+}
+
+ERROR_T DiskSystem::WriteQueued(const vector<pair<SIZE_T, SIZE_T> > &runs,
+				const BYTE_T *buf,
+				const double now,
+				double &reqtime,
+				double &donetime)
+{
+  vector<SIZE_T> tickets;
+  size_t at=0;
+
+  reqtime=0;
+  donetime=now;
+
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=runs.begin(); r!=runs.end(); ++r) {
+    if ((*r).first+(*r).second > numblocks) { 
+      cerr << "DiskSystem::WriteQueued: Attempt to write blocks "<<(*r).first<<" to "<<((*r).first+(*r).second-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+      return ERROR_NOSPACE;
+    }
+  }
+
+  // All of them are queued before any is waited for, so that the
+  // scheduler sees the whole batch
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=runs.begin(); r!=runs.end(); ++r) {
+    for (SIZE_T i=0;i<(*r).second;i++) { 
+      if (!IsBlockAllocated((*r).first+i)) { 
+	if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	  cerr <<"DiskSystem::WriteQueued: writing unallocated block "<<((*r).first+i)<<endl;
+	}
+      }
+    }
+    tickets.push_back(nextticket++);
+    QueueAccess(tickets.back(),(*r).first,(*r).second,true,now);
+  }
+
+  ERROR_T first=ERROR_NOERROR;
+
+  for (SIZE_T i=0; i<runs.size(); i++) {
+    double t, done;
+
+    FinishAccess(tickets[i],t,done);
+    started.erase(tickets[i]);
+    reqtime+=t;
+    if (done>donetime) { 
+      donetime=done;
+    }
+
+    size_t len=(size_t)runs[i].second*blocksize;
+    ERROR_T rc=WriteData(ByteOffset(runs[i].first),buf+at,len);
+
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) { 
+      first=rc;
+    }
+    at+=len;
+  }
+  return first;
+}
+
+// Wait for any submitted request to finish on the host
+ERROR_T DiskSystem::ReapOne()
+{
+  SIZE_T tag;
+  ERROR_T result;
+  ERROR_T rc=aio->Wait(tag,result);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  for (vector<DiskRequest>::iterator r=requests.begin(); r!=requests.end(); ++r) {
+    if ((*r).ticket==tag) { 
+      (*r).done=true;
+      (*r).rc=result;
+      return ERROR_NOERROR;
+    }
+  }
+  return ERROR_IMPLBUG;
+}
+
+ERROR_T DiskSystem::Complete(const SIZE_T ticket)
+{
+  for (SIZE_T i=0; i<requests.size(); i++) {
+    if (requests[i].ticket==ticket) { 
+      while (!requests[i].done) { 
+	ERROR_T rc=ReapOne();
+	if (rc!=ERROR_NOERROR) { 
+	  return rc;
+	}
+      }
+      ERROR_T rc=requests[i].rc;
+      requests.erase(requests.begin()+i);
+      // Nobody will ask when it is done in the model now
+      started.erase(ticket);
+      for (vector<QueuedAccess>::iterator q=pending.begin(); q!=pending.end(); ++q) {
+	if ((*q).ticket==ticket) { 
+	  (*q).want=false;
+	}
+      }
+      return rc;
+    }
+  }
+  return ERROR_NONEXISTENT;
+}
+
+void DiskSystem::WaitForOverlaps(const off_t off, const size_t len, const bool write)
+{
+  for (vector<DiskRequest>::const_iterator r=requests.begin(); r!=requests.end(); ++r) {
+    while (!(*r).done && (write || (*r).write) &&
+	   (*r).off<off+(off_t)len && off<(*r).off+(off_t)(*r).len) { 
+      if (ReapOne()!=ERROR_NOERROR) { 
+	break;
       }
     }
-    CLEARBIT(i);
   }
+}
+
+// Everything submitted is finished on the host, though not Completed
+void DiskSystem::Drain()
+{
+  while (aio && aio->GetNumInFlight()>0) { 
+    if (ReapOne()!=ERROR_NOERROR) { 
+      break;
+    }
+  }
+}
+
+ERROR_T DiskSystem::SetQueueDepth(const SIZE_T depth, const AsyncIOType type)
+{
+  if (depth==0) { 
+    return ERROR_BADCONFIG;
+  }
+  Drain();
+
+  AsyncIO *newaio=0;
+
+  if (type==ASYNCIO_URING) { 
+    // Find out now rather than at the first submission
+    if (!(newaio=MakeAsyncIO(type,depth))) { 
+      return ERROR_UNIMPL;
+    }
+  }
+  delete aio;
+  aio=newaio;
+  aiotype=type;
+  queuedepth=depth;
+  return ERROR_NOERROR;
+}
+
+const char *DiskSystem::GetAsyncEngineName() const
+{
+  if (mapping) { 
+    return "mmap";
+  }
+  return aio ? aio->GetName() : "none";
+}
+
+
+SIZE_T DiskSystem::GetBlockSize() const
+{
+  return blocksize;
+}
+
+SIZE_T DiskSystem::GetNumBlocks() const
+{
+  return numblocks;
+}
+
+
+
+#define GETBIT(x) ((bitmap[(x)/64] >> ((x)%64)) & 0x1)
+
+
+bool DiskSystem::IsBlockAllocated(const SIZE_T block)
+{
+  return GETBIT(block);
+}
+
+
+SIZE_T DiskSystem::FindBit(const SIZE_T from, const bool set) const
+{
+  if (from>=numblocks) { 
+    return numblocks;
+  }
+
+  SIZE_T w=from/64;
+  // Ignore the bits below from in the first word
+  uint64_t bits=(set ? bitmap[w] : ~bitmap[w]) & (~(uint64_t)0 << (from%64));
+
+  while (bits==0) { 
+    if (++w>=numbitmapwords) { 
+      return numblocks;
+    }
+    bits = set ? bitmap[w] : ~bitmap[w];
+  }
+
+  SIZE_T i=w*64+__builtin_ctzll(bits);
+
+  // The padding past the last block is set
+  return i<numblocks ? i : numblocks;
+}
+
+
+void DiskSystem::SetBits(const SIZE_T from, const SIZE_T num, const bool set)
+{
+  SIZE_T i=from;
+  SIZE_T end=from+num;
+
+  while (i<end) { 
+    SIZE_T n = end-i < 64-(i%64) ? end-i : 64-(i%64);
+    uint64_t mask = (n==64 ? ~(uint64_t)0 : (((uint64_t)0x1<<n)-1)) << (i%64);
+    if (set) { 
+      bitmap[i/64] |= mask;
+    } else {
+      bitmap[i/64] &= ~mask;
+    }
+    i+=n;
+  }
+
+  if (set) { 
+    if (from<=allocfrom && allocfrom<end) { 
+      allocfrom=FindBit(end,false);
+    }
+  } else if (num>0 && from<allocfrom) { 
+    allocfrom=from;
+  }
+}
+
+
+ERROR_T DiskSystem::AllocateBlocks(const SIZE_T innumblocks, SIZE_T &outoffset)
+{
+  if (innumblocks==0) { 
+    return ERROR_SIZE;
+  }
+
+  // First fit: the lowest free block that starts a long enough run
+  SIZE_T start=allocfrom;
+
+  while (start<numblocks && innumblocks<=numblocks-start) { 
+    SIZE_T end=FindBit(start,true);
+    if (end-start>=innumblocks) { 
+      SetBits(start,innumblocks,true);
+      outoffset=start;
+      return ERROR_NOERROR;
+    }
+    start=FindBit(end,false);
+  }
+  return ERROR_NOSPACE;
+}
+
+
+ERROR_T DiskSystem::ClearAllocations(const SIZE_T inoffset, const SIZE_T innumblocks)
+{
+  if (inoffset+innumblocks > numblocks) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+  SetBits(inoffset,innumblocks,false);
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T DiskSystem::GetNumFreeBlocks() const
+{
+  SIZE_T numset=0;
+
+  for (SIZE_T w=0; w<numbitmapwords; w++) { 
+    numset+=__builtin_popcountll(bitmap[w]);
+  }
+  // The padding counts as set
+  return numbitmapwords*64-numset;
+}
+
+
+ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innumblocks)
+{
+  if (offset+innumblocks > numblocks) { 
+    cerr << "Disksystem: NotifyAllocateBlocks: Attempt to allocate"<<offset<<" to "<<(offset+innumblocks-1)<<" but maximum block is "<<(numblocks-1)<<endl;
+    return ERROR_NOSUCHBLOCK;
+  }
+
+
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    for (SIZE_T i=FindBit(offset,true); i<(offset+innumblocks); i=FindBit(i+1,true)) { 
+      cerr << "Disksystem: NotifyAllocateBlocks: Block "<<i<<" is being allocated, but it's already allocated!"<<endl;
+    }
+  }
+  SetBits(offset,innumblocks,true);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset,const SIZE_T innumblocks)
+{
+  if (offset+innumblocks > numblocks) { 
+    cerr << "Disksystem: NotifyDeallocateBlocks: Attempt to deallocate"<<offset<<" to "<<(offset+innumblocks-1)<<" but maximum block is "<<(numblocks-1)<<endl;
+    return ERROR_NOSUCHBLOCK;
+  }
+
+
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    for (SIZE_T i=FindBit(offset,false); i<(offset+innumblocks); i=FindBit(i+1,false)) { 
+      cerr << "Disksystem: NotifyDeallocateBlocks: Block "<<i<<" is being deallocated, but it's already deallocated!"<<endl;
+    }
+  }
+  SetBits(offset,innumblocks,false);
 
   return ERROR_NOERROR;
 }
@@ -583,7 +2046,18 @@ ostream & DiskSystem::Print(ostream &os) const
      << ", averageseeklatency="<<averageseeklatency
      << ", trackseeklatency="<<trackseeklatency
      << ", rotationallatency="<<rotationallatency
-     << ", bitmap=";
+     << ", datalayout="<<DiskDataLayoutName(datalayout)
+     << ", device="<<DiskDeviceName(device);
+  if (device==DISK_DEVICE_SSD) { 
+    os << ", channels="<<flashgeom.channels
+       << ", pagesperblock="<<flashgeom.pagesperblock
+       << ", readlatency="<<flashgeom.readlatency
+       << ", programlatency="<<flashgeom.programlatency
+       << ", eraselatency="<<flashgeom.eraselatency
+       << ", transferlatency="<<flashgeom.transferlatency
+       << ", overprovision="<<flashgeom.overprovision;
+  }
+  os << ", bitmap=";
 
   for (SIZE_T i=0;i<numblocks;i++) { 
     if (GETBIT(i)) { 
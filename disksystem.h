@@ -4,24 +4,186 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <sys/types.h>
+#include <stdint.h>
 
 #include "global.h"
 #include "block.h"
+#include "asyncio.h"
+#include "flashmodel.h"
 
 using namespace std;
 
-// Models a single disk with a single outstanding request
+//
+// How block data gets to and from filestem.data.  Either way the
+// file is the same and ModelAccess decides the simulated time.
+//
+//   DISK_IO_PREAD  pread and pwrite on the file
+//   DISK_IO_MMAP   memcpy to and from a shared mapping of the file,
+//                  which is written back at Sync (or when the
+//                  DiskSystem goes away).  For disks that fit in RAM.
+//   DISK_IO_DIRECT pread and pwrite with O_DIRECT, so that the
+//                  kernel's page cache doesn't cache the blocks a
+//                  second time.  The blocksize and offset must be
+//                  multiples of what the file system needs; a buffer
+//                  that isn't aligned for it is copied through one
+//                  that is.
+//
+enum DiskIOMode {DISK_IO_PREAD, DISK_IO_MMAP, DISK_IO_DIRECT};
+
+// Names are pread, mmap, and direct.  ERROR_BADCONFIG for anything else.
+ERROR_T ParseDiskIOMode(const string &name, DiskIOMode &mode);
+
+//
+// How the data file gets its space.  Recorded in filestem.config.
+//
+//   DISK_DATA_GROW     the file grows as blocks are first written,
+//                      wherever they happen to be
+//   DISK_DATA_PREALLOC all of it is allocated with fallocate up
+//                      front, so first writes don't allocate and
+//                      the file isn't fragmented by them
+//   DISK_DATA_SPARSE   the file is full size from the start but only
+//                      blocks that have been written take space.
+//                      Reading a block that never has been gives
+//                      zeros without a system call.
+//
+enum DiskDataLayout {DISK_DATA_GROW, DISK_DATA_PREALLOC, DISK_DATA_SPARSE};
+
+// Names are grow, prealloc, and sparse.  ERROR_BADCONFIG otherwise.
+ERROR_T ParseDiskDataLayout(const string &name, DiskDataLayout &layout);
+const char *DiskDataLayoutName(const DiskDataLayout layout);
+
+//
+// What the simulated time comes from.  Recorded in filestem.config.
+//
+//   DISK_DEVICE_HDD  a spinning disk: seeks, rotation, and transfer,
+//                    from the geometry and latencies
+//   DISK_DEVICE_SSD  a flash device (FlashModel), which has no seeks
+//                    but slow programs and garbage collection
+//
+enum DiskDeviceType {DISK_DEVICE_HDD, DISK_DEVICE_SSD};
+
+// Names are hdd and ssd.  ERROR_BADCONFIG otherwise.
+ERROR_T ParseDiskDeviceType(const string &name, DiskDeviceType &type);
+const char *DiskDeviceName(const DiskDeviceType type);
+
+// How many requests may be outstanding at once, unless told otherwise
+const SIZE_T DISKSYSTEM_QUEUEDEPTH=32;
+
+//
+// Which queued request the disk serves next, whenever it comes free.
+// Only requests that have arrived by then are considered.
+//
+//   DISK_SCHED_FCFS   the oldest
+//   DISK_SCHED_SSTF   the one whose first block is on the nearest track
+//   DISK_SCHED_SCAN   the next one in the direction the head is going,
+//                     turning around when there are no more that way
+//                     (at the last request, as LOOK does, since the
+//                     model has no notion of the arm moving idle)
+//   DISK_SCHED_CLOOK  the next one up from the head, or else the
+//                     lowest
+//
+enum DiskSchedType {DISK_SCHED_FCFS, DISK_SCHED_SSTF, DISK_SCHED_SCAN, DISK_SCHED_CLOOK};
+
+// Names are fcfs, sstf, scan, and clook.  ERROR_BADCONFIG otherwise.
+ERROR_T ParseDiskSchedType(const string &name, DiskSchedType &type);
+const char *DiskSchedName(const DiskSchedType type);
+
+// Where the simulated time of the requests the model served went
+struct DiskSchedStats {
+  SIZE_T requests;
+  double seektime;      // moving the arm, including within requests
+  double rotationtime;  // waiting for the first block to come around
+  double transfertime;  // the blocks passing under the head, or over
+                        // the flash channels
+  double queuetime;     // queued requests waiting for the disk
+  // Flash devices only
+  double celltime;      // reading and programming the host's pages
+  double gctime;        // garbage collection
+  SIZE_T hostpages;     // pages the host wrote
+  SIZE_T flashpages;    // pages programmed; flashpages/hostpages is
+                        // the write amplification
+  SIZE_T erases;
+};
+
+// Models a single disk.  Read and Write are one request at a time:
+// the caller waits, and the disk is assumed idle when they start.
+// SubmitRead and SubmitWrite queue up to a queue depth of requests
+// that complete later, both in simulated time and on the host.
+// ReadQueued and WriteQueued are requests the caller waits for that
+// take their turn among the queued ones.  The scheduler picks the
+// order in which the model serves queued requests.
+//
+// A request, of either kind, that overlaps a submitted one where
+// either of them writes waits for that one to finish on the host,
+// so data always moves in the order it was asked for.
 //
 // Includes storage allocator and free space bitmap to 
 // simplify project - REAL DISKS DO NOT HAVE ALLOCATORS OR BITMAPS
 //
 class DiskSystem {
  private:
-  BYTE_T *bitmap;
-  FILE*  datafilefd;
+  uint64_t *bitmap;     // block i is bit i%64 of word i/64; bits past
+                        // the last block are set
+  SIZE_T numbitmapwords;
+  SIZE_T allocfrom;     // no block below this is free
+  string datafilename;  // what datafd was opened as
+  int    datafd;        // block data goes through pread/pwrite here
+  int    directfd;      // or here, opened with O_DIRECT, in DISK_IO_DIRECT mode
+  SIZE_T diomemalign;   // what O_DIRECT needs of buffers
+  SIZE_T diooffalign;   // and of offsets and lengths
+  BYTE_T *bounce;       // for buffers that aren't aligned
+  size_t bouncesize;
+  DiskIOMode iomode;
+  DiskDataLayout datalayout;
+  DiskDeviceType device;
+  FlashGeometry flashgeom;
+  FlashModel *flash;    // DISK_DEVICE_SSD only
+  vector<uint64_t> written;  // DISK_DATA_SPARSE: blocks that may not be
+                             // holes, as in the allocation bitmap
+  BYTE_T *mapping;      // all of the data file, in DISK_IO_MMAP mode
+  size_t mappedbytes;
+  size_t dirtylo, dirtyhi;  // bytes of the mapping written since the last Sync
   FILE*  configfilefd;
   FILE*  bitmapfilefd;
 
+  // A submitted request.  done means the data has moved; it stays
+  // here until Complete hands back rc.
+  struct DiskRequest {
+    SIZE_T  ticket;
+    off_t   off;
+    size_t  len;
+    bool    write;
+    bool    done;
+    ERROR_T rc;
+  };
+  vector<DiskRequest> requests;
+  AsyncIO *aio;         // made on first use
+  AsyncIOType aiotype;
+  SIZE_T queuedepth;
+  SIZE_T nextticket;
+
+  // A request the model has queued but not started.  want means
+  // somebody may still ask when it is done.
+  struct QueuedAccess {
+    SIZE_T ticket;
+    SIZE_T off;
+    SIZE_T num;
+    bool   write;
+    double arrival;
+    bool   want;
+  };
+  vector<QueuedAccess> pending;   // in arrival order
+  map<SIZE_T, pair<double, double> > started;  // ticket -> (reqtime, donetime)
+  double busyuntil;     // when the one being served is done; a flash
+                        // device starts the next one at once, so
+                        // there it is when the last one started
+  vector<double> inflight;  // DISK_DEVICE_SSD: when the ones started are done
+  DiskSchedType sched;
+  bool   scanup;        // which way DISK_SCHED_SCAN is going
+  DiskSchedStats schedstats;
+
 
   //
   //
@@ -41,8 +203,77 @@ class DiskSystem {
   double trackseeklatency;
   double rotationallatency;
 
+  // Where block starts in the data file (the files can be big)
+  off_t  ByteOffset(const SIZE_T block) const { return (off_t)offset+(off_t)block*blocksize; }
+
+  // Move len bytes at off in the data file, whatever the mode
+  ERROR_T ReadData(const off_t off, BYTE_T *buf, const size_t len);
+  ERROR_T WriteData(const off_t off, const BYTE_T *buf, const size_t len);
+  // numblock blocks at off, one buffer each, in one go
+  ERROR_T ReadDataV(const off_t off, BYTE_T *const *bufs, const SIZE_T numblock);
+  ERROR_T WriteDataV(const off_t off, const BYTE_T *const *bufs, const SIZE_T numblock);
+  ERROR_T Map();
+  void    Unmap();
+  ERROR_T OpenDirect();
+  void    CloseDirect();
+  bool    IsDirectAligned(const BYTE_T *buf, const off_t off, const size_t len) const;
+  ERROR_T MoveDirect(const bool write, const off_t off, BYTE_T *buf, const size_t len);
+  ERROR_T GrowBounce(const size_t len);
+  ERROR_T LayOutDataFile(const bool whole);
+  ERROR_T MapHoles();
+  bool    IsHole(const off_t off, const size_t len) const;
+  void    MarkWritten(const off_t off, const size_t len);
+  ERROR_T Submit(const bool write, const SIZE_T inoffblock, const SIZE_T numblock, BYTE_T *buf, SIZE_T &ticket);
+  ERROR_T ReapOne();
+  void    WaitForOverlaps(const off_t off, const size_t len, const bool write);
+  void    Drain();
+  SIZE_T  PickNext(const double now) const;
+  bool    StartNext(const double until);
+  // Requests the model has that aren't done at now, and the next
+  // time one of them will be
+  SIZE_T  GetOutstanding(const double now);
+  double  GetNextDone(const double now) const;
+  // Serve a request on the flash device that it gets at start, and
+  // return when it is done
+  double  ServeFlash(const SIZE_T off, const SIZE_T num, const bool write, const double start);
+  void    CountFlash(const SIZE_T off, const SIZE_T num, const bool write, const FlashCost &cost);
+
  protected:
-  virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
+  virtual double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+  double ModelAccessFrom(SIZE_T &track,
+			 SIZE_T &sector,
+			 const SIZE_T off,
+			 const SIZE_T num) const;
+  // The same, also splitting the time into seek, rotational wait,
+  // and transfer
+  double ModelAccessFrom(SIZE_T &track,
+			 SIZE_T &sector,
+			 const SIZE_T off,
+			 const SIZE_T num,
+			 double &seek,
+			 double &rotation,
+			 double &transfer) const;
+  // Queue a request made at now behind any others.  If queuedepth
+  // requests are outstanding it is not even accepted until one is
+  // done.  Returns the time it was accepted.
+  double QueueAccess(const SIZE_T ticket,
+		     const SIZE_T off,
+		     const SIZE_T num,
+		     const bool write,
+		     const double now);
+  // Start every queued request the disk would start by until.
+  // Nothing can arrive before until afterwards.
+  void   Dispatch(const double until);
+  // Serve queued requests until ticket is done, assuming nothing
+  // else arrives meanwhile.  ERROR_NONEXISTENT for an unknown ticket.
+  ERROR_T FinishAccess(const SIZE_T ticket, double &reqtime, double &donetime);
+
+  // For a subclass that keeps its blocks elsewhere: the DiskSystem
+  // has only the allocation bitmap, filestem.bitmap, which the
+  // subclass opens with OpenBitMap
+  DiskSystem(const string &filestem,
+	     const SIZE_T blocks,
+	     const SIZE_T blocksize);
 
   ERROR_T SanityCheckConfig();
   ERROR_T InitFromConfigFile();
@@ -51,6 +282,12 @@ class DiskSystem {
   ERROR_T WriteConfig();
   ERROR_T ReadBitMap();
   ERROR_T WriteBitMap();
+  ERROR_T OpenBitMap(const bool create);
+  void    NewBitMap();
+  // The first block at or after from whose bit is set (or clear),
+  // or numblocks if there is none
+  SIZE_T  FindBit(const SIZE_T from, const bool set) const;
+  void    SetBits(const SIZE_T from, const SIZE_T num, const bool set);
   
    
  public:
@@ -76,27 +313,164 @@ class DiskSystem {
 
   // Each returns the number of milliseconds the operation has taken
 
-  ERROR_T Read(const SIZE_T inoffblock,
-	       const SIZE_T numblock,
-	       vector<Block> &blocks,
-	       double &reqtime);
+  // Appends numblock blocks to blocks, reading them all with one
+  // vectored request
+  virtual ERROR_T Read(const SIZE_T inoffblock,
+		       const SIZE_T numblock,
+		       vector<Block> &blocks,
+		       double &reqtime);
 
   ERROR_T Read(const SIZE_T inoffblock, 
 	       Block &blocks,
 	       double &reqtime);
 
-  ERROR_T Write(const SIZE_T inoffblock,
-		const SIZE_T numblock,
-		const vector<Block> &blocks,
-		double &reqtime);
+  virtual ERROR_T Write(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			const vector<Block> &blocks,
+			double &reqtime);
 
   ERROR_T Write(const SIZE_T inoffblock, 
 		const Block &blocks,
 		double &reqtime);
 
+  // These move numblock*blocksize bytes to or from buf,
+  // which the caller provides, without allocating anything
+  virtual ERROR_T Read(const SIZE_T inoffblock,
+		       const SIZE_T numblock,
+		       BYTE_T *buf,
+		       double &reqtime);
+
+  virtual ERROR_T Write(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			const BYTE_T *buf,
+			double &reqtime);
+
+  // Start a read or write of numblock blocks at inoffblock and
+  // return at once.  buf must stay put until the request is
+  // Completed.  now is the simulated time of the request, and admit
+  // is when the disk took it (later than now only if the queue was
+  // full).  ticket names it to GetDoneTime and Complete.
+  virtual ERROR_T SubmitRead(const SIZE_T inoffblock,
+			     const SIZE_T numblock,
+			     BYTE_T *buf,
+			     const double now,
+			     SIZE_T &ticket,
+			     double &admit);
+  virtual ERROR_T SubmitWrite(const SIZE_T inoffblock,
+			      const SIZE_T numblock,
+			      const BYTE_T *buf,
+			      const double now,
+			      SIZE_T &ticket,
+			      double &admit);
+  // The service time of a submitted request and when it is done in
+  // simulated time.  Until now the scheduler may still put later
+  // requests ahead of it, so ask only when about to wait for it, and
+  // before Completing it.  ERROR_NONEXISTENT for an unknown ticket.
+  virtual ERROR_T GetDoneTime(const SIZE_T ticket, double &reqtime, double &donetime);
+  // Wait for a submitted request's data to move and return its
+  // result.  Every submitted request must be Completed once.
+  // ERROR_NONEXISTENT for an unknown ticket.
+  virtual ERROR_T Complete(const SIZE_T ticket);
+
+  // Requests made at now that the caller waits for.  They queue
+  // like submitted ones, and donetime is when the last of them is
+  // done; reqtime is their own service time.  WriteQueued writes
+  // runs of (offset, numblocks) in one go, their data one after
+  // another in buf, and the scheduler may serve them in any order.
+  ERROR_T ReadQueued(const SIZE_T inoffblock,
+		     const SIZE_T numblock,
+		     BYTE_T *buf,
+		     const double now,
+		     double &reqtime,
+		     double &donetime);
+  // The same, but block inoffblock+i goes to bufs[i], which need not
+  // be next to each other.  It is still one request.
+  virtual ERROR_T ReadQueued(const SIZE_T inoffblock,
+			     const SIZE_T numblock,
+			     BYTE_T *const *bufs,
+			     const double now,
+			     double &reqtime,
+			     double &donetime);
+  virtual ERROR_T WriteQueued(const vector<pair<SIZE_T, SIZE_T> > &runs,
+			      const BYTE_T *buf,
+			      const double now,
+			      double &reqtime,
+			      double &donetime);
+
+  // Outstanding requests allowed, in the model and on the host, and
+  // which engine moves the data for submitted requests.  This waits
+  // for everything outstanding first.  ERROR_BADCONFIG for a depth
+  // of zero, ERROR_UNIMPL if ASYNCIO_URING is asked for and the
+  // kernel doesn't have it.
+  virtual ERROR_T SetQueueDepth(const SIZE_T depth, const AsyncIOType type=ASYNCIO_AUTO);
+  virtual SIZE_T GetQueueDepth() const { return queuedepth; }
+  // io_uring or threads, once something has been submitted
+  virtual const char *GetAsyncEngineName() const;
+  // Forget the simulated completion times of submitted requests,
+  // for a caller whose clock starts over
+  virtual void    RestartQueueModel();
+  // When the disk will have served everything queued so far, if
+  // nothing else arrives
+  virtual double  GetIdleTime();
+
+  // The order in which queued requests are served.  Changing it
+  // leaves the requests already queued where they are.
+  virtual void SetScheduler(const DiskSchedType type) { sched=type; }
+  DiskSchedType GetScheduler() const { return sched; }
+  virtual const DiskSchedStats &GetSchedStats() const { return schedstats; }
+  virtual void    ResetSchedStats();
+
+  // Switch how the data moves.  The mapping for DISK_IO_MMAP covers
+  // the whole disk, growing the data file to full size if need be
+  // (the new part reads as zeros, as unwritten blocks always have).
+  // ERROR_NOMEM if it can't be mapped; the mode is then unchanged.
+  // DISK_IO_DIRECT gives ERROR_BADCONFIG if the blocksize or offset
+  // can't be aligned for O_DIRECT and ERROR_UNIMPL if the file
+  // system doesn't do it, also leaving the mode unchanged.
+  virtual ERROR_T SetIOMode(const DiskIOMode mode);
+  virtual DiskIOMode GetIOMode() const { return iomode; }
+  // The buffer alignment DISK_IO_DIRECT needs to avoid a copy
+  virtual SIZE_T GetDirectAlignment() const { return diomemalign; }
+
+  // Switch how the data file gets its space.  DISK_DATA_PREALLOC
+  // allocates all of it now, giving ERROR_UNIMPL if the file system
+  // can't and ERROR_NOSPACE if it is full.  DISK_DATA_SPARSE makes
+  // the file full size and finds its holes.  Shrinking back to
+  // DISK_DATA_GROW gives nothing back.
+  virtual ERROR_T SetDataLayout(const DiskDataLayout layout);
+  virtual DiskDataLayout GetDataLayout() const { return datalayout; }
+
+  // Get everything written so far onto the file.  In DISK_IO_MMAP
+  // mode this msyncs the part of the mapping that has been written
+  // since the last Sync; otherwise there is nothing to do.
+  // This takes no simulated time.
+  virtual ERROR_T Sync();
+
+  // Switch what the simulated time comes from.  For DISK_DEVICE_SSD
+  // flash gives the device; it is ignored otherwise.  The flash
+  // device starts out with nothing mapped, and so does it every time
+  // the disk is opened.  ERROR_BADCONFIG for a flash geometry that
+  // makes no sense, leaving the device unchanged.
+  virtual ERROR_T SetDeviceModel(const DiskDeviceType type,
+				 const FlashGeometry &flash=FlashGeometry());
+  virtual DiskDeviceType GetDeviceModel() const { return device; }
+  const FlashGeometry &GetFlashGeometry() const { return flashgeom; }
+
   SIZE_T GetBlockSize() const;
   SIZE_T GetNumBlocks() const;
 
+  // The block the head is at (where the last request ended)
+  virtual SIZE_T GetHeadPosition() const;
+  // Blocks under all the heads at one seek position
+  // (what ModelAccess calls a track)
+  virtual SIZE_T GetBlocksPerCylinder() const;
+
+  // What a sequence of (offset, numblocks) requests would take,
+  // starting from where the head is now.  Nothing moves.  A flash
+  // device's estimate leaves out garbage collection.
+  virtual double EstimateAccessTime(const vector<pair<SIZE_T, SIZE_T> > &requests,
+				    const bool write=false) const;
+
   //
   // These are notification functions that should be called when
   // a block is allocated or deallocated.  They keep the bitmap updated
@@ -109,8 +483,20 @@ class DiskSystem {
 
   bool    IsBlockAllocated(const SIZE_T offset);
 
+  //
+  // The allocator.  AllocateBlocks finds the lowest numblocks free
+  // blocks in a row, marks them allocated, and returns the first in
+  // offset, or ERROR_NOSPACE if there is no such extent.  The
+  // blocks themselves are not touched.  ClearAllocations marks a
+  // range free whatever its state, for starting over.
+  //
+  ERROR_T AllocateBlocks(const SIZE_T numblocks, SIZE_T &offset);
+  ERROR_T ClearAllocations(const SIZE_T offset,
+			   const SIZE_T innumblocks);
+  SIZE_T  GetNumFreeBlocks() const;
+
 
-  ostream & Print(ostream &os) const;
+  virtual ostream & Print(ostream &os) const;
 };
 
 inline ostream & operator<< (ostream &os, const DiskSystem &rhs) { return rhs.Print(os);}
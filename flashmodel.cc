@@ -0,0 +1,214 @@
+#include <assert.h>
+
+#include "flashmodel.h"
+
+const uint32_t FLASH_UNMAPPED=0xffffffff;
+
+
+ERROR_T FlashModel::Check(const FlashGeometry &geom)
+{
+  if (geom.channels==0 || geom.pagesperblock==0 || geom.overprovision<0 ||
+      geom.readlatency<0 || geom.programlatency<0 ||
+      geom.eraselatency<0 || geom.transferlatency<0) {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Each channel gets enough erase blocks for its share of the logical
+// pages plus the overprovisioning, and never fewer than three spare
+// ones.  With three there is always an erase block besides the one
+// being written that isn't all live, and room to copy it.
+//
+FlashModel::FlashModel(const FlashGeometry &g, const SIZE_T n) :
+  geom(g),
+  numpages(n)
+{
+  SIZE_T perchannel=(numpages+geom.channels-1)/geom.channels;
+  SIZE_T needed=(perchannel+geom.pagesperblock-1)/geom.pagesperblock;
+  SIZE_T spare=(SIZE_T)(perchannel*geom.overprovision+geom.pagesperblock-1)/geom.pagesperblock;
+
+  blockspercolumn=needed+(spare<3 ? 3 : spare);
+
+  SIZE_T numerase=blockspercolumn*geom.channels;
+
+  l2p.assign(numpages,FLASH_UNMAPPED);
+  p2l.assign((size_t)numerase*geom.pagesperblock,FLASH_UNMAPPED);
+  live.assign(numerase,0);
+  isfree.assign(numerase,true);
+  chans.resize(geom.channels);
+  chanfree.assign(geom.channels,0);
+  for (SIZE_T c=0; c<geom.channels; c++) {
+    // Taken from the back, so the lowest goes first
+    for (SIZE_T k=blockspercolumn; k>1; k--) {
+      chans[c].freeblocks.push_back((k-1)*geom.channels+c);
+    }
+    chans[c].active=c;
+    chans[c].nextpage=0;
+    isfree[c]=false;
+  }
+}
+
+void FlashModel::Program(const SIZE_T c, const SIZE_T lp)
+{
+  Channel &ch=chans[c];
+
+  if (ch.nextpage==geom.pagesperblock) {
+    assert(!ch.freeblocks.empty());
+    ch.active=ch.freeblocks.back();
+    ch.freeblocks.pop_back();
+    ch.nextpage=0;
+    isfree[ch.active]=false;
+  }
+
+  SIZE_T pp=ch.active*geom.pagesperblock+ch.nextpage++;
+
+  l2p[lp]=pp;
+  p2l[pp]=lp;
+  live[ch.active]++;
+}
+
+double FlashModel::Collect(const SIZE_T c, FlashCost &cost)
+{
+  Channel &ch=chans[c];
+  double t=0;
+
+  while (ch.freeblocks.size()<2) {
+    SIZE_T victim=live.size();
+
+    for (SIZE_T e=c; e<live.size(); e+=geom.channels) {
+      if (e!=ch.active && !isfree[e] && (victim==live.size() || live[e]<live[victim])) {
+	victim=e;
+      }
+    }
+    if (victim==live.size() || live[victim]==geom.pagesperblock) {
+      // Nothing to gain; can't happen with three spares per channel
+      break;
+    }
+    for (SIZE_T i=0; i<geom.pagesperblock && live[victim]>0; i++) {
+      SIZE_T pp=victim*geom.pagesperblock+i;
+      uint32_t lp=p2l[pp];
+
+      if (lp==FLASH_UNMAPPED) {
+	continue;
+      }
+      // Copied within the channel, without crossing it
+      p2l[pp]=FLASH_UNMAPPED;
+      live[victim]--;
+      Program(c,lp);
+      t+=geom.readlatency+geom.programlatency;
+      cost.programs++;
+    }
+    t+=geom.eraselatency;
+    cost.erases++;
+    isfree[victim]=true;
+    ch.freeblocks.insert(ch.freeblocks.begin(),victim);
+  }
+  cost.gctime+=t;
+  return t;
+}
+
+void FlashModel::Run(const SIZE_T off,
+		     const SIZE_T numpage,
+		     const bool write,
+		     FlashCost &cost,
+		     vector<double> &busy)
+{
+  busy.assign(geom.channels,0);
+  cost.celltime=0;
+  cost.transfertime=0;
+  cost.gctime=0;
+  cost.programs=0;
+  cost.erases=0;
+
+  for (SIZE_T lp=off; lp<off+numpage; lp++) {
+    SIZE_T c=ChannelOf(lp);
+
+    busy[c]+=geom.transferlatency;
+    cost.transfertime+=geom.transferlatency;
+    if (!write) {
+      if (l2p[lp]!=FLASH_UNMAPPED) {
+	busy[c]+=geom.readlatency;
+	cost.celltime+=geom.readlatency;
+      }
+      continue;
+    }
+    if (l2p[lp]!=FLASH_UNMAPPED) {
+      SIZE_T old=l2p[lp];
+      p2l[old]=FLASH_UNMAPPED;
+      live[old/geom.pagesperblock]--;
+    }
+    Program(c,lp);
+    busy[c]+=geom.programlatency;
+    cost.celltime+=geom.programlatency;
+    cost.programs++;
+    if (chans[c].nextpage==geom.pagesperblock && chans[c].freeblocks.size()<2) {
+      busy[c]+=Collect(c,cost);
+    }
+  }
+}
+
+double FlashModel::Access(const SIZE_T off,
+			  const SIZE_T numpage,
+			  const bool write,
+			  FlashCost &cost)
+{
+  vector<double> busy;
+  double t=0;
+
+  Run(off,numpage,write,cost,busy);
+  for (SIZE_T c=0; c<geom.channels; c++) {
+    if (busy[c]>t) {
+      t=busy[c];
+    }
+  }
+  return t;
+}
+
+double FlashModel::Serve(const SIZE_T off,
+			 const SIZE_T numpage,
+			 const bool write,
+			 const double start,
+			 FlashCost &cost)
+{
+  vector<double> busy;
+  double done=start;
+
+  Run(off,numpage,write,cost,busy);
+  for (SIZE_T c=0; c<geom.channels; c++) {
+    if (busy[c]==0) {
+      continue;
+    }
+    chanfree[c] = (chanfree[c]>start ? chanfree[c] : start) + busy[c];
+    if (chanfree[c]>done) {
+      done=chanfree[c];
+    }
+  }
+  return done;
+}
+
+double FlashModel::GetIdleTime() const
+{
+  double idle=0;
+
+  for (SIZE_T c=0; c<geom.channels; c++) {
+    if (chanfree[c]>idle) {
+      idle=chanfree[c];
+    }
+  }
+  return idle;
+}
+
+void FlashModel::RestartClock()
+{
+  chanfree.assign(geom.channels,0);
+}
+
+double FlashModel::Estimate(const SIZE_T off, const SIZE_T numpage, const bool write) const
+{
+  // The busiest channel has this many of the pages
+  SIZE_T most=(numpage+geom.channels-1)/geom.channels;
+
+  return most*(geom.transferlatency+(write ? geom.programlatency : geom.readlatency));
+}
@@ -0,0 +1,121 @@
+#ifndef _flashmodel
+#define _flashmodel
+
+#include <vector>
+#include <stdint.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// What a flash device is made of.  A disk block is one flash page.
+// Pages are written (programmed) only into erased pages, and erased
+// only pagesperblock at a time, so a rewritten page goes somewhere
+// new and the old copy is garbage until its erase block is
+// collected.  Latencies are in ms, like the disk's.
+//
+struct FlashGeometry {
+  SIZE_T channels;        // independent channels; page p is on p%channels
+  SIZE_T pagesperblock;   // pages per erase block
+  double readlatency;     // reading a page out of the cells
+  double programlatency;  // programming a page
+  double eraselatency;    // erasing an erase block
+  double transferlatency; // moving a page over its channel
+  double overprovision;   // spare pages, as a fraction of the disk's
+
+  // A current TLC NVMe drive, roughly
+  FlashGeometry() :
+    channels(8), pagesperblock(256),
+    readlatency(0.05), programlatency(0.5), eraselatency(3),
+    transferlatency(0.005), overprovision(0.07) {}
+};
+
+// What one request cost the device, split up
+struct FlashCost {
+  double celltime;      // reading and programming the host's pages
+  double transfertime;  // moving them over the channels
+  double gctime;        // garbage collection: moving live pages and erasing
+  SIZE_T programs;      // pages programmed, including garbage collection's
+  SIZE_T erases;
+};
+
+//
+// A page-mapped flash translation layer.  Each logical page stays on
+// its own channel, and each channel writes into one erase block at a
+// time.  When a channel is down to its last spare erase block, the
+// erase block on it with the fewest live pages is collected: those
+// pages are copied (a read and a program on the channel) and the
+// block is erased.  The channels work at the same time, so a request
+// takes as long as its busiest channel, and requests that were
+// Served may overlap on different channels.
+//
+// The mapping lives only in memory: the device starts out trimmed,
+// with nothing mapped, every time it is made.
+//
+class FlashModel {
+ private:
+  FlashGeometry geom;
+  SIZE_T numpages;            // logical pages
+  SIZE_T blockspercolumn;     // erase blocks per channel
+  vector<uint32_t> l2p;       // logical page -> physical page
+  vector<uint32_t> p2l;       // physical page -> logical page
+  vector<SIZE_T> live;        // live pages in each erase block
+  vector<bool>   isfree;      // erased and not being written
+  struct Channel {
+    SIZE_T active;            // erase block being written
+    SIZE_T nextpage;          // in active
+    vector<SIZE_T> freeblocks;
+  };
+  vector<Channel> chans;
+  vector<double> chanfree;    // when each channel is done with what
+                              // was Served
+
+  // Where logical page stays; erase block e is on channel
+  // e%channels too
+  SIZE_T ChannelOf(const SIZE_T page) const { return page%geom.channels; }
+  // Put logical page lp in the next erased page of channel c
+  void   Program(const SIZE_T c, const SIZE_T lp);
+  // Collect erase blocks on c until it has spares again.  Returns
+  // the time it took.
+  double Collect(const SIZE_T c, FlashCost &cost);
+  // The work for each channel, in busy
+  void   Run(const SIZE_T off,
+	     const SIZE_T numpage,
+	     const bool write,
+	     FlashCost &cost,
+	     vector<double> &busy);
+
+ public:
+  FlashModel(const FlashGeometry &geom, const SIZE_T numpages);
+
+  // ERROR_BADCONFIG for a geometry the model can't run with
+  static ERROR_T Check(const FlashGeometry &geom);
+
+  // Serve numpage pages at off and return how long it took.  cost
+  // says where the time went.  Reading a page that was never written
+  // only moves zeros over the channel.
+  double Access(const SIZE_T off,
+		const SIZE_T numpage,
+		const bool write,
+		FlashCost &cost);
+  // The same for a request the device gets at start, whose pages
+  // wait for their channels to finish what they were already given.
+  // Returns when it is done.
+  double Serve(const SIZE_T off,
+	       const SIZE_T numpage,
+	       const bool write,
+	       const double start,
+	       FlashCost &cost);
+  // When every channel will be done
+  double GetIdleTime() const;
+  // Start the channels' clocks over, all idle
+  void   RestartClock();
+  // The same without garbage collection, and without changing
+  // anything
+  double Estimate(const SIZE_T off, const SIZE_T numpage, const bool write) const;
+
+  const FlashGeometry &GetGeometry() const { return geom; }
+};
+
+#endif
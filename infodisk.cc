@@ -1,7 +1,7 @@
 #include <string>
 #include <stdlib.h>
 
-#include "disksystem.h"
+#include "stripeddisk.h"
 
 
 void usage() 
@@ -18,9 +18,16 @@ int main(int argc, char *argv[])
   }
 #endif
 
-  DiskSystem disk(argv[1]);
+  DiskSystem *disk=OpenDiskSystem(argv[1]);
+
+  if (!disk) {
+    cerr << "Can't open the disk "<<argv[1]<<"\n";
+    return -1;
+  }
   
-  cerr << "Disk is as follows.\n" << disk << "\n";
+  cerr << "Disk is as follows.\n" << *disk << "\n";
+
+  delete disk;
 
   cerr << "Done.\n";
 
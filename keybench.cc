@@ -0,0 +1,110 @@
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "keysearch.h"
+
+
+void usage()
+{
+  cerr << "usage: keybench keysize numkeys stride numsearches\n";
+}
+
+static double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+static void RandomKey(BYTE_T *key, const SIZE_T keysize)
+{
+  for (SIZE_T i=0;i<keysize;i++) {
+    key[i]=rand()&0xff;
+  }
+}
+
+//
+// Lay out numkeys sorted random keys stride bytes apart, the way a
+// node's slots hold them, and time searches for random keys, half of
+// which are there, with each kind of search this CPU has.  Every
+// search's answer is checked against the memcmp binary search.
+//
+int main(int argc, char *argv[])
+{
+  if (argc<5) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T keysize=atoi(argv[1]);
+  SIZE_T numkeys=atoi(argv[2]);
+  SIZE_T stride=atoi(argv[3]);
+  SIZE_T numsearches=atoi(argv[4]);
+  KeySearchType types[]={KEYSEARCH_SCALAR, KEYSEARCH_SSE2, KEYSEARCH_AVX2};
+
+  if (keysize==0 || numkeys==0 || stride<keysize || numsearches==0) {
+    usage();
+    exit(-1);
+  }
+
+  srand(numkeys);
+
+  vector<vector<BYTE_T> > sorted(numkeys,vector<BYTE_T>(keysize));
+  for (SIZE_T i=0;i<numkeys;i++) {
+    RandomKey(&sorted[i][0],keysize);
+  }
+  sort(sorted.begin(),sorted.end());
+  sorted.erase(unique(sorted.begin(),sorted.end()),sorted.end());
+  numkeys=sorted.size();
+
+  vector<BYTE_T> keys(numkeys*stride,0);
+  for (SIZE_T i=0;i<numkeys;i++) {
+    memcpy(&keys[i*stride],&sorted[i][0],keysize);
+  }
+
+  vector<BYTE_T> probes(numsearches*keysize);
+  for (SIZE_T i=0;i<numsearches;i++) {
+    if (i%2) {
+      memcpy(&probes[i*keysize],&sorted[rand()%numkeys][0],keysize);
+    } else {
+      RandomKey(&probes[i*keysize],keysize);
+    }
+  }
+
+  cerr << "keysize="<<keysize<<" numkeys="<<numkeys<<" stride="<<stride<<" numsearches="<<numsearches<<endl;
+
+  vector<SIZE_T> expect(numsearches);
+
+  for (SIZE_T t=0;t<sizeof(types)/sizeof(types[0]);t++) {
+    if (SetKeySearch(types[t])!=ERROR_NOERROR) {
+      cout << "search="<<KeySearchName(types[t])<<" unavailable"<<endl;
+      continue;
+    }
+
+    vector<SIZE_T> found(numsearches);
+    double start=now();
+
+    for (SIZE_T i=0;i<numsearches;i++) {
+      found[i]=KeyLowerBound(&keys[0],stride,numkeys,keysize,&probes[i*keysize]);
+    }
+
+    double elapsed=now()-start;
+
+    if (types[t]==KEYSEARCH_SCALAR) {
+      expect=found;
+    } else if (found!=expect) {
+      cerr << "search="<<KeySearchName(types[t])<<" disagrees with the memcmp search"<<endl;
+      return -1;
+    }
+
+    cout << "search="<<KeySearchName(types[t])
+	 << " nspersearch="<<elapsed*1e9/numsearches
+	 << endl;
+  }
+
+  return 0;
+}
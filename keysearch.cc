@@ -0,0 +1,449 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "keysearch.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KEYSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+
+ERROR_T ParseKeySearchType(const char *name, KeySearchType &type)
+{
+  if (!strcmp(name,"auto")) {
+    type=KEYSEARCH_AUTO;
+  } else if (!strcmp(name,"scalar")) {
+    type=KEYSEARCH_SCALAR;
+  } else if (!strcmp(name,"sse2")) {
+    type=KEYSEARCH_SSE2;
+  } else if (!strcmp(name,"avx2")) {
+    type=KEYSEARCH_AVX2;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *KeySearchName(const KeySearchType type)
+{
+  switch (type) {
+  case KEYSEARCH_AUTO: return "auto";
+  case KEYSEARCH_SCALAR: return "scalar";
+  case KEYSEARCH_SSE2: return "sse2";
+  case KEYSEARCH_AVX2: return "avx2";
+  default: return "unknown";
+  }
+}
+
+
+static SIZE_T SearchMemcmp(const BYTE_T *keys,
+			   const SIZE_T stride,
+			   const SIZE_T numkeys,
+			   const SIZE_T keysize,
+			   const BYTE_T *key)
+{
+  SIZE_T lo=0, hi=numkeys;
+
+  while (lo<hi) {
+    SIZE_T mid=lo+(hi-lo)/2;
+
+    if (memcmp(keys+mid*stride,key,keysize)<0) {
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+  return lo;
+}
+
+
+#ifdef KEYSEARCH_X86
+
+//
+// x86 is little-endian, so swapping the bytes of a key as it is
+// loaded gives an integer that orders the way memcmp orders the bytes
+//
+static inline uint32_t Load32(const BYTE_T *p)
+{
+  uint32_t v;
+
+  memcpy(&v,p,sizeof(v));
+  return __builtin_bswap32(v);
+}
+
+static inline uint64_t Load64(const BYTE_T *p)
+{
+  uint64_t v;
+
+  memcpy(&v,p,sizeof(v));
+  return __builtin_bswap64(v);
+}
+
+static inline bool KeyLess(const BYTE_T *a, const BYTE_T *b, const SIZE_T keysize)
+{
+  switch (keysize) {
+  case 4:
+    return Load32(a)<Load32(b);
+  case 8:
+    return Load64(a)<Load64(b);
+  default: {
+    // 16
+    uint64_t ah=Load64(a), bh=Load64(b);
+    return ah<bh || (ah==bh && Load64(a+8)<Load64(b+8));
+  }
+  }
+}
+
+//
+// Binary search with integer compares until at most window keys are
+// left, in [lo,hi).  The answer is lo plus how many of those are less
+// than key, which the vector code counts.
+//
+static inline void Narrow(const BYTE_T *keys,
+			  const SIZE_T stride,
+			  const SIZE_T keysize,
+			  const BYTE_T *key,
+			  const SIZE_T window,
+			  SIZE_T &lo,
+			  SIZE_T &hi)
+{
+  while (hi-lo>window) {
+    SIZE_T mid=lo+(hi-lo)/2;
+
+    if (KeyLess(keys+mid*stride,key,keysize)) {
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+}
+
+// The keys in [i,hi) that are less than key, one at a time
+static inline SIZE_T CountLessScalar(const BYTE_T *keys,
+				     const SIZE_T stride,
+				     const SIZE_T keysize,
+				     const BYTE_T *key,
+				     SIZE_T i,
+				     const SIZE_T hi)
+{
+  SIZE_T n=0;
+
+  for (; i<hi; i++) {
+    n+=KeyLess(keys+i*stride,key,keysize);
+  }
+  return n;
+}
+
+
+//
+// SSE2.  There is no byte shuffle or 64 bit compare, so the bytes
+// are swapped with 16 bit shifts and word shuffles, and 64 bit
+// unsigned compares are built out of 32 bit ones.  The sign bits are
+// flipped to make the signed compares unsigned.
+//
+__attribute__((target("sse2")))
+static inline __m128i Bswap32SSE2(__m128i x)
+{
+  x=_mm_or_si128(_mm_slli_epi16(x,8),_mm_srli_epi16(x,8));
+  x=_mm_shufflelo_epi16(x,_MM_SHUFFLE(2,3,0,1));
+  return _mm_shufflehi_epi16(x,_MM_SHUFFLE(2,3,0,1));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i Bswap64SSE2(__m128i x)
+{
+  x=_mm_or_si128(_mm_slli_epi16(x,8),_mm_srli_epi16(x,8));
+  x=_mm_shufflelo_epi16(x,_MM_SHUFFLE(0,1,2,3));
+  return _mm_shufflehi_epi16(x,_MM_SHUFFLE(0,1,2,3));
+}
+
+// All ones in each 64 bit lane where a<b, unsigned
+__attribute__((target("sse2")))
+static inline __m128i Less64SSE2(const __m128i a, const __m128i b)
+{
+  const __m128i flip=_mm_set1_epi32(0x80000000);
+  __m128i lt=_mm_cmplt_epi32(_mm_xor_si128(a,flip),_mm_xor_si128(b,flip));
+  __m128i eq=_mm_cmpeq_epi32(a,b);
+  // The high half decides unless it's equal, then the low half does
+  __m128i r=_mm_or_si128(lt,_mm_and_si128(eq,_mm_slli_epi64(lt,32)));
+
+  return _mm_shuffle_epi32(r,_MM_SHUFFLE(3,3,1,1));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i Equal64SSE2(const __m128i a, const __m128i b)
+{
+  __m128i eq=_mm_cmpeq_epi32(a,b);
+
+  return _mm_and_si128(eq,_mm_shuffle_epi32(eq,_MM_SHUFFLE(2,3,0,1)));
+}
+
+__attribute__((target("sse2")))
+static SIZE_T CountLess4SSE2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m128i flip=_mm_set1_epi32(0x80000000);
+  const __m128i t=_mm_xor_si128(_mm_set1_epi32(Load32(key)),flip);
+  SIZE_T n=0;
+
+  for (; i+4<=hi; i+=4) {
+    __m128i k;
+
+    if (stride==4) {
+      k=Bswap32SSE2(_mm_loadu_si128((const __m128i *)(keys+i*4)));
+    } else {
+      k=_mm_set_epi32(Load32(keys+(i+3)*stride),Load32(keys+(i+2)*stride),
+		      Load32(keys+(i+1)*stride),Load32(keys+i*stride));
+    }
+    k=_mm_xor_si128(k,flip);
+    n+=__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(k,t))));
+  }
+  return n+CountLessScalar(keys,stride,4,key,i,hi);
+}
+
+__attribute__((target("sse2")))
+static SIZE_T CountLess8SSE2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m128i t=_mm_set1_epi64x(Load64(key));
+  SIZE_T n=0;
+
+  for (; i+2<=hi; i+=2) {
+    __m128i k;
+
+    if (stride==8) {
+      k=Bswap64SSE2(_mm_loadu_si128((const __m128i *)(keys+i*8)));
+    } else {
+      k=_mm_set_epi64x(Load64(keys+(i+1)*stride),Load64(keys+i*stride));
+    }
+    n+=__builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(Less64SSE2(k,t))));
+  }
+  return n+CountLessScalar(keys,stride,8,key,i,hi);
+}
+
+__attribute__((target("sse2")))
+static SIZE_T CountLess16SSE2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m128i th=_mm_set1_epi64x(Load64(key));
+  const __m128i tl=_mm_set1_epi64x(Load64(key+8));
+  SIZE_T n=0;
+
+  for (; i+2<=hi; i+=2) {
+    // Each register holds one key, high half first
+    __m128i k0=Bswap64SSE2(_mm_loadu_si128((const __m128i *)(keys+i*stride)));
+    __m128i k1=Bswap64SSE2(_mm_loadu_si128((const __m128i *)(keys+(i+1)*stride)));
+    __m128i h=_mm_unpacklo_epi64(k0,k1);
+    __m128i l=_mm_unpackhi_epi64(k0,k1);
+    __m128i lt=_mm_or_si128(Less64SSE2(h,th),_mm_and_si128(Equal64SSE2(h,th),Less64SSE2(l,tl)));
+
+    n+=__builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(lt)));
+  }
+  return n+CountLessScalar(keys,stride,16,key,i,hi);
+}
+
+static SIZE_T SearchSSE2(const BYTE_T *keys,
+			 const SIZE_T stride,
+			 const SIZE_T numkeys,
+			 const SIZE_T keysize,
+			 const BYTE_T *key)
+{
+  SIZE_T lo=0, hi=numkeys;
+
+  switch (keysize) {
+  case 4:
+    Narrow(keys,stride,4,key,16,lo,hi);
+    return lo+CountLess4SSE2(keys,stride,key,lo,hi);
+  case 8:
+    Narrow(keys,stride,8,key,8,lo,hi);
+    return lo+CountLess8SSE2(keys,stride,key,lo,hi);
+  case 16:
+    Narrow(keys,stride,16,key,8,lo,hi);
+    return lo+CountLess16SSE2(keys,stride,key,lo,hi);
+  default:
+    return SearchMemcmp(keys,stride,numkeys,keysize,key);
+  }
+}
+
+
+//
+// AVX2.  Keys that aren't next to each other are gathered, and the
+// bytes are swapped with a byte shuffle.
+//
+__attribute__((target("avx2")))
+static inline __m256i Bswap32AVX2(const __m256i x)
+{
+  const __m256i m=_mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+				   3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  return _mm256_shuffle_epi8(x,m);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Bswap64AVX2(const __m256i x)
+{
+  const __m256i m=_mm256_setr_epi8(7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8,
+				   7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8);
+  return _mm256_shuffle_epi8(x,m);
+}
+
+__attribute__((target("avx2")))
+static SIZE_T CountLess4AVX2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m256i flip=_mm256_set1_epi32(0x80000000);
+  const __m256i t=_mm256_xor_si256(_mm256_set1_epi32(Load32(key)),flip);
+  const __m256i idx=_mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),_mm256_set1_epi32(stride));
+  SIZE_T n=0;
+
+  for (; i+8<=hi; i+=8) {
+    __m256i k;
+
+    if (stride==4) {
+      k=_mm256_loadu_si256((const __m256i *)(keys+i*4));
+    } else {
+      k=_mm256_i32gather_epi32((const int *)(keys+i*stride),idx,1);
+    }
+    k=_mm256_xor_si256(Bswap32AVX2(k),flip);
+    n+=__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(t,k))));
+  }
+  return n+CountLessScalar(keys,stride,4,key,i,hi);
+}
+
+__attribute__((target("avx2")))
+static SIZE_T CountLess8AVX2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m256i flip=_mm256_set1_epi64x(0x8000000000000000LL);
+  const __m256i t=_mm256_xor_si256(_mm256_set1_epi64x(Load64(key)),flip);
+  const __m128i idx=_mm_mullo_epi32(_mm_setr_epi32(0,1,2,3),_mm_set1_epi32(stride));
+  SIZE_T n=0;
+
+  for (; i+4<=hi; i+=4) {
+    __m256i k;
+
+    if (stride==8) {
+      k=_mm256_loadu_si256((const __m256i *)(keys+i*8));
+    } else {
+      k=_mm256_i32gather_epi64((const long long *)(keys+i*stride),idx,1);
+    }
+    k=_mm256_xor_si256(Bswap64AVX2(k),flip);
+    n+=__builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(t,k))));
+  }
+  return n+CountLessScalar(keys,stride,8,key,i,hi);
+}
+
+__attribute__((target("avx2")))
+static SIZE_T CountLess16AVX2(const BYTE_T *keys, const SIZE_T stride, const BYTE_T *key, SIZE_T i, const SIZE_T hi)
+{
+  const __m256i flip=_mm256_set1_epi64x(0x8000000000000000LL);
+  const __m256i th=_mm256_xor_si256(_mm256_set1_epi64x(Load64(key)),flip);
+  const __m256i tl=_mm256_xor_si256(_mm256_set1_epi64x(Load64(key+8)),flip);
+  const __m128i idx=_mm_mullo_epi32(_mm_setr_epi32(0,1,2,3),_mm_set1_epi32(stride));
+  SIZE_T n=0;
+
+  for (; i+4<=hi; i+=4) {
+    const BYTE_T *base=keys+i*stride;
+    __m256i h=_mm256_i32gather_epi64((const long long *)base,idx,1);
+    __m256i l=_mm256_i32gather_epi64((const long long *)(base+8),idx,1);
+
+    h=_mm256_xor_si256(Bswap64AVX2(h),flip);
+    l=_mm256_xor_si256(Bswap64AVX2(l),flip);
+
+    // The high halves decide unless they're equal
+    __m256i lt=_mm256_or_si256(_mm256_cmpgt_epi64(th,h),
+			       _mm256_and_si256(_mm256_cmpeq_epi64(th,h),_mm256_cmpgt_epi64(tl,l)));
+
+    n+=__builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+  }
+  return n+CountLessScalar(keys,stride,16,key,i,hi);
+}
+
+static SIZE_T SearchAVX2(const BYTE_T *keys,
+			 const SIZE_T stride,
+			 const SIZE_T numkeys,
+			 const SIZE_T keysize,
+			 const BYTE_T *key)
+{
+  SIZE_T lo=0, hi=numkeys;
+
+  switch (keysize) {
+  case 4:
+    Narrow(keys,stride,4,key,32,lo,hi);
+    return lo+CountLess4AVX2(keys,stride,key,lo,hi);
+  case 8:
+    Narrow(keys,stride,8,key,16,lo,hi);
+    return lo+CountLess8AVX2(keys,stride,key,lo,hi);
+  case 16:
+    Narrow(keys,stride,16,key,16,lo,hi);
+    return lo+CountLess16AVX2(keys,stride,key,lo,hi);
+  default:
+    return SearchMemcmp(keys,stride,numkeys,keysize,key);
+  }
+}
+
+#endif
+
+
+static bool CPUHas(const KeySearchType type)
+{
+  switch (type) {
+  case KEYSEARCH_SCALAR:
+    return true;
+#ifdef KEYSEARCH_X86
+  case KEYSEARCH_SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+  case KEYSEARCH_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+static KeySearchType BestKeySearch()
+{
+  if (CPUHas(KEYSEARCH_AVX2)) {
+    return KEYSEARCH_AVX2;
+  } else if (CPUHas(KEYSEARCH_SSE2)) {
+    return KEYSEARCH_SSE2;
+  } else {
+    return KEYSEARCH_SCALAR;
+  }
+}
+
+static KeySearchType searchtype=BestKeySearch();
+
+
+SIZE_T KeyLowerBound(const BYTE_T *keys,
+		     const SIZE_T stride,
+		     const SIZE_T numkeys,
+		     const SIZE_T keysize,
+		     const BYTE_T *key)
+{
+  switch (searchtype) {
+#ifdef KEYSEARCH_X86
+  case KEYSEARCH_AVX2:
+    return SearchAVX2(keys,stride,numkeys,keysize,key);
+  case KEYSEARCH_SSE2:
+    return SearchSSE2(keys,stride,numkeys,keysize,key);
+#endif
+  default:
+    return SearchMemcmp(keys,stride,numkeys,keysize,key);
+  }
+}
+
+ERROR_T SetKeySearch(const KeySearchType type)
+{
+  if (type==KEYSEARCH_AUTO) {
+    searchtype=BestKeySearch();
+    return ERROR_NOERROR;
+  }
+  if (!CPUHas(type)) {
+    return ERROR_UNIMPL;
+  }
+  searchtype=type;
+  return ERROR_NOERROR;
+}
+
+KeySearchType GetKeySearch()
+{
+  return searchtype;
+}
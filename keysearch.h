@@ -0,0 +1,36 @@
+#ifndef _keysearch
+#define _keysearch
+
+#include "global.h"
+
+using namespace std;
+
+enum KeySearchType {KEYSEARCH_AUTO, KEYSEARCH_SCALAR, KEYSEARCH_SSE2, KEYSEARCH_AVX2};
+
+// Names are auto, scalar, sse2, and avx2.  ERROR_BADCONFIG otherwise.
+ERROR_T ParseKeySearchType(const char *name, KeySearchType &type);
+const char *KeySearchName(const KeySearchType type);
+
+//
+// Search numkeys sorted keys of keysize bytes each, the ith at
+// keys+i*stride, for the first that is not less than key.  Returns
+// numkeys if they all are.  Keys compare as memcmp compares them.
+//
+// Keys of 4, 8, or 16 bytes are loaded as big-endian integers, so
+// that comparing the integers is comparing the bytes, and the last
+// few keys the search narrows down to are compared with key several
+// at a time in SSE2 or AVX2 registers.  Any other keysize, or the
+// scalar search, is a binary search with memcmp.
+//
+SIZE_T KeyLowerBound(const BYTE_T *keys,
+		     const SIZE_T stride,
+		     const SIZE_T numkeys,
+		     const SIZE_T keysize,
+		     const BYTE_T *key);
+
+// Search with type from now on.  KEYSEARCH_AUTO, the default, is the
+// widest one this CPU has.  ERROR_UNIMPL if the CPU doesn't have it.
+ERROR_T SetKeySearch(const KeySearchType type);
+KeySearchType GetKeySearch();
+
+#endif
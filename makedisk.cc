@@ -6,7 +6,7 @@
 
 void usage() 
 {
-  cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat\n";
+  cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat [grow|prealloc|sparse] [ssd channels pagesperblock readlat programlat eraselat transferlat overprovision]\n";
 }
 
 int main(int argc, char *argv[])
@@ -28,6 +28,41 @@ int main(int argc, char *argv[])
 		  atof(argv[8]),
 		  atof(argv[9]));
   
+  int arg=10;
+
+  if (argc>arg && string(argv[arg])!="ssd") { 
+    DiskDataLayout layout;
+    ERROR_T rc;
+    if (ParseDiskDataLayout(argv[arg],layout)!=ERROR_NOERROR) { 
+      usage();
+      exit(-1);
+    }
+    if ((rc=disk.SetDataLayout(layout))!=ERROR_NOERROR) { 
+      cerr << "Can't lay out the data file due to error "<<rc<<"\n";
+      exit(-1);
+    }
+    arg++;
+  }
+
+  if (argc>arg) { 
+    FlashGeometry flash;
+    ERROR_T rc;
+    if (string(argv[arg])!="ssd" || argc<arg+8) { 
+      usage();
+      exit(-1);
+    }
+    flash.channels=atoi(argv[arg+1]);
+    flash.pagesperblock=atoi(argv[arg+2]);
+    flash.readlatency=atof(argv[arg+3]);
+    flash.programlatency=atof(argv[arg+4]);
+    flash.eraselatency=atof(argv[arg+5]);
+    flash.transferlatency=atof(argv[arg+6]);
+    flash.overprovision=atof(argv[arg+7]);
+    if ((rc=disk.SetDeviceModel(DISK_DEVICE_SSD,flash))!=ERROR_NOERROR) { 
+      cerr << "Can't model the flash device due to error "<<rc<<"\n";
+      exit(-1);
+    }
+  }
   
   cerr << "Disk is as follows.\n" << disk << "\n";
 
@@ -0,0 +1,42 @@
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include "stripeddisk.h"
+
+
+void usage() 
+{
+  cerr << "usage: makestripe filestem stripeunit memberfilestem [memberfilestem ...]\n";
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc<4) { 
+    usage();
+    exit(-1);
+  }
+
+  vector<string> members;
+  ERROR_T rc;
+
+  for (int i=3;i<argc;i++) { 
+    members.push_back(argv[i]);
+  }
+
+  if ((rc=MakeStripedDisk(argv[1],atoi(argv[2]),members))!=ERROR_NOERROR) { 
+    cerr << "Can't make the stripe set due to error "<<rc<<"\n";
+    exit(-1);
+  }
+
+  DiskSystem *disk=OpenDiskSystem(argv[1]);
+
+  if (disk) { 
+    cerr << "Disk is as follows.\n" << *disk << "\n";
+    delete disk;
+  }
+
+  cerr << "Done.\n";
+
+  return 0;
+}
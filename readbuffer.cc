@@ -1,7 +1,9 @@
 #include <string>
+#include <memory>
 #include <stdlib.h>
 
 #include "buffercache.h"
+#include "stripeddisk.h"
 
 
 void usage() 
@@ -15,27 +17,35 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T cachesize=atoi(argv[1]);
+  SIZE_T cachesize;
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
-  DiskSystem disk(argv[2]);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(argv[2]));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<argv[2]<<"\n";
+    return -1;
+  }
+  if (ParseCacheSize(argv[1],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  BufferCache cache(disk.get(),cachesize);
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T blocksize = disk->GetBlockSize();
 
   cache.Attach();
 
-  for (unsigned i=blocknum;i<(blocknum+numblocks);i++) { 
-    Block block(blocksize);
-    ERROR_T rc;
-    rc=cache.ReadBlock(i,block);
-    if (rc!=ERROR_NOERROR) { 
-      cerr << "Error " << rc <<" occured when reading block "<< i << endl;
-      return -1;
-    }
-    for (SIZE_T j=0;j<block.length;j++) { 
-      cout << block.data[j];
+  // The blocks are consecutive, so the misses go to disk in runs
+  vector<Block> blocks;
+  ERROR_T rc=cache.ReadBlocks(blocknum,numblocks,blocks);
+  if (rc!=ERROR_NOERROR) { 
+    cerr << "Error " << rc <<" occured when reading blocks "<< blocknum << " to " << (blocknum+numblocks-1) << endl;
+    return -1;
+  }
+  for (unsigned i=0;i<blocks.size();i++) { 
+    for (SIZE_T j=0;j<blocks[i].length && j<blocksize;j++) { 
+      cout << blocks[i].data[j];
     }
   }
 
@@ -52,6 +62,7 @@ int main(int argc, char *argv[])
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+  DumpStatsJSON(cache,"readbuffer");
 
   return 0;
 }
@@ -1,7 +1,8 @@
 #include <string>
+#include <memory>
 #include <stdlib.h>
 
-#include "disksystem.h"
+#include "stripeddisk.h"
 
 
 void usage() 
@@ -19,11 +20,15 @@ int main(int argc, char *argv[])
   SIZE_T numblocks=atoi(argv[3]);
   double reqtime;
 
-  DiskSystem disk(argv[1]);
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(argv[1]));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<argv[1]<<"\n";
+    return -1;
+  }
 
   vector<Block> b;
 
-  ERROR_T rc= disk.Read(blocknum, numblocks, b, reqtime);
+  ERROR_T rc= disk->Read(blocknum, numblocks, b, reqtime);
 
   if (rc!=ERROR_NOERROR) { 
     cerr << "Error "<< rc << " occured.\n";
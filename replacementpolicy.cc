@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <ctype.h>
+
+#include "replacementpolicy.h"
+
+
+ERROR_T ParseReplacementPolicy(const string &name, ReplacementPolicyType &type)
+{
+  string n;
+
+  for (SIZE_T i=0;i<name.size();i++) {
+    if (name[i]!='-') {
+      n+=tolower(name[i]);
+    }
+  }
+
+  if (n=="lru") {
+    type=REPLACE_LRU;
+  } else if (n=="clock") {
+    type=REPLACE_CLOCK;
+  } else if (n=="2q") {
+    type=REPLACE_2Q;
+  } else if (n=="arc") {
+    type=REPLACE_ARC;
+  } else if (n=="lruk" || n=="lru2") {
+    type=REPLACE_LRUK;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+ReplacementPolicy *MakeReplacementPolicy(const ReplacementPolicyType type)
+{
+  switch (type) {
+  case REPLACE_CLOCK:
+    return new ClockPolicy;
+  case REPLACE_2Q:
+    return new TwoQPolicy;
+  case REPLACE_ARC:
+    return new ARCPolicy;
+  case REPLACE_LRUK:
+    return new LRUKPolicy;
+  case REPLACE_LRU:
+  default:
+    return new LRUPolicy;
+  }
+}
+
+
+//
+// LRU
+//
+
+LRUPolicy::LRUPolicy() : mru(BUFFERCACHE_NOFRAME), lru(BUFFERCACHE_NOFRAME), lrusorted(-1)
+{}
+
+void LRUPolicy::Reset(const SIZE_T numframes)
+{
+  prev.assign(numframes,BUFFERCACHE_NOFRAME);
+  next.assign(numframes,BUFFERCACHE_NOFRAME);
+  blocknum.assign(numframes,0);
+  lastaccessed.assign(numframes,-1);
+  mru=lru=BUFFERCACHE_NOFRAME;
+  lrusorted=-1;
+}
+
+void LRUPolicy::LinkAtMRU(const SIZE_T f)
+{
+  prev[f]=BUFFERCACHE_NOFRAME;
+  next[f]=mru;
+  if (mru!=BUFFERCACHE_NOFRAME) {
+    prev[mru]=f;
+  }
+  mru=f;
+  if (lru==BUFFERCACHE_NOFRAME) {
+    lru=f;
+  }
+}
+
+void LRUPolicy::LinkAtLRU(const SIZE_T f)
+{
+  next[f]=BUFFERCACHE_NOFRAME;
+  prev[f]=lru;
+  if (lru!=BUFFERCACHE_NOFRAME) {
+    next[lru]=f;
+  }
+  lru=f;
+  if (mru==BUFFERCACHE_NOFRAME) {
+    mru=f;
+  }
+}
+
+void LRUPolicy::Unlink(const SIZE_T f)
+{
+  if (prev[f]!=BUFFERCACHE_NOFRAME) {
+    next[prev[f]]=next[f];
+  } else {
+    mru=next[f];
+  }
+  if (next[f]!=BUFFERCACHE_NOFRAME) {
+    prev[next[f]]=prev[f];
+  } else {
+    lru=prev[f];
+  }
+  prev[f]=next[f]=BUFFERCACHE_NOFRAME;
+}
+
+void LRUPolicy::Insert(const SIZE_T f, const SIZE_T b, const double now)
+{
+  blocknum[f]=b;
+  lastaccessed[f]=now;
+  LinkAtMRU(f);
+}
+
+void LRUPolicy::Touch(const SIZE_T f, const double now)
+{
+  lastaccessed[f]=now;
+  if (mru!=f) {
+    Unlink(f);
+    LinkAtMRU(f);
+  }
+}
+
+void LRUPolicy::Remove(const SIZE_T f)
+{
+  Unlink(f);
+}
+
+//
+// The victim is the lru frame, except that every frame touched at
+// the same simulated time counts as equally old, and those ties
+// go to the lowest block number.  Once time has moved past the
+// run of equal lastaccessed values at the lru end, nothing can join
+// it, so we put it in block order once and then just pop the lru end.
+//
+SIZE_T LRUPolicy::ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now)
+{
+  SIZE_T f;
+
+  if (lru==BUFFERCACHE_NOFRAME) {
+    return BUFFERCACHE_NOFRAME;
+  }
+
+  double oldest=lastaccessed[lru];
+
+  if (oldest!=lrusorted) {
+    run.clear();  // (blocknum, frame)
+
+    for (f=lru;
+	 f!=BUFFERCACHE_NOFRAME && lastaccessed[f]==oldest;
+	 f=prev[f]) {
+      run.push_back(pair<SIZE_T, SIZE_T>(blocknum[f],f));
+    }
+
+    sort(run.begin(),run.end());
+
+    if (oldest>=now) {
+      // Still open, so just find the lowest evictable block
+      for (vector<pair<SIZE_T, SIZE_T> >::const_iterator i=run.begin();
+	   i!=run.end();
+	   ++i) {
+	if (check.CanEvict((*i).second)) {
+	  return (*i).second;
+	}
+      }
+      return BUFFERCACHE_NOFRAME;
+    }
+
+    // relink the run so the lowest block number is at the lru end
+    for (vector<pair<SIZE_T, SIZE_T> >::const_reverse_iterator i=run.rbegin();
+	 i!=run.rend();
+	 ++i) {
+      Unlink((*i).second);
+      LinkAtLRU((*i).second);
+    }
+    lrusorted=oldest;
+  }
+
+  for (f=lru; f!=BUFFERCACHE_NOFRAME; f=prev[f]) {
+    if (check.CanEvict(f)) {
+      return f;
+    }
+  }
+  return BUFFERCACHE_NOFRAME;
+}
+
+
+//
+// CLOCK
+//
+
+ClockPolicy::ClockPolicy() : hand(0)
+{}
+
+void ClockPolicy::Reset(const SIZE_T numframes)
+{
+  resident.assign(numframes,false);
+  referenced.assign(numframes,false);
+  hand=0;
+}
+
+void ClockPolicy::Insert(const SIZE_T f, const SIZE_T b, const double now)
+{
+  resident[f]=true;
+  referenced[f]=false;
+}
+
+void ClockPolicy::Touch(const SIZE_T f, const double now)
+{
+  referenced[f]=true;
+}
+
+void ClockPolicy::Remove(const SIZE_T f)
+{
+  resident[f]=false;
+  referenced[f]=false;
+}
+
+SIZE_T ClockPolicy::ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now)
+{
+  SIZE_T n=resident.size();
+
+  // Two full sweeps clear every reference bit, so if nothing turns
+  // up by then everything is pinned
+  for (SIZE_T i=0; i<2*n; i++, hand=(hand+1)%n) {
+    if (!resident[hand] || !check.CanEvict(hand)) {
+      continue;
+    }
+    if (referenced[hand]) {
+      referenced[hand]=false;
+    } else {
+      SIZE_T f=hand;
+      hand=(hand+1)%n;
+      return f;
+    }
+  }
+  return BUFFERCACHE_NOFRAME;
+}
+
+
+//
+// Ghost lists
+//
+
+void GhostList::PushFront(const SIZE_T b)
+{
+  Erase(b);
+  order.push_front(b);
+  where[b]=order.begin();
+}
+
+void GhostList::Erase(const SIZE_T b)
+{
+  unordered_map<SIZE_T, list<SIZE_T>::iterator>::iterator i=where.find(b);
+
+  if (i!=where.end()) {
+    order.erase((*i).second);
+    where.erase(i);
+  }
+}
+
+void GhostList::PopBack()
+{
+  if (!order.empty()) {
+    where.erase(order.back());
+    order.pop_back();
+  }
+}
+
+void GhostList::Clear()
+{
+  order.clear();
+  where.clear();
+}
+
+
+//
+// 2Q
+//
+
+TwoQPolicy::TwoQPolicy() : kin(1), kout(1)
+{}
+
+void TwoQPolicy::Reset(const SIZE_T numframes)
+{
+  queue.assign(numframes,NONE);
+  blocknum.assign(numframes,0);
+  pos.assign(numframes,list<SIZE_T>::iterator());
+  a1in.clear();
+  am.clear();
+  a1out.Clear();
+  // The sizes recommended in the paper
+  kin = numframes/4>0 ? numframes/4 : 1;
+  kout = numframes/2>0 ? numframes/2 : 1;
+}
+
+void TwoQPolicy::Insert(const SIZE_T f, const SIZE_T b, const double now)
+{
+  blocknum[f]=b;
+  if (a1out.Contains(b)) {
+    // it came back after falling out of A1in, so it's hot
+    a1out.Erase(b);
+    am.push_front(f);
+    pos[f]=am.begin();
+    queue[f]=AM;
+  } else {
+    a1in.push_front(f);
+    pos[f]=a1in.begin();
+    queue[f]=A1IN;
+  }
+}
+
+void TwoQPolicy::Touch(const SIZE_T f, const double now)
+{
+  // A hit in A1in does nothing; correlated references don't promote
+  if (queue[f]==AM) {
+    am.splice(am.begin(),am,pos[f]);
+  }
+}
+
+void TwoQPolicy::Remove(const SIZE_T f)
+{
+  if (queue[f]==A1IN) {
+    a1in.erase(pos[f]);
+    a1out.PushFront(blocknum[f]);
+    while (a1out.Size()>kout) {
+      a1out.PopBack();
+    }
+  } else if (queue[f]==AM) {
+    am.erase(pos[f]);
+  }
+  queue[f]=NONE;
+}
+
+SIZE_T TwoQPolicy::OldestEvictable(const list<SIZE_T> &l, const EvictionCheck &check) const
+{
+  for (list<SIZE_T>::const_reverse_iterator i=l.rbegin(); i!=l.rend(); ++i) {
+    if (check.CanEvict(*i)) {
+      return *i;
+    }
+  }
+  return BUFFERCACHE_NOFRAME;
+}
+
+SIZE_T TwoQPolicy::ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now)
+{
+  SIZE_T f;
+
+  if (a1in.size()>kin || am.empty()) {
+    f=OldestEvictable(a1in,check);
+    return f!=BUFFERCACHE_NOFRAME ? f : OldestEvictable(am,check);
+  } else {
+    f=OldestEvictable(am,check);
+    return f!=BUFFERCACHE_NOFRAME ? f : OldestEvictable(a1in,check);
+  }
+}
+
+
+//
+// ARC
+//
+
+ARCPolicy::ARCPolicy() : c(1), p(0), adaptedfor(BUFFERCACHE_NOFRAME)
+{}
+
+void ARCPolicy::Reset(const SIZE_T numframes)
+{
+  queue.assign(numframes,NONE);
+  blocknum.assign(numframes,0);
+  pos.assign(numframes,list<SIZE_T>::iterator());
+  t1.clear();
+  t2.clear();
+  b1.Clear();
+  b2.Clear();
+  c=numframes;
+  p=0;
+  adaptedfor=BUFFERCACHE_NOFRAME;
+}
+
+// A miss on a block we remember shifts the target size of T1
+void ARCPolicy::Adapt(const SIZE_T b)
+{
+  if (adaptedfor==b) {
+    return;
+  }
+  if (b1.Contains(b)) {
+    double delta = b1.Size()>=b2.Size() ? 1 : (double)b2.Size()/(double)b1.Size();
+    p = p+delta<c ? p+delta : c;
+    adaptedfor=b;
+  } else if (b2.Contains(b)) {
+    double delta = b2.Size()>=b1.Size() ? 1 : (double)b1.Size()/(double)b2.Size();
+    p = p-delta>0 ? p-delta : 0;
+    adaptedfor=b;
+  }
+}
+
+void ARCPolicy::Insert(const SIZE_T f, const SIZE_T b, const double now)
+{
+  blocknum[f]=b;
+  if (b1.Contains(b) || b2.Contains(b)) {
+    Adapt(b);
+    b1.Erase(b);
+    b2.Erase(b);
+    t2.push_front(f);
+    pos[f]=t2.begin();
+    queue[f]=T2;
+  } else {
+    t1.push_front(f);
+    pos[f]=t1.begin();
+    queue[f]=T1;
+  }
+  adaptedfor=BUFFERCACHE_NOFRAME;
+
+  // Keep the directory to at most c entries for T1+B1 and 2c overall
+  while (t1.size()+b1.Size()>c && b1.Size()>0) {
+    b1.PopBack();
+  }
+  while (t1.size()+t2.size()+b1.Size()+b2.Size()>2*c) {
+    if (b2.Size()>0) {
+      b2.PopBack();
+    } else if (b1.Size()>0) {
+      b1.PopBack();
+    } else {
+      break;
+    }
+  }
+}
+
+void ARCPolicy::Touch(const SIZE_T f, const double now)
+{
+  if (queue[f]==T1) {
+    t2.splice(t2.begin(),t1,pos[f]);
+    queue[f]=T2;
+  } else if (queue[f]==T2) {
+    t2.splice(t2.begin(),t2,pos[f]);
+  }
+}
+
+void ARCPolicy::Remove(const SIZE_T f)
+{
+  if (queue[f]==T1) {
+    t1.erase(pos[f]);
+    b1.PushFront(blocknum[f]);
+  } else if (queue[f]==T2) {
+    t2.erase(pos[f]);
+    b2.PushFront(blocknum[f]);
+  }
+  queue[f]=NONE;
+}
+
+SIZE_T ARCPolicy::OldestEvictable(const list<SIZE_T> &l, const EvictionCheck &check) const
+{
+  for (list<SIZE_T>::const_reverse_iterator i=l.rbegin(); i!=l.rend(); ++i) {
+    if (check.CanEvict(*i)) {
+      return *i;
+    }
+  }
+  return BUFFERCACHE_NOFRAME;
+}
+
+// This is REPLACE from the paper
+SIZE_T ARCPolicy::ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now)
+{
+  SIZE_T f;
+
+  Adapt(incoming);
+
+  if (!t1.empty() &&
+      ((double)t1.size()>p || (b2.Contains(incoming) && (double)t1.size()==p))) {
+    f=OldestEvictable(t1,check);
+    return f!=BUFFERCACHE_NOFRAME ? f : OldestEvictable(t2,check);
+  } else {
+    f=OldestEvictable(t2,check);
+    return f!=BUFFERCACHE_NOFRAME ? f : OldestEvictable(t1,check);
+  }
+}
+
+
+//
+// LRU-K
+//
+// The correlated reference period of the paper is not modeled;
+// every reference counts.
+//
+
+LRUKPolicy::LRUKPolicy(const SIZE_T kk) : k(kk>0 ? kk : 1), tick(0), numframes(0)
+{}
+
+void LRUKPolicy::Reset(const SIZE_T n)
+{
+  numframes=n;
+  tick=0;
+  blocknum.assign(n,0);
+  resident.assign(n,false);
+  history.clear();
+  retired.clear();
+  order.clear();
+}
+
+// Blocks with fewer than K references sort first (Kth time 0)
+LRUKPolicy::Key LRUKPolicy::MakeKey(const SIZE_T f) const
+{
+  const History &h=(*(history.find(blocknum[f]))).second;
+  SIZE_T kth = h.times.size()>=k ? h.times[k-1] : 0;
+
+  return Key(pair<SIZE_T, SIZE_T>(kth,h.times[0]),f);
+}
+
+void LRUKPolicy::Reference(const SIZE_T f)
+{
+  History &h=history[blocknum[f]];
+
+  h.times.insert(h.times.begin(),++tick);
+  if (h.times.size()>k) {
+    h.times.resize(k);
+  }
+}
+
+void LRUKPolicy::Insert(const SIZE_T f, const SIZE_T b, const double now)
+{
+  blocknum[f]=b;
+  resident[f]=true;
+  history[b].resident=true;
+  Reference(f);
+  order.insert(MakeKey(f));
+}
+
+void LRUKPolicy::Touch(const SIZE_T f, const double now)
+{
+  order.erase(MakeKey(f));
+  Reference(f);
+  order.insert(MakeKey(f));
+}
+
+void LRUKPolicy::Remove(const SIZE_T f)
+{
+  order.erase(MakeKey(f));
+  resident[f]=false;
+  history[blocknum[f]].resident=false;
+
+  // Remember about as many departed blocks as we have frames
+  retired.push_back(blocknum[f]);
+  while (retired.size()>numframes) {
+    unordered_map<SIZE_T, History>::iterator h=history.find(retired.front());
+    if (h!=history.end() && !(*h).second.resident) {
+      history.erase(h);
+    }
+    retired.pop_front();
+  }
+}
+
+SIZE_T LRUKPolicy::ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now)
+{
+  for (set<Key>::const_iterator i=order.begin(); i!=order.end(); ++i) {
+    if (check.CanEvict((*i).second)) {
+      return (*i).second;
+    }
+  }
+  return BUFFERCACHE_NOFRAME;
+}
@@ -0,0 +1,236 @@
+#ifndef _replacementpolicy
+#define _replacementpolicy
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <deque>
+#include <unordered_map>
+
+#include "global.h"
+
+using namespace std;
+
+enum ReplacementPolicyType {REPLACE_LRU, REPLACE_CLOCK, REPLACE_2Q, REPLACE_ARC, REPLACE_LRUK};
+
+// Marks "no frame" for policies and the buffer cache
+const SIZE_T BUFFERCACHE_NOFRAME=(SIZE_T)-1;
+
+//
+// The buffer cache tells the policy which frames it may not evict
+// (e.g., because they are pinned)
+//
+class EvictionCheck {
+ public:
+  virtual ~EvictionCheck() {}
+  virtual bool CanEvict(const SIZE_T frame) const = 0;
+};
+
+
+//
+// A replacement policy tracks which of the buffer cache's frames
+// should go next.  Frames are numbered 0..numframes-1.  The cache
+// calls
+//
+//   Insert      when a frame is filled with a block (a miss)
+//   Touch       when a resident frame is accessed (a hit)
+//   Remove      when a frame is emptied (eviction or flush)
+//   ChooseVictim when it needs a frame and has none free
+//
+// now is the current simulated time.  incoming is the block the
+// cache is making room for, which some policies use to adapt.
+// ChooseVictim does not remove the frame; the cache will call
+// Remove on it if it really evicts it.
+//
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  virtual const char *GetName() const = 0;
+
+  virtual void   Reset(const SIZE_T numframes) = 0;
+  virtual void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now) = 0;
+  virtual void   Touch(const SIZE_T frame, const double now) = 0;
+  virtual void   Remove(const SIZE_T frame) = 0;
+  // returns BUFFERCACHE_NOFRAME if nothing can be evicted
+  virtual SIZE_T ChooseVictim(const EvictionCheck &check,
+			      const SIZE_T incoming,
+			      const double now) = 0;
+};
+
+
+// Returns ERROR_BADCONFIG for an unknown name
+// Names are lru, clock, 2q, arc, and lruk (K=2)
+ERROR_T ParseReplacementPolicy(const string &name, ReplacementPolicyType &type);
+
+ReplacementPolicy *MakeReplacementPolicy(const ReplacementPolicyType type);
+
+
+//
+// Least recently used.  Everything touched at the same simulated
+// time counts as equally old, and ties go to the lowest block number.
+//
+class LRUPolicy : public ReplacementPolicy {
+ private:
+  vector<SIZE_T> prev;        // toward the most recently used end
+  vector<SIZE_T> next;        // toward the least recently used end
+  vector<SIZE_T> blocknum;
+  vector<double> lastaccessed;
+  SIZE_T mru, lru;
+  double lrusorted;           // lastaccessed of the ordered lru run
+  vector<pair<SIZE_T, SIZE_T> > run;  // scratch for ChooseVictim
+
+  void LinkAtMRU(const SIZE_T frame);
+  void LinkAtLRU(const SIZE_T frame);
+  void Unlink(const SIZE_T frame);
+ public:
+  LRUPolicy();
+  const char *GetName() const { return "LRU"; }
+  void   Reset(const SIZE_T numframes);
+  void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void   Touch(const SIZE_T frame, const double now);
+  void   Remove(const SIZE_T frame);
+  SIZE_T ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now);
+};
+
+
+//
+// CLOCK (second chance).  A hit sets the frame's reference bit;
+// the hand clears bits as it sweeps and takes the first frame
+// whose bit is already clear.
+//
+class ClockPolicy : public ReplacementPolicy {
+ private:
+  vector<bool> resident;
+  vector<bool> referenced;
+  SIZE_T       hand;
+ public:
+  ClockPolicy();
+  const char *GetName() const { return "CLOCK"; }
+  void   Reset(const SIZE_T numframes);
+  void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void   Touch(const SIZE_T frame, const double now);
+  void   Remove(const SIZE_T frame);
+  SIZE_T ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now);
+};
+
+
+//
+// A simple list of block numbers with O(1) removal by value, used
+// for the ghost (history only) lists of 2Q and ARC.  Front is newest.
+//
+class GhostList {
+ private:
+  list<SIZE_T> order;
+  unordered_map<SIZE_T, list<SIZE_T>::iterator> where;
+ public:
+  bool   Contains(const SIZE_T blocknum) const { return where.find(blocknum)!=where.end(); }
+  SIZE_T Size() const { return where.size(); }
+  void   PushFront(const SIZE_T blocknum);
+  void   Erase(const SIZE_T blocknum);
+  void   PopBack();
+  void   Clear();
+};
+
+
+//
+// 2Q (Johnson and Shasha).  New blocks go to a FIFO (A1in); blocks
+// that come back after falling out of it, as remembered by a ghost
+// FIFO (A1out), are promoted to an LRU (Am).  A one-time scan only
+// ever churns A1in, so it cannot flush the hot blocks out of Am.
+//
+class TwoQPolicy : public ReplacementPolicy {
+ private:
+  enum {NONE, A1IN, AM};
+  vector<int>                      queue;
+  vector<SIZE_T>                   blocknum;
+  vector<list<SIZE_T>::iterator>   pos;
+  list<SIZE_T>                     a1in;   // frames, front is newest
+  list<SIZE_T>                     am;     // frames, front is most recent
+  GhostList                        a1out;  // block numbers
+  SIZE_T                           kin, kout;
+
+  SIZE_T OldestEvictable(const list<SIZE_T> &l, const EvictionCheck &check) const;
+ public:
+  TwoQPolicy();
+  const char *GetName() const { return "2Q"; }
+  void   Reset(const SIZE_T numframes);
+  void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void   Touch(const SIZE_T frame, const double now);
+  void   Remove(const SIZE_T frame);
+  SIZE_T ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now);
+};
+
+
+//
+// ARC (Megiddo and Modha).  T1 holds blocks seen once recently and
+// T2 blocks seen at least twice; B1 and B2 remember what was evicted
+// from each.  A miss that hits in B1 or B2 moves the target size p
+// of T1 toward whichever list would have kept the block.
+//
+class ARCPolicy : public ReplacementPolicy {
+ private:
+  enum {NONE, T1, T2};
+  vector<int>                      queue;
+  vector<SIZE_T>                   blocknum;
+  vector<list<SIZE_T>::iterator>   pos;
+  list<SIZE_T>                     t1, t2;  // frames, front is most recent
+  GhostList                        b1, b2;  // block numbers
+  SIZE_T                           c;
+  double                           p;
+  SIZE_T                           adaptedfor;
+
+  void   Adapt(const SIZE_T blocknum);
+  SIZE_T OldestEvictable(const list<SIZE_T> &l, const EvictionCheck &check) const;
+ public:
+  ARCPolicy();
+  const char *GetName() const { return "ARC"; }
+  void   Reset(const SIZE_T numframes);
+  void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void   Touch(const SIZE_T frame, const double now);
+  void   Remove(const SIZE_T frame);
+  SIZE_T ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now);
+};
+
+
+//
+// LRU-K (O'Neil, O'Neil, and Weikum).  The victim is the block whose
+// Kth most recent reference is furthest in the past; blocks with
+// fewer than K references go first, oldest last reference first.
+// Reference history outlives residency for a while so that a block
+// that comes back is not treated as brand new.  Time here is a count
+// of references, not simulated time.
+//
+class LRUKPolicy : public ReplacementPolicy {
+ private:
+  struct History {
+    vector<SIZE_T> times;    // most recent first, at most K
+    bool           resident;
+  };
+  typedef pair<pair<SIZE_T, SIZE_T>, SIZE_T> Key;  // ((Kth time, last time), frame)
+
+  SIZE_T                              k;
+  SIZE_T                              tick;
+  vector<SIZE_T>                      blocknum;
+  vector<bool>                        resident;
+  unordered_map<SIZE_T, History>      history;
+  deque<SIZE_T>                       retired;    // non-resident histories, oldest first
+  set<Key>                            order;
+  SIZE_T                              numframes;
+
+  Key  MakeKey(const SIZE_T frame) const;
+  void Reference(const SIZE_T frame);
+ public:
+  LRUKPolicy(const SIZE_T k=2);
+  const char *GetName() const { return k==2 ? "LRU-2" : "LRU-K"; }
+  void   Reset(const SIZE_T numframes);
+  void   Insert(const SIZE_T frame, const SIZE_T blocknum, const double now);
+  void   Touch(const SIZE_T frame, const double now);
+  void   Remove(const SIZE_T frame);
+  SIZE_T ChooseVictim(const EvictionCheck &check, const SIZE_T incoming, const double now);
+};
+
+
+#endif
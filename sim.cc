@@ -4,14 +4,17 @@
 #include <string>
 #include <strstream>
 #include <fstream>
+#include <memory>
 #include "btree.h"
+#include "stripeddisk.h"
+#include "keysearch.h"
 
 
 using namespace std;
 
 void usage()
 {
-  cerr << "usage: sim filestem cachesize < specfile \n";
+  cerr << "usage: sim filestem cachesize [-policy lru|clock|2q|arc|lruk] [-writeback dirtyratio] [-stats jsonfile] [-io pread|mmap|direct] [-queue depth] [-aio auto|uring|threads] [-sched fcfs|sstf|scan|clook] [-search auto|scalar|sse2|avx2] < specfile \n";
 }
 
 
@@ -20,13 +23,69 @@ int main(int argc, char *argv[])
 
   // CONFORMS to the interface of ref_impl.pl
 
-  if (argc != 3){
+  if (argc < 3 || (argc-3)%2!=0){
     usage();
     return 1;
   }
 
   char *filestem=argv[1];
-  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T cachesize;
+  ReplacementPolicyType policy=REPLACE_LRU;
+  double dirtyratio=0;
+  char *statsfile=0;
+  DiskIOMode iomode=DISK_IO_PREAD;
+  SIZE_T queuedepth=DISKSYSTEM_QUEUEDEPTH;
+  AsyncIOType aiotype=ASYNCIO_AUTO;
+  DiskSchedType sched=DISK_SCHED_FCFS;
+
+  for (int i=3; i<argc; i+=2) { 
+    string opt=argv[i];
+    if (opt=="-policy") { 
+      if (ParseReplacementPolicy(argv[i+1],policy)!=ERROR_NOERROR) { 
+	cerr << "Unknown replacement policy "<<argv[i+1]<<"\n";
+	usage();
+	return 1;
+      }
+    } else if (opt=="-writeback") { 
+      dirtyratio=atof(argv[i+1]);
+    } else if (opt=="-stats") { 
+      statsfile=argv[i+1];
+    } else if (opt=="-io") { 
+      if (ParseDiskIOMode(argv[i+1],iomode)!=ERROR_NOERROR) { 
+	cerr << "Unknown I/O mode "<<argv[i+1]<<"\n";
+	usage();
+	return 1;
+      }
+    } else if (opt=="-queue") { 
+      queuedepth=atoi(argv[i+1]);
+    } else if (opt=="-aio") { 
+      if (ParseAsyncIOType(argv[i+1],aiotype)!=ERROR_NOERROR) { 
+	cerr << "Unknown asynchronous I/O engine "<<argv[i+1]<<"\n";
+	usage();
+	return 1;
+      }
+    } else if (opt=="-sched") { 
+      if (ParseDiskSchedType(argv[i+1],sched)!=ERROR_NOERROR) { 
+	cerr << "Unknown disk scheduler "<<argv[i+1]<<"\n";
+	usage();
+	return 1;
+      }
+    } else if (opt=="-search") { 
+      KeySearchType search;
+      if (ParseKeySearchType(argv[i+1],search)!=ERROR_NOERROR) { 
+	cerr << "Unknown key search "<<argv[i+1]<<"\n";
+	usage();
+	return 1;
+      }
+      if (SetKeySearch(search)!=ERROR_NOERROR) { 
+	cerr << "This CPU can't do the "<<argv[i+1]<<" key search\n";
+	return 1;
+      }
+    } else {
+      usage();
+      return 1;
+    }
+  }
   SIZE_T superblocknum;
 
   FILE *file; 
@@ -37,8 +96,31 @@ int main(int argc, char *argv[])
   // We'll connect to the btree only once and then
   // run lots of operations
   // so we need to do this outside the loop
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(filestem));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<filestem<<"\n";
+    return -1;
+  }
+  if ((rc=disk->SetIOMode(iomode))!=ERROR_NOERROR) { 
+    cerr << "Can't set disk I/O mode due to error "<<rc<<"\n";
+    return -1;
+  }
+  if ((rc=disk->SetQueueDepth(queuedepth,aiotype))!=ERROR_NOERROR) { 
+    cerr << "Can't set disk queue depth due to error "<<rc<<"\n";
+    return -1;
+  }
+  disk->SetScheduler(sched);
+  if (ParseCacheSize(argv[2],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
+  BufferCache cache(disk.get(),cachesize,policy);
+
+  if (cache.SetDirtyThreshold(dirtyratio)!=ERROR_NOERROR) { 
+    cerr << "Dirty ratio must be between 0 and 1\n";
+    usage();
+    return 1;
+  }
   // will be set on init
   BTreeIndex *btree;
 
@@ -116,6 +198,25 @@ int main(int argc, char *argv[])
     cerr << "\n";
     btree->SanityCheck();
     cerr << "\n";
+    cerr << "policy="<<cache.GetPolicyName()
+	 << " hitratio="<<cache.GetHitRatio()
+	 << " writebacks="<<cache.GetNumWriteBacks()
+	 << " flushsaved="<<cache.GetFlushTimeSaved()
+	 << " queue="<<disk->GetQueueDepth()<<"("<<disk->GetAsyncEngineName()<<")"
+	 << " sched="<<DiskSchedName(disk->GetScheduler())
+	 << " seek="<<disk->GetSchedStats().seektime
+	 << " rotation="<<disk->GetSchedStats().rotationtime;
+    if (disk->GetDeviceModel()==DISK_DEVICE_SSD) { 
+      const DiskSchedStats &d=disk->GetSchedStats();
+      cerr << " gc="<<d.gctime
+	   << " wa="<<(d.hostpages>0 ? (double)d.flashpages/d.hostpages : 1.0);
+    }
+    cerr << " time="<<cache.GetCurrentTime()<<"\n";
+    if (statsfile) { 
+      WriteStatsJSON(cache,"sim",statsfile);
+    } else {
+      DumpStatsJSON(cache,"sim");
+    }
 	  delete btree;
 	  cout << "OK\n";
 	}
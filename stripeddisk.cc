@@ -0,0 +1,868 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "stripeddisk.h"
+
+
+// As many whole stripes as every member has room for
+static SIZE_T StripedBlocks(const vector<DiskSystem *> &members, const SIZE_T stripeunit)
+{
+  SIZE_T rows=0;
+
+  if (stripeunit==0) {
+    return 0;
+  }
+  for (SIZE_T i=0; i<members.size(); i++) {
+    SIZE_T r=members[i]->GetNumBlocks()/stripeunit;
+    if (i==0 || r<rows) {
+      rows=r;
+    }
+  }
+  return rows*stripeunit*members.size();
+}
+
+
+StripedDiskSystem::StripedDiskSystem(const string &filestem,
+				     const vector<DiskSystem *> &ms,
+				     const SIZE_T unit,
+				     const bool create) :
+  DiskSystem(filestem,
+	     StripedBlocks(ms,unit),
+	     ms.empty() ? 0 : ms[0]->GetBlockSize()),
+  stripefilestem(filestem),
+  members(ms),
+  stripeunit(unit),
+  nextticket(0)
+{
+  OpenBitMap(create);
+}
+
+StripedDiskSystem::~StripedDiskSystem()
+{
+  for (map<SIZE_T, vector<pair<SIZE_T, SIZE_T> > >::iterator s=submitted.begin(); s!=submitted.end(); ++s) {
+    CompletePieces((*s).second);
+  }
+  for (SIZE_T i=0; i<members.size(); i++) {
+    delete members[i];
+  }
+}
+
+
+//
+// Cut a request at the stripe unit boundaries.  Pieces that are next
+// to each other on the same member, as with a single member, stay
+// together.
+//
+void StripedDiskSystem::Split(const SIZE_T off, const SIZE_T num, vector<StripePiece> &pieces) const
+{
+  SIZE_T k=members.size();
+
+  pieces.clear();
+  for (SIZE_T b=off; b<off+num; ) {
+    SIZE_T stripe=b/stripeunit;
+    SIZE_T within=b%stripeunit;
+    SIZE_T n = off+num-b < stripeunit-within ? off+num-b : stripeunit-within;
+    StripePiece p;
+
+    p.member=stripe%k;
+    p.memberoff=(stripe/k)*stripeunit+within;
+    p.logicaloff=b;
+    p.num=n;
+    if (!pieces.empty() &&
+	pieces.back().member==p.member &&
+	pieces.back().memberoff+pieces.back().num==p.memberoff &&
+	pieces.back().logicaloff+pieces.back().num==p.logicaloff) {
+      pieces.back().num+=n;
+    } else {
+      pieces.push_back(p);
+    }
+    b+=n;
+  }
+}
+
+SIZE_T StripedDiskSystem::ToLogical(const SIZE_T member, const SIZE_T memberoff) const
+{
+  SIZE_T row=memberoff/stripeunit;
+
+  return (row*members.size()+member)*stripeunit + memberoff%stripeunit;
+}
+
+
+ERROR_T StripedDiskSystem::SubmitPieces(const bool write,
+					const vector<StripePiece> &pieces,
+					BYTE_T *const *bufs,
+					const double now,
+					vector<pair<SIZE_T, SIZE_T> > &subs,
+					double &admit)
+{
+  admit=now;
+  subs.clear();
+
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    DiskSystem *m=members[pieces[i].member];
+    SIZE_T ticket;
+    double a;
+    ERROR_T rc = write ?
+      m->SubmitWrite(pieces[i].memberoff,pieces[i].num,bufs[i],now,ticket,a) :
+      m->SubmitRead(pieces[i].memberoff,pieces[i].num,bufs[i],now,ticket,a);
+
+    if (rc!=ERROR_NOERROR) {
+      CompletePieces(subs);
+      subs.clear();
+      return rc;
+    }
+    subs.push_back(pair<SIZE_T, SIZE_T>(pieces[i].member,ticket));
+    if (a>admit) {
+      admit=a;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// The pieces are done when the last one is.  reqtime runs from when
+// the first one started, so that the time before that counts as
+// waiting in the queue.
+//
+ERROR_T StripedDiskSystem::DoneTime(const vector<pair<SIZE_T, SIZE_T> > &subs,
+				    double &reqtime,
+				    double &donetime)
+{
+  double start=HUGE_VAL;
+  double done=-HUGE_VAL;
+
+  for (SIZE_T i=0; i<subs.size(); i++) {
+    double t, d;
+    ERROR_T rc=members[subs[i].first]->GetDoneTime(subs[i].second,t,d);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    if (d-t<start) {
+      start=d-t;
+    }
+    if (d>done) {
+      done=d;
+    }
+  }
+  if (!subs.empty()) {
+    reqtime=done-start;
+    donetime=done;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::CompletePieces(const vector<pair<SIZE_T, SIZE_T> > &subs)
+{
+  ERROR_T first=ERROR_NOERROR;
+
+  for (SIZE_T i=0; i<subs.size(); i++) {
+    ERROR_T rc=members[subs[i].first]->Complete(subs[i].second);
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) {
+      first=rc;
+    }
+  }
+  return first;
+}
+
+
+//
+// Requests the caller waits for right away.  Each member serves its
+// pieces one after another, and the members all at once, so the
+// time is that of the busiest member.
+//
+ERROR_T StripedDiskSystem::Read(const SIZE_T   inoffblock,
+				const SIZE_T   numblock,
+				BYTE_T        *buf,
+				double        &reqtime)
+{
+  vector<StripePiece> pieces;
+  vector<double> busy(members.size(),0);
+
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedDiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  Split(inoffblock,numblock,pieces);
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    double t;
+    ERROR_T rc=members[pieces[i].member]->Read(pieces[i].memberoff,
+					       pieces[i].num,
+					       buf+(size_t)(pieces[i].logicaloff-inoffblock)*GetBlockSize(),
+					       t);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    busy[pieces[i].member]+=t;
+    if (busy[pieces[i].member]>reqtime) {
+      reqtime=busy[pieces[i].member];
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::Write(const SIZE_T   inoffblock,
+				 const SIZE_T   numblock,
+				 const BYTE_T  *buf,
+				 double        &reqtime)
+{
+  vector<StripePiece> pieces;
+  vector<double> busy(members.size(),0);
+
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedDiskSystem::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  Split(inoffblock,numblock,pieces);
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    double t;
+    ERROR_T rc=members[pieces[i].member]->Write(pieces[i].memberoff,
+						pieces[i].num,
+						buf+(size_t)(pieces[i].logicaloff-inoffblock)*GetBlockSize(),
+						t);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    busy[pieces[i].member]+=t;
+    if (busy[pieces[i].member]>reqtime) {
+      reqtime=busy[pieces[i].member];
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+// The Block versions go through one buffer; only the tools use them
+ERROR_T StripedDiskSystem::Read(const SIZE_T   inoffblock,
+				const SIZE_T   numblock,
+				vector<Block> &blocks,
+				double        &reqtime)
+{
+  SIZE_T blocksize=GetBlockSize();
+  vector<BYTE_T> buf((size_t)numblock*blocksize);
+
+  reqtime=0;
+  if (numblock==0) {
+    return ERROR_NOERROR;
+  }
+
+  ERROR_T rc=Read(inoffblock,numblock,&(buf[0]),reqtime);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  SIZE_T first=blocks.size();
+
+  blocks.resize(first+numblock);
+  for (SIZE_T i=0; i<numblock; i++) {
+    if (blocks[first+i].Resize(blocksize,false)!=ERROR_NOERROR) {
+      blocks.resize(first);
+      return ERROR_NOMEM;
+    }
+    memcpy(blocks[first+i].data,&(buf[(size_t)i*blocksize]),blocksize);
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::Write(const SIZE_T   inoffblock,
+				 const SIZE_T   numblock,
+				 const vector<Block> &blocks,
+				 double        &reqtime)
+{
+  SIZE_T blocksize=GetBlockSize();
+  vector<BYTE_T> buf((size_t)numblock*blocksize);
+
+  reqtime=0;
+  if (numblock==0) {
+    return ERROR_NOERROR;
+  }
+  for (SIZE_T i=0; i<numblock; i++) {
+    if (blocks[i].length<blocksize) {
+      return ERROR_WRONGSIZEBLOCK;
+    }
+    memcpy(&(buf[(size_t)i*blocksize]),blocks[i].data,blocksize);
+  }
+  return Write(inoffblock,numblock,&(buf[0]),reqtime);
+}
+
+
+ERROR_T StripedDiskSystem::SubmitRead(const SIZE_T inoffblock,
+				      const SIZE_T numblock,
+				      BYTE_T *buf,
+				      const double now,
+				      SIZE_T &ticket,
+				      double &admit)
+{
+  vector<StripePiece> pieces;
+  vector<BYTE_T *> bufs;
+  vector<pair<SIZE_T, SIZE_T> > subs;
+
+  admit=now;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedDiskSystem::SubmitRead: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  Split(inoffblock,numblock,pieces);
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    bufs.push_back(buf+(size_t)(pieces[i].logicaloff-inoffblock)*GetBlockSize());
+  }
+
+  ERROR_T rc=SubmitPieces(false,pieces,bufs.empty() ? 0 : &(bufs[0]),now,subs,admit);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  ticket=nextticket++;
+  submitted[ticket]=subs;
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::SubmitWrite(const SIZE_T inoffblock,
+				       const SIZE_T numblock,
+				       const BYTE_T *buf,
+				       const double now,
+				       SIZE_T &ticket,
+				       double &admit)
+{
+  vector<StripePiece> pieces;
+  vector<BYTE_T *> bufs;
+  vector<pair<SIZE_T, SIZE_T> > subs;
+
+  admit=now;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedDiskSystem::SubmitWrite: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  Split(inoffblock,numblock,pieces);
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    // SubmitPieces only reads from them when writing
+    bufs.push_back((BYTE_T*)buf+(size_t)(pieces[i].logicaloff-inoffblock)*GetBlockSize());
+  }
+
+  ERROR_T rc=SubmitPieces(true,pieces,bufs.empty() ? 0 : &(bufs[0]),now,subs,admit);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  ticket=nextticket++;
+  submitted[ticket]=subs;
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::GetDoneTime(const SIZE_T ticket, double &reqtime, double &donetime)
+{
+  map<SIZE_T, vector<pair<SIZE_T, SIZE_T> > >::iterator s=submitted.find(ticket);
+
+  if (s==submitted.end()) {
+    return ERROR_NONEXISTENT;
+  }
+  reqtime=0;
+  donetime=0;
+  return DoneTime((*s).second,reqtime,donetime);
+}
+
+ERROR_T StripedDiskSystem::Complete(const SIZE_T ticket)
+{
+  map<SIZE_T, vector<pair<SIZE_T, SIZE_T> > >::iterator s=submitted.find(ticket);
+
+  if (s==submitted.end()) {
+    return ERROR_NONEXISTENT;
+  }
+
+  ERROR_T rc=CompletePieces((*s).second);
+
+  submitted.erase(s);
+  return rc;
+}
+
+
+//
+// When a queued read spans members, the pieces whose buffers are
+// next to each other are submitted, so that the members move their
+// data at once on the host as well.  The rest are read in place.
+//
+ERROR_T StripedDiskSystem::ReadQueued(const SIZE_T inoffblock,
+				      const SIZE_T numblock,
+				      BYTE_T *const *bufs,
+				      const double now,
+				      double &reqtime,
+				      double &donetime)
+{
+  vector<StripePiece> pieces, inplace, together;
+  vector<BYTE_T *> togetherbufs;
+  vector<pair<SIZE_T, SIZE_T> > subs;
+  SIZE_T blocksize=GetBlockSize();
+  double start=HUGE_VAL;
+  double admit;
+
+  reqtime=0;
+  donetime=now;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedDiskSystem::ReadQueued: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  Split(inoffblock,numblock,pieces);
+  for (SIZE_T i=0; i<pieces.size(); i++) {
+    BYTE_T *const *b=bufs+(pieces[i].logicaloff-inoffblock);
+    bool contiguous = pieces.size()>1;
+
+    for (SIZE_T j=1; contiguous && j<pieces[i].num; j++) {
+      contiguous = b[j]==b[0]+(size_t)j*blocksize;
+    }
+    if (contiguous) {
+      together.push_back(pieces[i]);
+      togetherbufs.push_back(b[0]);
+    } else {
+      inplace.push_back(pieces[i]);
+    }
+  }
+
+  ERROR_T rc=SubmitPieces(false,together,togetherbufs.empty() ? 0 : &(togetherbufs[0]),now,subs,admit);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  ERROR_T first=ERROR_NOERROR;
+
+  for (SIZE_T i=0; i<inplace.size(); i++) {
+    double t, d;
+
+    rc=members[inplace[i].member]->ReadQueued(inplace[i].memberoff,
+					      inplace[i].num,
+					      bufs+(inplace[i].logicaloff-inoffblock),
+					      now,
+					      t,
+					      d);
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) {
+      first=rc;
+    }
+    if (d-t<start) {
+      start=d-t;
+    }
+    if (d>donetime) {
+      donetime=d;
+    }
+  }
+  if (!subs.empty()) {
+    double t, d;
+
+    rc=DoneTime(subs,t,d);
+    if (rc==ERROR_NOERROR) {
+      if (d-t<start) {
+	start=d-t;
+      }
+      if (d>donetime) {
+	donetime=d;
+      }
+    } else if (first==ERROR_NOERROR) {
+      first=rc;
+    }
+    rc=CompletePieces(subs);
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) {
+      first=rc;
+    }
+  }
+  if (start<donetime) {
+    reqtime=donetime-start;
+  }
+  return first;
+}
+
+//
+// A batch that stays on one member is that member's batch.  One that
+// doesn't is submitted piece by piece, which queues every piece
+// before any is waited for, as the members' own WriteQueued does.
+//
+ERROR_T StripedDiskSystem::WriteQueued(const vector<pair<SIZE_T, SIZE_T> > &runs,
+				       const BYTE_T *buf,
+				       const double now,
+				       double &reqtime,
+				       double &donetime)
+{
+  vector<StripePiece> pieces, runpieces;
+  vector<BYTE_T *> bufs;
+  vector<pair<SIZE_T, SIZE_T> > memberruns, subs;
+  SIZE_T blocksize=GetBlockSize();
+  size_t at=0;
+  bool onemember=true;
+  double admit;
+
+  reqtime=0;
+  donetime=now;
+
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=runs.begin(); r!=runs.end(); ++r) {
+    if ((*r).first+(*r).second > GetNumBlocks()) {
+      cerr << "StripedDiskSystem::WriteQueued: Attempt to write blocks "<<(*r).first<<" to "<<((*r).first+(*r).second-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+      return ERROR_NOSPACE;
+    }
+    Split((*r).first,(*r).second,runpieces);
+    for (SIZE_T i=0; i<runpieces.size(); i++) {
+      // SubmitPieces only reads from them when writing
+      bufs.push_back((BYTE_T*)buf+at+(size_t)(runpieces[i].logicaloff-(*r).first)*blocksize);
+      memberruns.push_back(pair<SIZE_T, SIZE_T>(runpieces[i].memberoff,runpieces[i].num));
+      onemember = onemember && runpieces[i].member==(pieces.empty() ? runpieces[i].member : pieces[0].member);
+      pieces.push_back(runpieces[i]);
+    }
+    at+=(size_t)(*r).second*blocksize;
+  }
+  if (pieces.empty()) {
+    return ERROR_NOERROR;
+  }
+  if (onemember) {
+    // The data is already in the member's order
+    return members[pieces[0].member]->WriteQueued(memberruns,buf,now,reqtime,donetime);
+  }
+
+  ERROR_T rc=SubmitPieces(true,pieces,&(bufs[0]),now,subs,admit);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  ERROR_T first=DoneTime(subs,reqtime,donetime);
+
+  rc=CompletePieces(subs);
+  return first!=ERROR_NOERROR ? first : rc;
+}
+
+
+ERROR_T StripedDiskSystem::SetQueueDepth(const SIZE_T depth, const AsyncIOType type)
+{
+  for (SIZE_T i=0; i<members.size(); i++) {
+    ERROR_T rc=members[i]->SetQueueDepth(depth,type);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+SIZE_T StripedDiskSystem::GetQueueDepth() const
+{
+  return members[0]->GetQueueDepth();
+}
+
+const char *StripedDiskSystem::GetAsyncEngineName() const
+{
+  return members[0]->GetAsyncEngineName();
+}
+
+void StripedDiskSystem::RestartQueueModel()
+{
+  for (SIZE_T i=0; i<members.size(); i++) {
+    members[i]->RestartQueueModel();
+  }
+}
+
+double StripedDiskSystem::GetIdleTime()
+{
+  double idle=0;
+
+  for (SIZE_T i=0; i<members.size(); i++) {
+    double t=members[i]->GetIdleTime();
+    if (t>idle) {
+      idle=t;
+    }
+  }
+  return idle;
+}
+
+void StripedDiskSystem::SetScheduler(const DiskSchedType type)
+{
+  DiskSystem::SetScheduler(type);
+  for (SIZE_T i=0; i<members.size(); i++) {
+    members[i]->SetScheduler(type);
+  }
+}
+
+const DiskSchedStats &StripedDiskSystem::GetSchedStats() const
+{
+  totalstats.requests=0;
+  totalstats.seektime=0;
+  totalstats.rotationtime=0;
+  totalstats.transfertime=0;
+  totalstats.queuetime=0;
+  totalstats.celltime=0;
+  totalstats.gctime=0;
+  totalstats.hostpages=0;
+  totalstats.flashpages=0;
+  totalstats.erases=0;
+  for (SIZE_T i=0; i<members.size(); i++) {
+    const DiskSchedStats &s=members[i]->GetSchedStats();
+    totalstats.requests+=s.requests;
+    totalstats.seektime+=s.seektime;
+    totalstats.rotationtime+=s.rotationtime;
+    totalstats.transfertime+=s.transfertime;
+    totalstats.queuetime+=s.queuetime;
+    totalstats.celltime+=s.celltime;
+    totalstats.gctime+=s.gctime;
+    totalstats.hostpages+=s.hostpages;
+    totalstats.flashpages+=s.flashpages;
+    totalstats.erases+=s.erases;
+  }
+  return totalstats;
+}
+
+void StripedDiskSystem::ResetSchedStats()
+{
+  for (SIZE_T i=0; i<members.size(); i++) {
+    members[i]->ResetSchedStats();
+  }
+}
+
+// All of the members switch, or none of them do
+ERROR_T StripedDiskSystem::SetIOMode(const DiskIOMode mode)
+{
+  vector<DiskIOMode> old;
+
+  for (SIZE_T i=0; i<members.size(); i++) {
+    old.push_back(members[i]->GetIOMode());
+    ERROR_T rc=members[i]->SetIOMode(mode);
+    if (rc!=ERROR_NOERROR) {
+      for (SIZE_T j=0; j<i; j++) {
+	members[j]->SetIOMode(old[j]);
+      }
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+DiskIOMode StripedDiskSystem::GetIOMode() const
+{
+  return members[0]->GetIOMode();
+}
+
+SIZE_T StripedDiskSystem::GetDirectAlignment() const
+{
+  SIZE_T align=1;
+
+  for (SIZE_T i=0; i<members.size(); i++) {
+    if (members[i]->GetDirectAlignment()>align) {
+      align=members[i]->GetDirectAlignment();
+    }
+  }
+  return align;
+}
+
+ERROR_T StripedDiskSystem::SetDataLayout(const DiskDataLayout layout)
+{
+  for (SIZE_T i=0; i<members.size(); i++) {
+    ERROR_T rc=members[i]->SetDataLayout(layout);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+DiskDataLayout StripedDiskSystem::GetDataLayout() const
+{
+  return members[0]->GetDataLayout();
+}
+
+ERROR_T StripedDiskSystem::Sync()
+{
+  ERROR_T first=ERROR_NOERROR;
+
+  for (SIZE_T i=0; i<members.size(); i++) {
+    ERROR_T rc=members[i]->Sync();
+    if (rc!=ERROR_NOERROR && first==ERROR_NOERROR) {
+      first=rc;
+    }
+  }
+  return first;
+}
+
+ERROR_T StripedDiskSystem::SetDeviceModel(const DiskDeviceType type, const FlashGeometry &flash)
+{
+  if (type==DISK_DEVICE_SSD && FlashModel::Check(flash)!=ERROR_NOERROR) {
+    return ERROR_BADCONFIG;
+  }
+  for (SIZE_T i=0; i<members.size(); i++) {
+    members[i]->SetDeviceModel(type,flash);
+  }
+  return ERROR_NOERROR;
+}
+
+DiskDeviceType StripedDiskSystem::GetDeviceModel() const
+{
+  return members[0]->GetDeviceModel();
+}
+
+SIZE_T StripedDiskSystem::GetHeadPosition() const
+{
+  SIZE_T head=ToLogical(0,members[0]->GetHeadPosition());
+
+  return head<GetNumBlocks() ? head : 0;
+}
+
+SIZE_T StripedDiskSystem::GetBlocksPerCylinder() const
+{
+  return stripeunit;
+}
+
+double StripedDiskSystem::EstimateAccessTime(const vector<pair<SIZE_T, SIZE_T> > &requests,
+					      const bool write) const
+{
+  vector<vector<pair<SIZE_T, SIZE_T> > > permember(members.size());
+  vector<StripePiece> pieces;
+  double longest=0;
+
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator r=requests.begin(); r!=requests.end(); ++r) {
+    Split((*r).first,(*r).second,pieces);
+    for (SIZE_T i=0; i<pieces.size(); i++) {
+      permember[pieces[i].member].push_back(pair<SIZE_T, SIZE_T>(pieces[i].memberoff,pieces[i].num));
+    }
+  }
+  for (SIZE_T i=0; i<members.size(); i++) {
+    double t=members[i]->EstimateAccessTime(permember[i],write);
+    if (t>longest) {
+      longest=t;
+    }
+  }
+  return longest;
+}
+
+
+ostream & StripedDiskSystem::Print(ostream &os) const
+{
+  os << "StripedDiskSystem(diskfilestem="<<stripefilestem
+     << ", numblocks="<<GetNumBlocks()
+     << ", blocksize="<<GetBlockSize()
+     << ", stripeunit="<<stripeunit
+     << ", freeblocks="<<GetNumFreeBlocks()
+     << ", members=";
+  for (SIZE_T i=0; i<members.size(); i++) {
+    os << (i>0 ? ", " : "") << *(members[i]);
+  }
+  os << ")";
+  return os;
+}
+
+
+//
+// filestem.stripe looks like the disk config files: the stripe unit
+// and then one member filestem per line
+//
+static ERROR_T ReadStripeConfig(const string &filestem, SIZE_T &stripeunit, vector<string> &memberstems)
+{
+  FILE *f=fopen((filestem+".stripe").c_str(),"r");
+  char buf[1024];
+  bool gotunit=false;
+
+  if (!f) {
+    return ERROR_NOFILE;
+  }
+  memberstems.clear();
+  while (fgets(buf,sizeof(buf),f)) {
+    if (buf[0]=='#' || buf[0]=='\n') {
+      continue;
+    }
+    if (buf[strlen(buf)-1]=='\n') {
+      buf[strlen(buf)-1]=0;
+    }
+    if (!gotunit) {
+      sscanf(buf,"%u",&stripeunit);
+      gotunit=true;
+    } else {
+      memberstems.push_back(buf);
+    }
+  }
+  fclose(f);
+  return gotunit ? ERROR_NOERROR : ERROR_BADCONFIG;
+}
+
+static ERROR_T OpenMembers(const vector<string> &memberstems, const SIZE_T stripeunit, vector<DiskSystem *> &members)
+{
+  members.clear();
+  if (memberstems.empty() || stripeunit==0) {
+    return ERROR_BADCONFIG;
+  }
+  for (SIZE_T i=0; i<memberstems.size(); i++) {
+    members.push_back(new DiskSystem(memberstems[i]));
+    if (members[i]->GetNumBlocks()<stripeunit ||
+	members[i]->GetBlockSize()!=members[0]->GetBlockSize()) {
+      cerr << "Can't stripe across "<<memberstems[i]<<".\n";
+      for (SIZE_T j=0; j<=i; j++) {
+	delete members[j];
+      }
+      members.clear();
+      return ERROR_BADCONFIG;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T MakeStripedDisk(const string &filestem,
+			const SIZE_T stripeunit,
+			const vector<string> &memberstems)
+{
+  struct stat s;
+  vector<DiskSystem *> members;
+
+  if (stat((filestem+".stripe").c_str(),&s)!=-1 ||
+      stat((filestem+".bitmap").c_str(),&s)!=-1) {
+    cerr << "Configuration or bitmap files exist for this name!\n";
+    return ERROR_BADCONFIG;
+  }
+
+  ERROR_T rc=OpenMembers(memberstems,stripeunit,members);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  FILE *f=fopen((filestem+".stripe").c_str(),"w");
+
+  if (!f) {
+    for (SIZE_T i=0; i<members.size(); i++) {
+      delete members[i];
+    }
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"# disksystem stripe config version 0.9\n");
+  fprintf(f,"# stripeunit\n");
+  fprintf(f,"%u\n",stripeunit);
+  fprintf(f,"# members\n");
+  for (SIZE_T i=0; i<memberstems.size(); i++) {
+    fprintf(f,"%s\n",memberstems[i].c_str());
+  }
+  fclose(f);
+
+  // This writes out the empty bitmap
+  delete new StripedDiskSystem(filestem,members,stripeunit,true);
+  return ERROR_NOERROR;
+}
+
+DiskSystem *OpenDiskSystem(const string &filestem)
+{
+  struct stat s;
+  SIZE_T stripeunit=0;
+  vector<string> memberstems;
+  vector<DiskSystem *> members;
+
+  if (stat((filestem+".stripe").c_str(),&s)==-1) {
+    return new DiskSystem(filestem);
+  }
+  if (ReadStripeConfig(filestem,stripeunit,memberstems)!=ERROR_NOERROR ||
+      OpenMembers(memberstems,stripeunit,members)!=ERROR_NOERROR) {
+    return 0;
+  }
+  return new StripedDiskSystem(filestem,members,stripeunit);
+}
@@ -0,0 +1,167 @@
+#ifndef _stripeddisk
+#define _stripeddisk
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A disk striped across several member disks, RAID-0 style.  The
+// logical blocks go stripeunit at a time to each member in turn, so
+// logical block b is on member (b/stripeunit)%K.  Each member is an
+// ordinary DiskSystem with its own geometry, head position, queue,
+// and data file, so requests that land on different members are
+// served at the same time in the simulated clock, and submitted ones
+// move their data at the same time on the host too.
+//
+// The stripe set has its own allocation bitmap (filestem.bitmap).
+// filestem.stripe records the stripe unit and the members'
+// filestems.  The members' own bitmaps are not used.
+//
+class StripedDiskSystem : public DiskSystem {
+ private:
+  string stripefilestem;
+  vector<DiskSystem *> members;
+  SIZE_T stripeunit;
+
+  // The part of a request that one member serves: num blocks of the
+  // member starting at memberoff, which are logical blocks starting
+  // at logicaloff
+  struct StripePiece {
+    SIZE_T member;
+    SIZE_T memberoff;
+    SIZE_T logicaloff;
+    SIZE_T num;
+  };
+  // A submitted request is one per piece: (member, member's ticket)
+  map<SIZE_T, vector<pair<SIZE_T, SIZE_T> > > submitted;
+  SIZE_T nextticket;
+  mutable DiskSchedStats totalstats;
+
+  void    Split(const SIZE_T off, const SIZE_T num, vector<StripePiece> &pieces) const;
+  SIZE_T  ToLogical(const SIZE_T member, const SIZE_T memberoff) const;
+  ERROR_T SubmitPieces(const bool write,
+		       const vector<StripePiece> &pieces,
+		       BYTE_T *const *bufs,
+		       const double now,
+		       vector<pair<SIZE_T, SIZE_T> > &subs,
+		       double &admit);
+  ERROR_T DoneTime(const vector<pair<SIZE_T, SIZE_T> > &subs,
+		   double &reqtime,
+		   double &donetime);
+  ERROR_T CompletePieces(const vector<pair<SIZE_T, SIZE_T> > &subs);
+
+ public:
+  // Takes over the members, which must all have the same blocksize.
+  // create makes an empty bitmap rather than reading it.
+  StripedDiskSystem(const string &filestem,
+		    const vector<DiskSystem *> &members,
+		    const SIZE_T stripeunit,
+		    const bool create=false);
+  virtual ~StripedDiskSystem();
+
+  SIZE_T GetNumMembers() const { return members.size(); }
+  SIZE_T GetStripeUnit() const { return stripeunit; }
+
+  using DiskSystem::Read;
+  using DiskSystem::Write;
+  using DiskSystem::ReadQueued;
+
+  virtual ERROR_T Read(const SIZE_T inoffblock,
+		       const SIZE_T numblock,
+		       vector<Block> &blocks,
+		       double &reqtime);
+  virtual ERROR_T Write(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			const vector<Block> &blocks,
+			double &reqtime);
+  virtual ERROR_T Read(const SIZE_T inoffblock,
+		       const SIZE_T numblock,
+		       BYTE_T *buf,
+		       double &reqtime);
+  virtual ERROR_T Write(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			const BYTE_T *buf,
+			double &reqtime);
+
+  virtual ERROR_T SubmitRead(const SIZE_T inoffblock,
+			     const SIZE_T numblock,
+			     BYTE_T *buf,
+			     const double now,
+			     SIZE_T &ticket,
+			     double &admit);
+  virtual ERROR_T SubmitWrite(const SIZE_T inoffblock,
+			      const SIZE_T numblock,
+			      const BYTE_T *buf,
+			      const double now,
+			      SIZE_T &ticket,
+			      double &admit);
+  virtual ERROR_T GetDoneTime(const SIZE_T ticket, double &reqtime, double &donetime);
+  virtual ERROR_T Complete(const SIZE_T ticket);
+
+  virtual ERROR_T ReadQueued(const SIZE_T inoffblock,
+			     const SIZE_T numblock,
+			     BYTE_T *const *bufs,
+			     const double now,
+			     double &reqtime,
+			     double &donetime);
+  virtual ERROR_T WriteQueued(const vector<pair<SIZE_T, SIZE_T> > &runs,
+			      const BYTE_T *buf,
+			      const double now,
+			      double &reqtime,
+			      double &donetime);
+
+  virtual ERROR_T SetQueueDepth(const SIZE_T depth, const AsyncIOType type=ASYNCIO_AUTO);
+  virtual SIZE_T  GetQueueDepth() const;
+  virtual const char *GetAsyncEngineName() const;
+  virtual void    RestartQueueModel();
+  virtual double  GetIdleTime();
+
+  virtual void    SetScheduler(const DiskSchedType type);
+  // Summed over the members
+  virtual const DiskSchedStats &GetSchedStats() const;
+  virtual void    ResetSchedStats();
+
+  virtual ERROR_T SetIOMode(const DiskIOMode mode);
+  virtual DiskIOMode GetIOMode() const;
+  virtual SIZE_T  GetDirectAlignment() const;
+  virtual ERROR_T SetDataLayout(const DiskDataLayout layout);
+  virtual DiskDataLayout GetDataLayout() const;
+  virtual ERROR_T Sync();
+  virtual ERROR_T SetDeviceModel(const DiskDeviceType type,
+				 const FlashGeometry &flash=FlashGeometry());
+  virtual DiskDeviceType GetDeviceModel() const;
+
+  // Where member 0's head is, as a logical block
+  virtual SIZE_T GetHeadPosition() const;
+  // The stripe unit, since a run crossing it goes to two members
+  virtual SIZE_T GetBlocksPerCylinder() const;
+  // The members work at the same time, so this is the longest any
+  // of them would take for its share
+  virtual double EstimateAccessTime(const vector<pair<SIZE_T, SIZE_T> > &requests,
+				    const bool write=false) const;
+
+  virtual ostream & Print(ostream &os) const;
+};
+
+//
+// Make filestem into a stripe set of the existing disks memberstems,
+// with a fresh bitmap.  ERROR_BADCONFIG if there are no members, the
+// stripe unit is zero, or a member can't be opened or has a different
+// blocksize.
+//
+ERROR_T MakeStripedDisk(const string &filestem,
+			const SIZE_T stripeunit,
+			const vector<string> &memberstems);
+
+//
+// Open filestem as a stripe set if there is a filestem.stripe, and as
+// an ordinary disk otherwise.  Returns 0 if the stripe set is bad.
+//
+DiskSystem *OpenDiskSystem(const string &filestem);
+
+#endif
@@ -0,0 +1,122 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "disksystem.h"
+
+
+void usage()
+{
+  cerr << "usage: touchbench filestem numblocks blocksize\n";
+}
+
+static double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+//
+// Touch every block once, in a random order, reading or writing
+//
+static ERROR_T touch(DiskSystem &disk, const vector<SIZE_T> &order, const bool write)
+{
+  Block block(disk.GetBlockSize());
+  double reqtime;
+
+  for (SIZE_T i=0;i<order.size();i++) {
+    ERROR_T rc = write ? disk.Write(order[i],block,reqtime) : disk.Read(order[i],block,reqtime);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Make a fresh disk for each data layout and time first reads of
+// blocks that have never been written, first writes, and reads of
+// what was written.  The disks are deleted afterwards.
+//
+int main(int argc, char *argv[])
+{
+  if (argc<4) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T numblocks=atoi(argv[2]);
+  SIZE_T blocksize=atoi(argv[3]);
+  DiskDataLayout layouts[]={DISK_DATA_GROW, DISK_DATA_PREALLOC, DISK_DATA_SPARSE};
+
+  if (numblocks==0 || blocksize==0) {
+    usage();
+    exit(-1);
+  }
+
+  vector<SIZE_T> order(numblocks);
+  for (SIZE_T i=0;i<numblocks;i++) {
+    order[i]=i;
+  }
+  srand(numblocks);
+  random_shuffle(order.begin(),order.end());
+
+  cerr << "numblocks="<<numblocks<<" blocksize="<<blocksize<<endl;
+
+  for (SIZE_T l=0;l<sizeof(layouts)/sizeof(layouts[0]);l++) {
+    string stem=string(argv[1])+"-"+DiskDataLayoutName(layouts[l]);
+    ERROR_T rc;
+    double  start, setup, firstread, firstwrite, reread;
+    struct stat st;
+
+    {
+      DiskSystem disk(stem,true,0,numblocks,blocksize,1,1,numblocks,10,1,1);
+
+      start=now();
+      if ((rc=disk.SetDataLayout(layouts[l]))!=ERROR_NOERROR) {
+	cerr << "Can't lay out "<<stem<<" due to error "<<rc<<endl;
+	continue;
+      }
+      setup=now()-start;
+
+      start=now();
+      rc=touch(disk,order,false);
+      firstread=now()-start;
+
+      start=now();
+      rc = rc ? rc : touch(disk,order,true);
+      firstwrite=now()-start;
+
+      start=now();
+      rc = rc ? rc : touch(disk,order,false);
+      reread=now()-start;
+
+      if (rc!=ERROR_NOERROR) {
+	cerr << "Error "<<rc<<" occured on "<<stem<<endl;
+	return -1;
+      }
+    }
+
+    stat((stem+".data").c_str(),&st);
+
+    cout << "layout="<<DiskDataLayoutName(layouts[l])
+	 << " setup="<<setup
+	 << " firstread="<<firstread
+	 << " firstwrite="<<firstwrite
+	 << " reread="<<reread
+	 << " filebytes="<<st.st_size
+	 << " allocatedbytes="<<(long long)st.st_blocks*512
+	 << endl;
+
+    remove((stem+".data").c_str());
+    remove((stem+".bitmap").c_str());
+    remove((stem+".config").c_str());
+  }
+
+  return 0;
+}
@@ -1,7 +1,9 @@
 #include <string>
+#include <memory>
 #include <stdlib.h>
 
 #include "buffercache.h"
+#include "stripeddisk.h"
 
 
 void usage() 
@@ -15,14 +17,22 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T cachesize;
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
-  DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(argv[1]));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<argv[1]<<"\n";
+    return -1;
+  }
+  if (ParseCacheSize(argv[2],disk->GetBlockSize(),cachesize)!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+  BufferCache cache(disk.get(),cachesize);
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T blocksize = disk->GetBlockSize();
 
   cache.Attach();
 
@@ -57,6 +67,7 @@ int main(int argc, char *argv[])
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+  DumpStatsJSON(cache,"writebuffer");
 
   return 0;
 }
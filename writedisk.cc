@@ -1,7 +1,8 @@
 #include <string>
+#include <memory>
 #include <stdlib.h>
 
-#include "disksystem.h"
+#include "stripeddisk.h"
 
 
 void usage() 
@@ -19,8 +20,12 @@ int main(int argc, char *argv[])
   SIZE_T numblocks=atoi(argv[3]);
   double reqtime;
 
-  DiskSystem disk(argv[1]);
-  SIZE_T blocksize = disk.GetBlockSize();
+  unique_ptr<DiskSystem> disk(OpenDiskSystem(argv[1]));
+  if (!disk.get()) {
+    cerr << "Can't open the disk "<<argv[1]<<"\n";
+    return -1;
+  }
+  SIZE_T blocksize = disk->GetBlockSize();
 
   vector<Block> b;
 
@@ -33,7 +38,7 @@ int main(int argc, char *argv[])
   }
 
 
-  ERROR_T rc= disk.Write(blocknum, numblocks, b, reqtime);
+  ERROR_T rc= disk->Write(blocknum, numblocks, b, reqtime);
 
   if (rc!=ERROR_NOERROR) { 
     cerr << "Error "<< rc << " occured.\n";